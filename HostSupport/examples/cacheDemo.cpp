@@ -32,6 +32,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
     
 #include "ofxhPluginCache.h"
 #include "ofxhPropertySuite.h"
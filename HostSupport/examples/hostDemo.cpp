@@ -30,7 +30,17 @@ modification, are permitted provided that the following conditions are met:
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 // ofx
 #include "ofxCore.h"
@@ -48,11 +58,14 @@ modification, are permitted provided that the following conditions are met:
 #include "ofxhPluginCache.h"
 #include "ofxhHost.h"
 #include "ofxhImageEffectAPI.h"
+#include "ofxhParallelRender.h"
+#include "ofxhPixelConvert.h"
 
 // my host
 #include "hostDemoHostDescriptor.h"
 #include "hostDemoEffectInstance.h"
 #include "hostDemoClipInstance.h"
+#include "hostDemoSequenceClip.h"
    
 ////////////////////////////////////////////////////////////////////////////////
 // This example code can only work with the example 'invert' plugin built
@@ -69,29 +82,245 @@ modification, are permitted provided that the following conditions are met:
 // It works by hard coding progressive PAL SD imagery to input and output clips,
 // the images are black going in (and should be white coming out of the plugin).
 //
-// There is no file io to work with this.
+// Or, given -source, it reads the input from a sequence of frame files, which are mapped
+// and handed to the plugin as they are where it can take them, see SequenceClipInstance.
+// The pattern is printf style with one %d or %0Nd for the frame, eg: plate.%04d.ppm, and
+// raw files need -size.
+//
+// Each frame rendered is written to Output.<frame>.<format>, see FrameWriter, and the
+// number of frames and bytes written a second is reported at the end. Run it as...
+//
+//     hostDemo [-format ppm|pfm|raw] [-frames n] [-source pattern] [-size WxH]
+
+/// the formats frames can be written as
+enum OutputFormat {
+  eOutputPPM,  ///< binary 8 bit RGB, top row first
+  eOutputPFM,  ///< little endian 32 bit float RGB, bottom row first
+  eOutputRaw   ///< 8 bit planar, all of R, then G, B and A, top row first, no header
+};
+
+static const char *outputExtension(OutputFormat format)
+{
+  switch(format) {
+  case eOutputPFM : return "pfm";
+  case eOutputRaw : return "raw";
+  default         : return "ppm";
+  }
+}
+
+/// a frame copied out of the output image, rows packed top row first
+struct Frame {
+  std::vector<OfxRGBAColourB> pixels;
+  int                         width;
+  int                         height;
+  OfxTime                     time;
+
+  Frame() : width(0), height(0), time(0) {}
+};
 
-void exportToPPM(const std::string& fname, MyHost::MyImage* im)
+/// copy an image's pixels into a frame as byte RGBA, whatever its depth and components
+/// and whichever way up it lies in memory
+static void copyFrame(MyHost::MyImage &image, OfxTime time, Frame &frame)
 {
-  std::ofstream op(fname.c_str());
-  OfxRectI rod = im->getROD();
-  op << "P3" << "\t# FORMAT" << std::endl;
-  op << rod.x2 - rod.x1 << "\t#WIDTH" << std::endl;
-  op << rod.y2 - rod.y1 << "\t#HEIGHT" <<std::endl;
-  //This assumes 8-bit.
-  op << "255" << std::endl;
-  for (int y = rod.y1; y< rod.y2; ++y)
+  OfxRectI bounds = image.getBounds();
+  frame.width = bounds.x2 - bounds.x1;
+  frame.height = bounds.y2 - bounds.y1;
+  frame.time = time;
+  frame.pixels.resize(size_t(frame.width) * frame.height);
+  if(frame.pixels.empty())
+    return;
+
+  // the frame's rows run top down, so address it from its last row
+  OFX::Host::PixelConvert::Buffer dst;
+  dst.rowBytes = -int(frame.width * sizeof(OfxRGBAColourB));
+  dst.data = &frame.pixels[size_t(frame.height - 1) * frame.width];
+  dst.bounds = bounds;
+  dst.depth = OFX::Host::PixelConvert::eDepthByte;
+  dst.components = OFX::Host::PixelConvert::eComponentsRGBA;
+  dst.preMultiplication = OFX::Host::PixelConvert::mapPreMultiplication(image.getStringProperty(kOfxImageEffectPropPreMultiplication));
+
+  OFX::Host::PixelConvert::convert(OFX::Host::PixelConvert::getBuffer(image), dst, bounds);
+}
+
+/// encode a frame as a whole file in the given format
+static void encodeFrame(const Frame &frame, OutputFormat format, std::vector<char> &bytes)
+{
+  size_t nPixels = frame.pixels.size();
+  const OfxRGBAColourB *pixels = nPixels ? &frame.pixels[0] : 0;
+  char header[64];
+  int headerBytes = 0;
+
+  switch(format) {
+  case eOutputPPM : {
+    headerBytes = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", frame.width, frame.height);
+    bytes.resize(headerBytes + nPixels * 3);
+    char *dst = &bytes[headerBytes];
+    for(size_t i = 0; i < nPixels; ++i) {
+      *dst++ = pixels[i].r;
+      *dst++ = pixels[i].g;
+      *dst++ = pixels[i].b;
+    }
+    break;
+  }
+  case eOutputPFM : {
+    // a negative scale says the floats are little endian
+    headerBytes = snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", frame.width, frame.height);
+    bytes.resize(headerBytes + nPixels * 3 * sizeof(float));
+    float *dst = reinterpret_cast<float *>(&bytes[headerBytes]);
+    for(int y = frame.height - 1; y >= 0; --y) {
+      const OfxRGBAColourB *src = pixels + size_t(y) * frame.width;
+      for(int x = 0; x < frame.width; ++x) {
+        *dst++ = src[x].r * (1.0f / 255.0f);
+        *dst++ = src[x].g * (1.0f / 255.0f);
+        *dst++ = src[x].b * (1.0f / 255.0f);
+      }
+    }
+    break;
+  }
+  case eOutputRaw : {
+    bytes.resize(nPixels * 4);
+    char *r = nPixels ? &bytes[0] : 0, *g = r + nPixels, *b = g + nPixels, *a = b + nPixels;
+    for(size_t i = 0; i < nPixels; ++i) {
+      r[i] = pixels[i].r;
+      g[i] = pixels[i].g;
+      b[i] = pixels[i].b;
+      a[i] = pixels[i].a;
+    }
+    break;
+  }
+  }
+
+  if(headerBytes)
+    memcpy(&bytes[0], header, headerBytes);
+}
+
+/// Writes each frame rendered by the effect to Output.<frame>.<format> on a thread of its
+/// own, so frames are written while the next ones render. There are two frame buffers, the
+/// render only waits for the writer if it gets two frames ahead of it.
+class FrameWriter : public OFX::Host::ImageEffect::FrameRenderListener {
+  typedef std::chrono::steady_clock Clock;
+
+  OutputFormat            _format;
+  Frame                   _frames[2];
+  bool                    _full[2];       ///< is the frame waiting to be written
+  int                     _next;          ///< the buffer the next frame rendered goes in
+  bool                    _finishing;     ///< no more frames are coming
+  std::mutex              _lock;          ///< guards the above
+  std::condition_variable _changed;
+  std::thread             _thread;
+
+  // written by the writer thread, read once it has finished
+  int                     _nFrames;
+  unsigned long long      _nBytes;
+  double                  _writeSeconds;  ///< time spent encoding and writing
+  Clock::time_point       _start;
+
+  void writeFrames()
+  {
+    std::vector<char> bytes;
+    for(int i = 0; ; i ^= 1) {
+      {
+        std::unique_lock<std::mutex> guard(_lock);
+        while(!_full[i] && !_finishing)
+          _changed.wait(guard);
+        if(!_full[i])
+          return;
+      }
+
+      Clock::time_point start = Clock::now();
+      const Frame &frame = _frames[i];
+      encodeFrame(frame, _format, bytes);
+
+      std::ostringstream name;
+      name << "Output." << frame.time << "." << outputExtension(_format);
+      FILE *file = fopen(name.str().c_str(), "wb");
+      if(!file || fwrite(&bytes[0], 1, bytes.size(), file) != bytes.size())
+        std::cerr << "hostDemo: could not write " << name.str() << std::endl;
+      else {
+        ++_nFrames;
+        _nBytes += bytes.size();
+      }
+      if(file)
+        fclose(file);
+      _writeSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _full[i] = false;
+      }
+      _changed.notify_all();
+    }
+  }
+
+public :
+  explicit FrameWriter(OutputFormat format)
+    : _format(format)
+    , _next(0)
+    , _finishing(false)
+    , _nFrames(0)
+    , _nBytes(0)
+    , _writeSeconds(0)
+    , _start(Clock::now())
+  {
+    _full[0] = _full[1] = false;
+    _thread = std::thread(&FrameWriter::writeFrames, this);
+  }
+
+  ~FrameWriter()
+  {
+    if(_thread.joinable())
+      finish();
+  }
+
+  /// wait for the frames still buffered to be written, then report the throughput
+  void finish()
   {
-    for (int x = rod.x1; x < rod.x2; ++x)
     {
-      OfxRGBAColourB* pix = im->pixel(x,y);
-      if(pix)
-        op << (int)pix->r << " " << (int)pix->g << " " << (int)pix->b << " " << std::endl;
-      else
-        op << "0 0 0" << std::endl;
+      std::lock_guard<std::mutex> guard(_lock);
+      _finishing = true;
     }
+    _changed.notify_all();
+    _thread.join();
+
+    double seconds = std::chrono::duration<double>(Clock::now() - _start).count();
+    double megabytes = _nBytes / (1024.0 * 1024.0);
+    std::cout << "wrote " << _nFrames << " frames, " << megabytes << " MB in " << seconds << "s, "
+              << (seconds > 0 ? _nFrames / seconds : 0) << " fps, "
+              << (_writeSeconds > 0 ? megabytes / _writeSeconds : 0) << " MB/s written" << std::endl;
   }
-}
+
+  virtual void frameRendered(OFX::Host::ImageEffect::Instance &effect, OfxTime time, OfxStatus stat)
+  {
+    if(stat != kOfxStatOK)
+      return;
+
+    // get the output image buffer
+    MyHost::MyClipInstance* outputClip = dynamic_cast<MyHost::MyClipInstance*>(effect.getClip("Output"));
+    assert(outputClip);
+    MyHost::MyImage *outputImage = outputClip->getOutputImage();
+    if(!outputImage)
+      return;
+
+    // wait for the writer to be done with the buffer, then copy the frame out before the
+    // next render overwrites the output image
+    int i;
+    {
+      std::unique_lock<std::mutex> guard(_lock);
+      while(_full[_next])
+        _changed.wait(guard);
+      i = _next;
+    }
+
+    copyFrame(*outputImage, time, _frames[i]);
+
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      _full[i] = true;
+      _next = i ^ 1;
+    }
+    _changed.notify_all();
+  }
+};
 
 int main(int argc, char **argv) 
 {
@@ -99,6 +328,45 @@ int main(int argc, char **argv)
 #ifdef _WIN32
   _CrtSetDbgFlag ( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
+  // read the command line
+  OutputFormat format = eOutputPPM;
+  int numFramesToRender = int(OFXHOSTDEMOCLIPLENGTH) + 1;
+  bool framesGiven = false;
+  MyHost::SequenceSpec sequence;
+  for(int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if(arg == "-format" && i + 1 < argc) {
+      std::string name = argv[++i];
+      if(name == "ppm")
+        format = eOutputPPM;
+      else if(name == "pfm")
+        format = eOutputPFM;
+      else if(name == "raw")
+        format = eOutputRaw;
+      else {
+        std::cerr << "hostDemo: unknown format " << name << std::endl;
+        return 1;
+      }
+    }
+    else if(arg == "-frames" && i + 1 < argc) {
+      numFramesToRender = std::max(1, atoi(argv[++i]));
+      framesGiven = true;
+    }
+    else if(arg == "-source" && i + 1 < argc) {
+      sequence.pattern = argv[++i];
+      if(!MyHost::isFramePattern(sequence.pattern)) {
+        std::cerr << "hostDemo: the source pattern needs exactly one %d or %0Nd for the frame number" << std::endl;
+        return 1;
+      }
+    }
+    else if(arg == "-size" && i + 1 < argc)
+      sscanf(argv[++i], "%dx%d", &sequence.width, &sequence.height);
+    else {
+      std::cerr << "usage: hostDemo [-format ppm|pfm|raw] [-frames n] [-source pattern] [-size WxH]" << std::endl;
+      return 1;
+    }
+  }
+
   // set the version label in the global cache
   OFX::Host::PluginCache::getPluginCache()->setCacheVersion("hostDemoV1");
 
@@ -126,15 +394,25 @@ int main(int argc, char **argv)
   of.close();
 
   // get the invert example plugin which uses the OFX C++ support code
-  OFX::Host::ImageEffect::ImageEffectPlugin* plugin = imageEffectPluginCache.getPluginById("net.sf.openfx:invertPlugin");
+  OFX::Host::ImageEffect::ImageEffectPlugin* plugin = imageEffectPluginCache.getPluginById("net.sf.openfx.invertPlugin");
 
   imageEffectPluginCache.dumpToStdOut();
 
   if(plugin) {
     // create an instance of it as a filter
-    // the first arg is the context, the second is client data we are allowed to pass down the call chain
-
-    std::auto_ptr<OFX::Host::ImageEffect::Instance> instance(plugin->createInstance(kOfxImageEffectContextFilter, NULL));
+    // the first arg is the context, the second is client data we are allowed to pass down the call chain,
+    // which our host takes as the sequence of files to read the source from
+
+    std::auto_ptr<OFX::Host::ImageEffect::Instance> instance(plugin->createInstance(kOfxImageEffectContextFilter,
+                                                                                    sequence.pattern.empty() ? NULL : &sequence));
+    MyHost::SequenceClipInstance *source = 0;
+    if(instance.get() && !sequence.pattern.empty()) {
+      source = dynamic_cast<MyHost::SequenceClipInstance *>(instance->getClip(kOfxImageEffectSimpleSourceClipName));
+      if(!source || !source->isValid()) {
+        std::cerr << "hostDemo: could not read the sequence " << sequence.pattern << std::endl;
+        return 1;
+      }
+    }
 
     if(instance.get())
     {
@@ -161,54 +439,35 @@ int main(int argc, char **argv)
       renderWindow.x1 = renderWindow.y1 = 0;
       renderWindow.x2 = 720;
       renderWindow.y2 = 576;
-
-      /// RoI is in canonical coords, 
-      OfxRectD  regionOfInterest;
-      regionOfInterest.x1 = regionOfInterest.y1 = 0;
-      regionOfInterest.x2 = renderWindow.x2 * instance->getProjectPixelAspectRatio();
-      regionOfInterest.y2 = 576;
-      
-      int numFramesToRender = OFXHOSTDEMOCLIPLENGTH;
-
-      // say we are about to render a bunch of frames 
-      stat = instance->beginRenderAction(0, numFramesToRender, 1.0, false, renderScale, /*sequential=*/true, /*interactive=*/false
-                                         );
-      assert(stat == kOfxStatOK || stat == kOfxStatReplyDefault);
-
-      // get the output clip
-      MyHost::MyClipInstance* outputClip = dynamic_cast<MyHost::MyClipInstance*>(instance->getClip("Output"));
-      assert(outputClip);
-
-      for(int t = 0; t <= numFramesToRender; ++t) 
-      {
-        // call get region of interest on each of the inputs
-        OfxTime frame = t;
-
-        // get the RoI for each input clip
-        // the regions of interest for each input clip are returned in a std::map
-        // on a real host, these will be the regions of each input clip that the
-        // effect needs to render a given frame (clipped to the RoD).
-        //
-        // In our example we are doing full frame fetches regardless.
-        std::map<OFX::Host::ImageEffect::ClipInstance *, OfxRectD> rois;
-        stat = instance->getRegionOfInterestAction(frame, renderScale,
-                                                   regionOfInterest, rois);
-        assert(stat == kOfxStatOK || stat == kOfxStatReplyDefault);
-
-        // render a frame
-        stat = instance->renderAction(t,kOfxImageFieldBoth,renderWindow, renderScale, /*sequential=*/true, /*interactive=*/false, /*draft=*/false);
-        assert(stat == kOfxStatOK);
-
-        // get the output image buffer
-        MyHost::MyImage *outputImage = outputClip->getOutputImage();
-
-        std::ostringstream ss;
-        ss << "Output." << t << ".ppm";
-        exportToPPM(ss.str(), outputImage);
+      if(source)
+        renderWindow = source->getBounds();
+
+
+      // Render the frames, renderSequence calls the begin sequence render action, then
+      // the render action for each frame, then the end sequence render action. While a
+      // frame renders, the inputs of the next few are fetched in the background, using
+      // the frames needed and region of interest actions to say what they are.
+      //
+      // Our output clip has the one image for all renders, so render a frame at a time,
+      // the writer copies each out straight after it has rendered, then writes it while
+      // the next one renders.
+      OFX::Host::ImageEffect::SequenceRenderOptions options;
+      options.field = kOfxImageFieldBoth;
+      options.maxThreads = 1;
+
+      OfxRangeD range;
+      range.min = 0;
+      range.max = numFramesToRender - 1;
+      if(source) {
+        source->getFrameRange(range.min, range.max);
+        if(framesGiven)
+          range.max = std::min(range.max, range.min + numFramesToRender - 1);
       }
 
-      instance->endRenderAction(0, numFramesToRender, 1.0, false, renderScale, /*sequential=*/true, /*interactive=*/false
-                                );
+      FrameWriter writer(format);
+      stat = instance->renderSequence(range, 1.0, renderWindow, renderScale, options, &writer);
+      assert(stat == kOfxStatOK);
+      writer.finish();
     }
   }
   OFX::Host::PluginCache::clearPluginCache();
@@ -49,11 +49,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ofxhPluginCache.h"
 #include "ofxhHost.h"
 #include "ofxhImageEffectAPI.h"
+#include "ofxhPixelConvert.h"
 
 // my host
 #include "hostDemoHostDescriptor.h"
 #include "hostDemoEffectInstance.h"
 #include "hostDemoClipInstance.h"
+#include "hostDemoSequenceClip.h"
 
 // We are hard coding everything in our example, in a real host you
 // need to enquire things from your host.
@@ -184,8 +186,10 @@ namespace MyHost {
     setDoubleProperty(kOfxImageEffectPropRenderScale, 1.0, 0);
     setDoubleProperty(kOfxImageEffectPropRenderScale, 1.0, 1); 
 
-    // data ptr
-    setPointerProperty(kOfxImagePropData,_data);
+    // data ptr, we drew the frame top down in memory, as most image files and
+    // video APIs hand frames over, so point at the bottom row and walk up it
+    // with negative row bytes rather than flipping the frame
+    setPointerProperty(kOfxImagePropData,_data + (kPalSizeYPixels - 1) * kPalSizeXPixels);
 
     // bounds and rod
     setIntProperty(kOfxImagePropBounds, kPalRegionPixels.x1, 0);
@@ -199,7 +203,30 @@ namespace MyHost {
     setIntProperty(kOfxImagePropRegionOfDefinition, kPalRegionPixels.y2, 3);        
 
     // row bytes
-    setIntProperty(kOfxImagePropRowBytes, kPalSizeXPixels * sizeof(OfxRGBAColourB));
+    setIntProperty(kOfxImagePropRowBytes, -int(kPalSizeXPixels * sizeof(OfxRGBAColourB)));
+  }
+
+  MyImage::MyImage(MyClipInstance &clip, const OfxRectI &bounds)
+    : OFX::Host::ImageEffect::Image(clip) /// this ctor will set basic props on the image
+    , _data(NULL)
+  {
+    using namespace OFX::Host::PixelConvert;
+    int pixelBytes = getComponentBytes(mapDepth(clip.getPixelDepth())) * getComponentCount(mapComponents(clip.getComponents()));
+    int rowBytes = (bounds.x2 - bounds.x1) * pixelBytes;
+    int height = bounds.y2 - bounds.y1;
+
+    // counted in our byte RGBA pixels, which any other depth's pixels are a whole number of
+    size_t bytes = size_t(rowBytes) * height;
+    _data = new OfxRGBAColourB[(bytes + sizeof(OfxRGBAColourB) - 1) / sizeof(OfxRGBAColourB)]();
+
+    setDoubleProperty(kOfxImageEffectPropRenderScale, 1.0, 0);
+    setDoubleProperty(kOfxImageEffectPropRenderScale, 1.0, 1);
+
+    // top down in memory, as the PAL frames are
+    setPointerProperty(kOfxImagePropData, reinterpret_cast<char *>(_data) + ptrdiff_t(height > 0 ? height - 1 : 0) * rowBytes);
+    setIntPropertyN(kOfxImagePropBounds, &bounds.x1, 4);
+    setIntPropertyN(kOfxImagePropRegionOfDefinition, &bounds.x1, 4);
+    setIntProperty(kOfxImagePropRowBytes, -rowBytes);
   }
 
   OfxRGBAColourB* MyImage::pixel(int x, int y) const
@@ -208,15 +235,15 @@ namespace MyHost {
     if ((x >= bounds.x1) && ( x< bounds.x2) && ( y >= bounds.y1) && ( y < bounds.y2) )
     {
       int rowBytes = getIntProperty(kOfxImagePropRowBytes);
-      int offset = (y - bounds.y1) * rowBytes + (x - bounds.x1) * sizeof(OfxRGBAColourB);
-      return reinterpret_cast<OfxRGBAColourB*>(&(reinterpret_cast<char*>(_data)[offset]));
+      int offset = (y - bounds.y1) * rowBytes + (x - bounds.x1) * int(sizeof(OfxRGBAColourB));
+      return reinterpret_cast<OfxRGBAColourB*>(&(reinterpret_cast<char*>(getPointerProperty(kOfxImagePropData))[offset]));
     }
     return 0;
   }
 
   MyImage::~MyImage() 
   {
-    delete _data;
+    delete [] _data;
   }
 
   MyClipInstance::MyClipInstance(MyEffectInstance* effect, OFX::Host::ImageEffect::ClipDescriptor *desc)
@@ -224,13 +251,22 @@ namespace MyHost {
     , _effect(effect)
     , _name(desc->getName())
     , _outputImage(NULL)
+    , _inputFrame(NULL)
+    , _inputTime(0)
   {
   }
 
+  SequenceClipInstance *MyClipInstance::getSequenceSource() const
+  {
+    return dynamic_cast<SequenceClipInstance *>(_effect->getClip(kOfxImageEffectSimpleSourceClipName));
+  }
+
   MyClipInstance::~MyClipInstance()
   {
     if(_outputImage)
       _outputImage->releaseReference();
+    if(_inputFrame)
+      _inputFrame->releaseReference();
   }
    
   /// Get the Raw Unmapped Pixel Depth from the host. We are always 8 bits in our example
@@ -338,6 +374,12 @@ namespace MyHost {
   OfxRectD MyClipInstance::getRegionOfDefinition(OfxTime time) const
   {
     /// our clip is pretending to be progressive PAL SD, so return 0<=x<768, 0<=y<576 
+    // unless we are the output of an effect reading files, then we are what they are
+    if(_name == "Output") {
+      if(SequenceClipInstance *source = getSequenceSource())
+        return source->getRegionOfDefinition(time);
+    }
+
     OfxRectD v;
     v.x1 = v.y1 = 0;
     v.x2 = 768;
@@ -355,8 +397,9 @@ namespace MyHost {
   {
     if(_name == "Output") {
       if(!_outputImage) {
-        // make a new ref counted image
-        _outputImage = new MyImage(*this, 0);
+        // make a new ref counted image, the size of the input if that is read from files
+        SequenceClipInstance *source = getSequenceSource();
+        _outputImage = source ? new MyImage(*this, source->getBounds()) : new MyImage(*this, 0);
       }
      
       // add another reference to the member image for this fetch
@@ -369,13 +412,28 @@ namespace MyHost {
       return _outputImage;
     }
     else {
-      // Fetch on demand for the input clip.
-      // It does get deleted after the plugin is done with it as we
-      // have not incremented the auto ref
-      // 
+      // Make the input frame on demand and keep the last one, so that
+      // fetches of the same frame, say for each tile of a render, share
+      // its pixels. We keep a reference and give one to the caller.
+      //
       // You should do somewhat more sophisticated image management
       // than this.
-      MyImage *image = new MyImage(*this, time);
+      OFX::Host::ImageEffect::Image *image;
+      {
+        std::lock_guard<std::mutex> guard(_inputLock);
+        if(!_inputFrame || _inputTime != time) {
+          if(_inputFrame)
+            _inputFrame->releaseReference();
+          _inputFrame = new MyImage(*this, time);
+          _inputTime = time;
+        }
+        _inputFrame->addReference();
+        image = _inputFrame;
+      }
+
+      // only hand out the part asked for, as a view on the frame's pixels
+      if(optionalBounds)
+        image = OFX::Host::ImageEffect::cropImage(image, *optionalBounds);
       return image;
     }
   }
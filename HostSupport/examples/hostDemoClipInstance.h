@@ -36,6 +36,7 @@ namespace MyHost {
 
   // foward
   class MyClipInstance;
+  class SequenceClipInstance;
 
   /// make an image up
   class MyImage : public OFX::Host::ImageEffect::Image 
@@ -44,6 +45,9 @@ namespace MyHost {
     OfxRGBAColourB   *_data; // where we are keeping our image data
   public :
     explicit MyImage(MyClipInstance &clip, OfxTime t, int view = 0);
+
+    /// a black image of the clip's depth and components
+    MyImage(MyClipInstance &clip, const OfxRectI &bounds);
     OfxRGBAColourB* pixel(int x, int y) const;
     ~MyImage();
   };
@@ -53,6 +57,12 @@ namespace MyHost {
     MyEffectInstance *_effect;
     std::string       _name;
     MyImage          *_outputImage; ///< only set for output clips
+    MyImage          *_inputFrame;  ///< the last input frame made, fetches are views on it
+    OfxTime           _inputTime;   ///< the time of _inputFrame
+    std::mutex        _inputLock;   ///< guards the above, as tiles fetch from several threads
+
+    /// the effect's source clip if it reads a sequence of files, NULL if it is made up
+    SequenceClipInstance *getSequenceSource() const;
 
   public:
     MyClipInstance(MyEffectInstance* effect, OFX::Host::ImageEffect::ClipDescriptor* desc);
@@ -51,6 +51,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "hostDemoHostDescriptor.h"
 #include "hostDemoEffectInstance.h"
 #include "hostDemoClipInstance.h"
+#include "hostDemoSequenceClip.h"
 #include "hostDemoParamInstance.h"
 
 // my host support code
@@ -58,8 +59,10 @@ namespace MyHost {
 
   MyEffectInstance::MyEffectInstance(OFX::Host::ImageEffect::ImageEffectPlugin* plugin,
                                      OFX::Host::ImageEffect::Descriptor& desc,
-                                     const std::string& context) 
+                                     const std::string& context,
+                                     const SequenceSpec *source)
                                      : OFX::Host::ImageEffect::Instance(plugin,desc,context,false)
+                                     , _source(source)
   {
   }
 
@@ -70,6 +73,8 @@ namespace MyHost {
                                                                           OFX::Host::ImageEffect::ClipDescriptor* descriptor,
                                                                           int index)
   {
+    if(_source && descriptor->getName() == kOfxImageEffectSimpleSourceClipName)
+      return new SequenceClipInstance(this, descriptor, *_source);
     return new MyClipInstance(this,descriptor);
   }
 
@@ -32,12 +32,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace MyHost {
 
+  struct SequenceSpec;
+
   // class definition
   class MyEffectInstance : public OFX::Host::ImageEffect::Instance {
+  protected:
+    const SequenceSpec *_source;  ///< the files the source clip reads, NULL if it is made up
+
   public:
+    /// if source is not NULL the source clip reads that sequence of files, it must
+    /// outlive the instance
     MyEffectInstance(OFX::Host::ImageEffect::ImageEffectPlugin* plugin,
                      OFX::Host::ImageEffect::Descriptor& desc,
-                     const std::string& context);
+                     const std::string& context,
+                     const SequenceSpec *source = NULL);
 
     ////////////////////////////////////////////////////////////////////////////////
     ////////////////////////////////////////////////////////////////////////////////
@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
 
 // ofx
 #include "ofxCore.h"
@@ -95,7 +96,8 @@ namespace MyHost
                                                       OFX::Host::ImageEffect::Descriptor& desc,
                                                       const std::string& context)
   {
-    return new MyEffectInstance(plugin, desc, context);
+    // the client data is the sequence of files to read the source clip from, if any
+    return new MyEffectInstance(plugin, desc, context, static_cast<const SequenceSpec *>(clientData));
   }
   
   /// Override this to create a descriptor, this makes the 'root' descriptor
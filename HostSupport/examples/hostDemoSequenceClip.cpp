@@ -0,0 +1,382 @@
+/*
+Software License :
+
+Copyright (c) 2007, The Open Effects Association Ltd. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <iostream>
+
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <mutex>
+
+#include <sys/stat.h>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+#include "ofxPixels.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhParam.h"
+#include "ofxhMemory.h"
+#include "ofxhImageEffect.h"
+#include "ofxhPixelConvert.h"
+
+// my host
+#include "hostDemoHostDescriptor.h"
+#include "hostDemoEffectInstance.h"
+#include "hostDemoClipInstance.h"
+#include "hostDemoSequenceClip.h"
+
+#if defined(UNIX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace MyHost {
+
+#if defined(UNIX)
+  /// A frame whose pixels are a read only mapping of its file, which is unmapped when
+  /// the last reference goes.
+  class MappedFrame : public OFX::Host::ImageEffect::Image {
+  protected :
+    void   *_mapping;
+    size_t  _size;
+
+  public :
+    MappedFrame(OFX::Host::ImageEffect::ClipInstance &clip, const SequenceLayout &layout,
+                void *mapping, size_t size, const std::string &uniqueIdentifier)
+      : OFX::Host::ImageEffect::Image(clip)
+      , _mapping(mapping)
+      , _size(size)
+    {
+      OfxRectI bounds = {0, 0, layout.width, layout.height};
+      int rowBytes = int(layout.getRowBytes());
+      char *data = static_cast<char *>(mapping) + layout.offset;
+
+      // files that are top row first are walked up from their last row
+      if(!layout.bottomUp) {
+        data += ptrdiff_t(layout.height - 1) * rowBytes;
+        rowBytes = -rowBytes;
+      }
+
+      setDoubleProperty(kOfxImageEffectPropRenderScale, 1.0, 0);
+      setDoubleProperty(kOfxImageEffectPropRenderScale, 1.0, 1);
+      setPointerProperty(kOfxImagePropData, data);
+      setIntPropertyN(kOfxImagePropBounds, &bounds.x1, 4);
+      setIntPropertyN(kOfxImagePropRegionOfDefinition, &bounds.x1, 4);
+      setIntProperty(kOfxImagePropRowBytes, rowBytes);
+      setStringProperty(kOfxImagePropField, kOfxImageFieldNone);
+      setStringProperty(kOfxImagePropUniqueIdentifier, uniqueIdentifier);
+
+      // as the file has it, which may not be as the clip is mapped
+      setStringProperty(kOfxImageEffectPropPixelDepth, layout.depth);
+      setStringProperty(kOfxImageEffectPropComponents, layout.components);
+    }
+
+    virtual ~MappedFrame()
+    {
+      munmap(_mapping, _size);
+    }
+  };
+#endif
+
+  size_t SequenceLayout::getRowBytes() const
+  {
+    OFX::Host::PixelConvert::Depth d = OFX::Host::PixelConvert::mapDepth(depth);
+    OFX::Host::PixelConvert::Components c = OFX::Host::PixelConvert::mapComponents(components);
+    return size_t(width) * OFX::Host::PixelConvert::getComponentBytes(d) * OFX::Host::PixelConvert::getComponentCount(c);
+  }
+
+  /// does the file name end with the extension
+  static bool hasExtension(const std::string &path, const char *extension)
+  {
+    size_t n = strlen(extension);
+    return path.size() > n && path.compare(path.size() - n, n, extension) == 0;
+  }
+
+  bool readSequenceLayout(const std::string &path, const SequenceSpec &spec, SequenceLayout &layout)
+  {
+    if(hasExtension(path, ".raw")) {
+      if(spec.width <= 0 || spec.height <= 0)
+        return false;
+      layout.depth = kOfxBitDepthByte;
+      layout.components = kOfxImageComponentRGBA;
+      layout.width = spec.width;
+      layout.height = spec.height;
+      layout.offset = 0;
+      layout.bottomUp = false;
+      return true;
+    }
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if(!file)
+      return false;
+
+    // both headers are a magic number then whitespace separated values, then one
+    // whitespace character before the pixels
+    char magic[3] = {0, 0, 0};
+    bool ok = false;
+    if(fread(magic, 1, 2, file) == 2) {
+      if(hasExtension(path, ".ppm") && strcmp(magic, "P6") == 0) {
+        int maxValue = 0;
+        ok = fscanf(file, "%d %d %d", &layout.width, &layout.height, &maxValue) == 3 && maxValue == 255;
+        layout.depth = kOfxBitDepthByte;
+        layout.components = kOfxImageComponentRGB;
+        layout.bottomUp = false;
+      }
+      else if(hasExtension(path, ".pfm") && (strcmp(magic, "PF") == 0 || strcmp(magic, "Pf") == 0)) {
+        // a negative scale is little endian, we don't swap big endian files
+        double scale = 0;
+        ok = fscanf(file, "%d %d %lf", &layout.width, &layout.height, &scale) == 3 && scale < 0;
+        layout.depth = kOfxBitDepthFloat;
+        layout.components = magic[1] == 'F' ? kOfxImageComponentRGB : kOfxImageComponentAlpha;
+        layout.bottomUp = true;
+      }
+    }
+    if(ok && fgetc(file) != EOF)
+      layout.offset = size_t(ftell(file));
+    else
+      ok = false;
+
+    fclose(file);
+    return ok && layout.width > 0 && layout.height > 0;
+  }
+
+  bool isFramePattern(const std::string &pattern)
+  {
+    int conversions = 0;
+    for(size_t i = 0; i < pattern.size(); ++i) {
+      if(pattern[i] != '%')
+        continue;
+      if(++i < pattern.size() && pattern[i] == '%')
+        continue;
+
+      // an optional zero padded width, then the d
+      if(i < pattern.size() && pattern[i] == '0')
+        ++i;
+      while(i < pattern.size() && isdigit((unsigned char)pattern[i]))
+        ++i;
+      if(i >= pattern.size() || pattern[i] != 'd')
+        return false;
+      ++conversions;
+    }
+    return conversions == 1;
+  }
+
+  SequenceClipInstance::SequenceClipInstance(MyEffectInstance* effect, OFX::Host::ImageEffect::ClipDescriptor* desc,
+                                             const SequenceSpec &spec)
+    : MyClipInstance(effect, desc)
+    , _spec(spec)
+    , _valid(false)
+    , _firstFrame(0)
+    , _lastFrame(0)
+    , _frame(NULL)
+    , _frameTime(0)
+  {
+    // the pattern is handed to snprintf
+    if(!isFramePattern(_spec.pattern))
+      return;
+
+    // sequences start at 0 or 1 and run until a frame is missing
+    struct stat info;
+    if(stat(getFramePath(0).c_str(), &info) != 0)
+      _firstFrame = 1;
+#if defined(UNIX)
+    _valid = readSequenceLayout(getFramePath(_firstFrame), _spec, _layout);
+#endif
+    _lastFrame = _firstFrame;
+    while(_valid && stat(getFramePath(_lastFrame + 1).c_str(), &info) == 0)
+      ++_lastFrame;
+  }
+
+  SequenceClipInstance::~SequenceClipInstance()
+  {
+    if(_frame)
+      _frame->releaseReference();
+  }
+
+  std::string SequenceClipInstance::getFramePath(int frame) const
+  {
+    char path[4096];
+    snprintf(path, sizeof(path), _spec.pattern.c_str(), frame);
+    return path;
+  }
+
+  OfxRectI SequenceClipInstance::getBounds() const
+  {
+    OfxRectI bounds = {0, 0, _layout.width, _layout.height};
+    return bounds;
+  }
+
+  const std::string &SequenceClipInstance::getUnmappedBitDepth() const
+  {
+    return _layout.depth;
+  }
+
+  const std::string &SequenceClipInstance::getUnmappedComponents() const
+  {
+    return _layout.components;
+  }
+
+  const std::string &SequenceClipInstance::getPremult() const
+  {
+    static const std::string opaque(kOfxImageOpaque);
+    if(_layout.components == kOfxImageComponentRGBA)
+      return MyClipInstance::getPremult();
+    return opaque;
+  }
+
+  double SequenceClipInstance::getAspectRatio() const
+  {
+    return 1.0;
+  }
+
+  void SequenceClipInstance::getFrameRange(double &startFrame, double &endFrame) const
+  {
+    startFrame = _firstFrame;
+    endFrame = _lastFrame;
+  }
+
+  bool SequenceClipInstance::getConnected() const
+  {
+    return _valid;
+  }
+
+  void SequenceClipInstance::getUnmappedFrameRange(double &unmappedStartFrame, double &unmappedEndFrame) const
+  {
+    getFrameRange(unmappedStartFrame, unmappedEndFrame);
+  }
+
+  OfxRectD SequenceClipInstance::getRegionOfDefinition(OfxTime /*time*/) const
+  {
+    OfxRectD rod = {0, 0, double(_layout.width), double(_layout.height)};
+    return rod;
+  }
+
+  OFX::Host::ImageEffect::Image *SequenceClipInstance::mapFrame(int frame)
+  {
+#if defined(UNIX)
+    std::string path = getFramePath(frame);
+    SequenceLayout layout;
+    if(!readSequenceLayout(path, _spec, layout) ||
+       layout.width != _layout.width || layout.height != _layout.height ||
+       layout.depth != _layout.depth || layout.components != _layout.components)
+      return NULL;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+      return NULL;
+
+    size_t size = layout.offset + layout.getRowBytes() * layout.height;
+    struct stat info;
+    void *mapping = MAP_FAILED;
+    if(fstat(fd, &info) == 0 && size_t(info.st_size) >= size)
+      mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+      return NULL;
+
+    // the effect will read all of it, front to back
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    madvise(mapping, size, MADV_WILLNEED);
+
+    return new MappedFrame(*this, layout, mapping, size, path);
+#else
+    return NULL;
+#endif
+  }
+
+  void SequenceClipInstance::readAhead(int frame, int direction)
+  {
+#if defined(UNIX)
+    for(int i = 1; i <= kReadAhead; ++i) {
+      int ahead = frame + i * direction;
+      if(ahead < _firstFrame || ahead > _lastFrame)
+        break;
+      int fd = open(getFramePath(ahead).c_str(), O_RDONLY);
+      if(fd < 0)
+        continue;
+#if defined(POSIX_FADV_WILLNEED)
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+      close(fd);
+    }
+#endif
+  }
+
+  OFX::Host::ImageEffect::Image* SequenceClipInstance::getImage(OfxTime time, const OfxRectD *optionalBounds)
+  {
+    if(!_valid)
+      return NULL;
+
+    int frame = int(floor(time + 0.5));
+    if(frame < _firstFrame || frame > _lastFrame)
+      return NULL;
+
+    // keep the last frame, so fetches of it, say for each tile of a render, share it
+    OFX::Host::ImageEffect::Image *image;
+    {
+      std::lock_guard<std::mutex> guard(_frameLock);
+      if(!_frame || _frameTime != frame) {
+        int direction = !_frame || frame >= _frameTime ? 1 : -1;
+        OFX::Host::ImageEffect::Image *mapped = mapFrame(frame);
+        if(!mapped)
+          return NULL;
+        readAhead(frame, direction);
+
+        // the effect gets the file's own pages if it takes them as they are, otherwise
+        // a conversion to what the clip preferences asked for
+        if(getPixelDepth() != _layout.depth || getComponents() != _layout.components) {
+          MyImage *converted = new MyImage(*this, getBounds());
+          converted->setStringProperty(kOfxImagePropUniqueIdentifier, mapped->getStringProperty(kOfxImagePropUniqueIdentifier));
+          OFX::Host::PixelConvert::convert(*mapped, *converted);
+          mapped->releaseReference();
+          mapped = converted;
+        }
+
+        if(_frame)
+          _frame->releaseReference();
+        _frame = mapped;
+        _frameTime = frame;
+      }
+      _frame->addReference();
+      image = _frame;
+    }
+
+    // only hand out the part asked for, as a view on the frame's pixels
+    if(optionalBounds)
+      image = OFX::Host::ImageEffect::cropImage(image, *optionalBounds);
+    return image;
+  }
+
+} // MyHost
@@ -0,0 +1,127 @@
+/*
+Software License :
+
+Copyright (c) 2007, The Open Effects Association Ltd. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef HOST_DEMO_SEQUENCE_CLIP_H
+#define HOST_DEMO_SEQUENCE_CLIP_H
+
+namespace MyHost {
+
+  /// the frame files a SequenceClipInstance reads
+  struct SequenceSpec {
+    std::string pattern;  ///< printf pattern taking the frame number, eg: "plate.%04d.pfm"
+    int         width;    ///< width of raw frames, which have no header
+    int         height;   ///< height of raw frames
+
+    SequenceSpec() : width(0), height(0) {}
+  };
+
+  /// how the pixels lie in a frame file
+  struct SequenceLayout {
+    std::string depth;       ///< kOfxBitDepth
+    std::string components;  ///< kOfxImageComponent
+    int         width;
+    int         height;
+    size_t      offset;      ///< bytes before the first row
+    bool        bottomUp;    ///< is the first row the bottom one
+
+    SequenceLayout() : width(0), height(0), offset(0), bottomUp(false) {}
+
+    /// bytes in a row
+    size_t getRowBytes() const;
+  };
+
+  /// An input clip reading a sequence of frame files, one per frame, which are mapped
+  /// into memory rather than read.
+  ///
+  /// The files can be...
+  ///    - .ppm - binary P6 8 bit RGB
+  ///    - .pfm - little endian float RGB (PF) or Alpha (Pf)
+  ///    - .raw - 8 bit RGBA with no header, top row first, of the size in the SequenceSpec
+  ///
+  /// When an effect takes the file's depth and components, the frame's pages are given to
+  /// the effect as they are, the image's data pointing into the mapping, with negative row
+  /// bytes for files that are top row first. Otherwise the frame is converted to what the
+  /// clip preferences asked for. The next few frames' files are read ahead in the direction
+  /// frames are being fetched in, so a sequential render runs at the speed of the disk.
+  class SequenceClipInstance : public MyClipInstance {
+  protected :
+    SequenceSpec                      _spec;
+    SequenceLayout                    _layout;      ///< of the first frame, all frames must match it
+    bool                              _valid;       ///< did the first frame read OK
+    int                               _firstFrame;
+    int                               _lastFrame;
+    OFX::Host::ImageEffect::Image    *_frame;       ///< the last frame fetched
+    OfxTime                           _frameTime;   ///< and its time
+    std::mutex                        _frameLock;   ///< guards the above
+
+    /// the file holding a frame
+    std::string getFramePath(int frame) const;
+
+    /// map a frame's file, NULL if it can't be or isn't laid out as the first frame is
+    OFX::Host::ImageEffect::Image *mapFrame(int frame);
+
+    /// hint to the OS that the files after frame, in the direction we are going, are wanted
+    void readAhead(int frame, int direction);
+
+  public :
+    /// how many frames to read ahead
+    static const int kReadAhead = 2;
+
+    SequenceClipInstance(MyEffectInstance* effect, OFX::Host::ImageEffect::ClipDescriptor* desc, const SequenceSpec &spec);
+
+    virtual ~SequenceClipInstance();
+
+    /// did the first frame of the sequence read OK
+    bool isValid() const { return _valid; }
+
+    /// the pixel bounds of the frames
+    OfxRectI getBounds() const;
+
+    virtual const std::string &getUnmappedBitDepth() const;
+    virtual const std::string &getUnmappedComponents() const;
+    virtual const std::string &getPremult() const;
+    virtual double getAspectRatio() const;
+    virtual void getFrameRange(double &startFrame, double &endFrame) const;
+    virtual bool getConnected() const;
+    virtual void getUnmappedFrameRange(double &unmappedStartFrame, double &unmappedEndFrame) const;
+    virtual OFX::Host::ImageEffect::Image* getImage(OfxTime time, const OfxRectD *optionalBounds);
+    virtual OfxRectD getRegionOfDefinition(OfxTime time) const;
+  };
+
+  /// read the layout of a frame file from its header, returns false if it isn't one we read
+  bool readSequenceLayout(const std::string &path, const SequenceSpec &spec, SequenceLayout &layout);
+
+  /// is the pattern safe to hand the frame number to, which it is if it has exactly one
+  /// %d or %0Nd in it and no other conversions bar %%
+  bool isFramePattern(const std::string &pattern);
+
+}
+
+#endif // HOST_DEMO_SEQUENCE_CLIP_H
@@ -0,0 +1,222 @@
+/*
+Software License :
+
+Copyright (c) 2007, The Open Effects Association Ltd. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+   * Neither the name The Open Effects Association Ltd, nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+   
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+   ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+////////////////////////////////////////////////////////////////////////////////
+// Hammers image reference counting from many threads at once, as a plugin that
+// fetches and releases images from its multiThread workers would.
+//
+// Every thread fetches frames of the source clip through the image effect suite,
+// holds a few at a time and releases them in a different order to the one they were
+// fetched in. The demo clip keeps only its last frame, so fetching a new time drops
+// the clip's reference on the old one while other threads still hold theirs. Some
+// fetches ask for bounds, which hands out views that hold a reference of their own.
+// While it holds an image a thread checks its pixels are still those of the time it
+// asked for.
+//
+// Build the invert example and set OFX_PLUGIN_PATH so that it can be seen, then run
+// this, ideally built with -fsanitize=thread or address, as...
+//
+//     refCountStress [-threads n] [-iterations n]
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+#include "ofxPixels.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhParam.h"
+#include "ofxhMemory.h"
+#include "ofxhImageEffect.h"
+#include "ofxhPluginAPICache.h"
+#include "ofxhPluginCache.h"
+#include "ofxhHost.h"
+#include "ofxhImageEffectAPI.h"
+
+// my host
+#include "hostDemoHostDescriptor.h"
+#include "hostDemoEffectInstance.h"
+#include "hostDemoClipInstance.h"
+
+/// frames each thread cycles through, few enough that threads keep fetching the same ones
+static const int kStressFrames = 4;
+
+/// images a thread holds at once
+static const int kStressHeld = 3;
+
+/// what the demo clip fills a frame with, see MyImage
+static int expectedFill(OfxTime time)
+{
+  return (int)(floor(255.0 * (time / OFXHOSTDEMOCLIPLENGTH))) & 0xff;
+}
+
+/// everything the threads share
+struct Stress {
+  const OfxImageEffectSuiteV1 *effectSuite;
+  const OfxPropertySuiteV1    *propSuite;
+  OfxImageClipHandle           clip;
+  int                          iterations;
+  std::atomic<int>             fetched;
+  std::atomic<int>             failures;
+
+  Stress() : effectSuite(0), propSuite(0), clip(0), iterations(0), fetched(0), failures(0) {}
+};
+
+/// one image a thread holds
+struct Held {
+  OfxPropertySetHandle handle;
+  OfxTime              time;
+};
+
+/// is the image still the one fetched for its time
+static bool checkImage(Stress &stress, const Held &held)
+{
+  void *data = 0;
+  int bounds[4];
+  int rowBytes = 0;
+  if(stress.propSuite->propGetPointer(held.handle, kOfxImagePropData, 0, &data) != kOfxStatOK ||
+     stress.propSuite->propGetIntN(held.handle, kOfxImagePropBounds, 4, bounds) != kOfxStatOK ||
+     stress.propSuite->propGetInt(held.handle, kOfxImagePropRowBytes, 0, &rowBytes) != kOfxStatOK)
+    return false;
+  if(!data || bounds[0] >= bounds[2] || bounds[1] >= bounds[3])
+    return false;
+
+  // the first and last pixels of the bottom row, well away from the digits drawn on the frame
+  const OfxRGBAColourB *row = (const OfxRGBAColourB *)data;
+  int fill = expectedFill(held.time);
+  return row[0].r == fill && row[bounds[2] - bounds[0] - 1].r == fill && row[0].a == 255;
+}
+
+static void stressThread(Stress *stress, int index)
+{
+  Held held[kStressHeld];
+  int nHeld = 0;
+
+  for(int i = 0; i < stress->iterations; ++i) {
+    // make room, releasing from the middle as often as the ends
+    if(nHeld == kStressHeld) {
+      int victim = (i + index) % kStressHeld;
+      if(!checkImage(*stress, held[victim]))
+        ++stress->failures;
+      if(stress->effectSuite->clipReleaseImage(held[victim].handle) != kOfxStatOK)
+        ++stress->failures;
+      held[victim] = held[--nHeld];
+    }
+
+    Held h;
+    h.time = (i / 2 + index) % kStressFrames;
+
+    // every other fetch is cropped, so is a view on the frame
+    OfxRectD bounds = { 10.0 * (i % 7), 10.0 * (i % 5), 600.0, 500.0 };
+    OfxStatus st = stress->effectSuite->clipGetImage(stress->clip, h.time, (i & 1) ? &bounds : 0, &h.handle);
+    if(st != kOfxStatOK || !h.handle) {
+      ++stress->failures;
+      continue;
+    }
+    ++stress->fetched;
+
+    if(!checkImage(*stress, h))
+      ++stress->failures;
+    held[nHeld++] = h;
+  }
+
+  for(int i = 0; i < nHeld; ++i) {
+    if(!checkImage(*stress, held[i]))
+      ++stress->failures;
+    stress->effectSuite->clipReleaseImage(held[i].handle);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int numThreads = std::max(4, (int)std::thread::hardware_concurrency());
+  int iterations = 20000;
+  for(int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if(arg == "-threads" && i + 1 < argc)
+      numThreads = std::max(1, atoi(argv[++i]));
+    else if(arg == "-iterations" && i + 1 < argc)
+      iterations = std::max(1, atoi(argv[++i]));
+    else {
+      std::cerr << "usage: refCountStress [-threads n] [-iterations n]" << std::endl;
+      return 1;
+    }
+  }
+
+  // set up a host and find the invert plugin, as hostDemo does
+  OFX::Host::PluginCache::getPluginCache()->setCacheVersion("refCountStressV1");
+  MyHost::Host myHost;
+  OFX::Host::ImageEffect::PluginCache imageEffectPluginCache(myHost);
+  imageEffectPluginCache.registerInCache(*OFX::Host::PluginCache::getPluginCache());
+  OFX::Host::PluginCache::getPluginCache()->scanPluginFiles();
+
+  OFX::Host::ImageEffect::ImageEffectPlugin* plugin = imageEffectPluginCache.getPluginById("net.sf.openfx.invertPlugin");
+  if(!plugin) {
+    std::cerr << "refCountStress: could not find the invert plugin, is OFX_PLUGIN_PATH set?" << std::endl;
+    return 1;
+  }
+
+  int failures = 0;
+  OFX::Host::ImageEffect::Instance *instance = plugin->createInstance(kOfxImageEffectContextFilter, NULL);
+  if(!instance || instance->createInstanceAction() != kOfxStatOK || !instance->getClipPreferences()) {
+    std::cerr << "refCountStress: could not make an instance of the invert plugin" << std::endl;
+    failures = 1;
+  }
+  else {
+    Stress stress;
+    stress.effectSuite = (const OfxImageEffectSuiteV1 *)myHost.fetchSuite(kOfxImageEffectSuite, 1);
+    stress.propSuite = (const OfxPropertySuiteV1 *)myHost.fetchSuite(kOfxPropertySuite, 1);
+    stress.clip = instance->getClip(kOfxImageEffectSimpleSourceClipName)->getHandle();
+    stress.iterations = iterations;
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < numThreads; ++i)
+      threads.push_back(std::thread(stressThread, &stress, i));
+    for(size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+
+    failures = stress.failures;
+    std::cout << "refCountStress: " << numThreads << " threads fetched " << stress.fetched
+              << " images, " << failures << " failures" << std::endl;
+  }
+
+  delete instance;
+  OFX::Host::PluginCache::clearPluginCache();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+/*
+Software License :
+
+Copyright (c) 2007, The Open Effects Association Ltd. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+   * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+   * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+   * Neither the name The Open Effects Association Ltd, nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+   
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+   ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+   ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+////////////////////////////////////////////////////////////////////////////////
+// Times what tracing an action costs, see OFX::Host::Trace.
+//
+// It runs a number of Trace::Scopes back to back, as the host wraps each action in,
+// with tracing off, with it on, and with it on and a region of definition added as
+// the action's result. Reading the trace clock twice, which every traced action has
+// to, is timed on its own as well, so what the rest of the scope costs can be seen.
+// Each is reported in nanoseconds per scope. Run it as...
+//
+//     traceBench [-scopes n]
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+// ofx host
+#include "ofxhTrace.h"
+
+/// somewhere for the loops to put what they work out, so they aren't optimised away
+static volatile long long gSink;
+
+/// what the scopes say they are tracing an action on
+static int gInstance;
+
+/// nanoseconds each of nScopes runs of f took
+template <class F>
+static double timePerScope(int nScopes, F f)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int i = 0; i < nScopes; ++i)
+    f(i);
+  double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return nanos / nScopes;
+}
+
+/// a scope as the host opens around an action that gives nothing back
+static void plainScope(int i)
+{
+  OFX::Host::Trace::Scope trace(kOfxImageEffectActionRender, &gInstance, OfxTime(i));
+  trace.setStatus(kOfxStatOK);
+}
+
+/// a scope as the host opens around the region of definition action
+static void rodScope(int i)
+{
+  OFX::Host::Trace::Scope trace(kOfxImageEffectActionGetRegionOfDefinition, &gInstance, OfxTime(i));
+  trace.setStatus(kOfxStatOK);
+  OfxRectD rod = { 0, 0, 1920.0 + i, 1080 };
+  trace.result("rod");
+  trace.value(rod);
+}
+
+/// the two clock reads a traced scope makes
+static void clockReads(int)
+{
+  long long start = OFX::Host::Trace::now();
+  gSink = OFX::Host::Trace::now() - start;
+}
+
+int main(int argc, char **argv)
+{
+  int nScopes = 10000000;
+  for(int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if(arg == "-scopes" && i + 1 < argc)
+      nScopes = std::max(1, atoi(argv[++i]));
+    else {
+      std::cerr << "usage: traceBench [-scopes n]" << std::endl;
+      return 1;
+    }
+  }
+
+  // warm up the clock and this thread's ring before timing anything
+  OFX::Host::Trace::setEnabled(true);
+  timePerScope(nScopes / 10 + 1, rodScope);
+
+  double clock = timePerScope(nScopes, clockReads);
+
+  OFX::Host::Trace::setEnabled(false);
+  double off = timePerScope(nScopes, plainScope);
+
+  OFX::Host::Trace::setEnabled(true);
+  double on = timePerScope(nScopes, plainScope);
+  double onWithResult = timePerScope(nScopes, rodScope);
+  OFX::Host::Trace::setEnabled(false);
+
+  std::cout << "traceBench: " << nScopes << " scopes, nanoseconds each" << std::endl
+            << "  tracing off           " << off << std::endl
+            << "  tracing on            " << on << std::endl
+            << "  tracing on, with rod  " << onWithResult << std::endl
+            << "  two clock reads       " << clock << std::endl;
+  return 0;
+}
@@ -0,0 +1,137 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_ACTION_CACHE_H
+#define OFXH_ACTION_CACHE_H
+
+#include <map>
+#include <string>
+#include <mutex>
+
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+#include "ofxhImageEffect.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      /// Memoised results of an instance's metadata actions, the region of definition,
+      /// is identity, frames needed and time domain actions.
+      ///
+      /// Every result is stored against the instance revision it was computed at, the
+      /// whole cache is thrown away as soon as it is asked about a newer revision.
+      /// Only successful and default replies are kept. This is safe to use from
+      /// several render threads at once.
+      class ActionCache {
+      protected :
+        /// key for the region of definition action
+        struct RoDKey {
+          OfxTime   time;
+          OfxPointD renderScale;
+
+          bool operator<(const RoDKey &b) const;
+        };
+
+        /// key for the is identity action
+        struct IdentityKey {
+          OfxTime     time;
+          std::string field;
+          OfxRectI    renderWindow;
+          OfxPointD   renderScale;
+
+          bool operator<(const IdentityKey &b) const;
+        };
+
+        struct RoDResult {
+          OfxStatus stat;
+          OfxRectD  rod;
+        };
+
+        struct IdentityResult {
+          OfxStatus   stat;
+          OfxTime     time;
+          std::string clip;
+        };
+
+        struct FramesNeededResult {
+          OfxStatus stat;
+          RangeMap  rangeMap;
+        };
+
+        std::mutex                             _lock;
+        unsigned int                           _revision;       ///< revision everything in here was computed at
+        size_t                                 _maxEntries;     ///< most entries per action before we start again
+        std::map<RoDKey, RoDResult>            _rods;
+        std::map<IdentityKey, IdentityResult>  _identities;
+        std::map<OfxTime, FramesNeededResult>  _framesNeeded;
+        bool                                   _haveTimeDomain;
+        OfxStatus                              _timeDomainStat;
+        OfxRangeD                              _timeDomain;
+
+        /// throw everything away if the revision has moved on, returns false if it had or if revision
+        /// is older than the one we have, call with the lock held
+        bool checkRevision(unsigned int revision);
+
+      public :
+        /// ctor, maxEntries bounds the number of results kept for each action
+        explicit ActionCache(size_t maxEntries = 4096);
+
+        /// throw all results away
+        void clear();
+
+        /// the region of definition action, gets return false on a miss
+        bool getRegionOfDefinition(unsigned int revision, OfxTime time, OfxPointD renderScale, OfxStatus &stat, OfxRectD &rod);
+        void setRegionOfDefinition(unsigned int revision, OfxTime time, OfxPointD renderScale, OfxStatus stat, const OfxRectD &rod);
+
+        /// the is identity action, identityTime and clip are the action's out args
+        bool getIdentity(unsigned int revision, OfxTime time, const std::string &field, const OfxRectI &renderWindow, OfxPointD renderScale,
+                         OfxStatus &stat, OfxTime &identityTime, std::string &clip);
+        void setIdentity(unsigned int revision, OfxTime time, const std::string &field, const OfxRectI &renderWindow, OfxPointD renderScale,
+                         OfxStatus stat, OfxTime identityTime, const std::string &clip);
+
+        /// the frames needed action
+        bool getFramesNeeded(unsigned int revision, OfxTime time, OfxStatus &stat, RangeMap &rangeMap);
+        void setFramesNeeded(unsigned int revision, OfxTime time, OfxStatus stat, const RangeMap &rangeMap);
+
+        /// the time domain action
+        bool getTimeDomain(unsigned int revision, OfxStatus &stat, OfxRangeD &range);
+        void setTimeDomain(unsigned int revision, OfxStatus stat, const OfxRangeD &range);
+      };
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_ACTION_CACHE_H
@@ -0,0 +1,98 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_CANCEL_H
+#define OFXH_CANCEL_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+namespace OFX {
+
+  namespace Host {
+
+    /// Says whether a piece of work, typically a render request, has been cancelled.
+    ///
+    /// A token may have a parent, cancelling a token cancels all its descendants, so a
+    /// render that starts other renders, say of upstream effects, can give each a child
+    /// token and have them all stop when it is cancelled. Checking a token is a single
+    /// atomic load however deep it is.
+    ///
+    /// While a CancelScope is alive its token is the calling thread's current token, which
+    /// the default ImageEffect::Instance::abort answers from. Jobs the thread hands to the
+    /// MultiThread::ThreadPool run with the same current token.
+    class CancelToken {
+    protected :
+      std::atomic<bool>          _cancelled;
+      CancelToken               *_parent;    ///< NULL if we have none, or it has gone
+      std::mutex                 _lock;      ///< guards _children and the children's _parent
+      std::vector<CancelToken *> _children;
+
+    public :
+      /// a token that is cancelled when the parent is, if the parent is not NULL it must
+      /// not be destroyed while this is in use
+      explicit CancelToken(CancelToken *parent = 0);
+
+      /// detaches from the parent and any children
+      virtual ~CancelToken();
+
+      /// cancel this and all its descendants, it can't be undone
+      void cancel();
+
+      /// has this been cancelled
+      bool isCancelled() const { return _cancelled.load(std::memory_order_relaxed); }
+
+      /// the calling thread's current token, NULL if there is none
+      static CancelToken *getCurrent();
+
+      /// is there a current token on the calling thread and has it been cancelled
+      static bool isCurrentCancelled()
+      {
+        CancelToken *token = getCurrent();
+        return token && token->isCancelled();
+      }
+    };
+
+    /// Makes a token the calling thread's current one for the lifetime of the scope,
+    /// restoring the previous one after. The token may be NULL, for no current token.
+    class CancelScope {
+      CancelToken *_saved;
+
+    public :
+      explicit CancelScope(CancelToken *token);
+      ~CancelScope();
+    };
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_CANCEL_H
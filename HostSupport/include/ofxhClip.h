@@ -31,8 +31,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef OFX_CLIP_H
 #define OFX_CLIP_H
 
+#include <atomic>
+#include <mutex>
+
 #include "ofxImageEffect.h"
 #include "ofxhUtilities.h"
+#include "ofxhMemory.h"
 
 namespace OFX {
 
@@ -141,6 +145,9 @@ namespace OFX {
         /// is the clip an output clip
         bool isOutput() const {return  _isOutput;}
 
+        /// the effect instance the clip belongs to
+        ImageEffect::Instance *getEffectInstance() const {return _effectInstance;}
+
         /// notify override properties
         virtual void notify(const std::string &name, bool isSingle, int indexOrN)  OFX_EXCEPTION_SPEC;
         
@@ -307,7 +314,7 @@ namespace OFX {
       protected :
         /// called during ctors to get bits from the clip props into ours
         void getClipBits(ClipInstance& instance);
-        int _referenceCount; ///< reference count on this image
+        std::atomic<int> _referenceCount; ///< reference count on this image, images are shared between plugin threads
 
       public:
         // default constructor
@@ -374,11 +381,14 @@ namespace OFX {
         /// get the full region of this image
         OfxRectI getROD() const;
 
+        /// get the number of bytes in a pixel, 0 for unknown components or depths
+        int getPixelBytes() const;
+
         /// release the reference count, which, if zero, deletes this
         void releaseReference();
 
-        /// add a reference to this image
-        void addReference() {_referenceCount++;}
+        /// add a reference to this image, the caller already holds one so no ordering is needed
+        void addReference() {_referenceCount.fetch_add(1, std::memory_order_relaxed);}
       };
 
       /// instance of an image inside an image effect
@@ -416,7 +426,8 @@ namespace OFX {
         // ------
         // Row Bytes -
         //
-        // The number of bytes in a row of an image.
+        // The number of bytes in a row of an image. This is negative if the rows run top down
+        // in memory, in which case the data pointer still points at the bottom row.
         // ------
         // Field -
         //
@@ -445,6 +456,122 @@ namespace OFX {
               std::string uniqueIdentifier);
       };
 
+      /// An image whose pixels belong to another image, which it holds a reference
+      /// on for as long as it lives. This is used to pass an input image straight
+      /// through as an output with a different region of definition or bounds, and
+      /// to hand out a window on a larger image without copying any pixels.
+      class ImageView : public Image {
+      protected :
+        Image *_source; ///< the image that owns the pixels
+
+      public:
+        /// construct a view of source, taking the pixel depth, components, pre mult
+        /// and aspect ratio from the clip instance. The data must point to pixel
+        /// (bounds.x1, bounds.y1) inside the source's pixels.
+        ImageView(Image &source,
+                  ClipInstance& instance,
+                  double renderScaleX, 
+                  double renderScaleY,
+                  void* data,
+                  const OfxRectI &bounds,
+                  const OfxRectI &rod,
+                  int rowBytes,
+                  std::string field,
+                  std::string uniqueIdentifier);
+
+        /// construct a view of the pixels of source inside bounds, which must be inside
+        /// source's bounds, with all source's other properties
+        ImageView(Image &source, const OfxRectI &bounds);
+
+        /// releases our reference on the source
+        virtual ~ImageView();
+
+        /// the image that owns the pixels
+        Image &getSource() const { return *_source; }
+      };
+
+      /// Cut an image down to the pixels inside bounds, say a render's region of interest
+      /// or a tile, as an ImageView that copies none of the pixels. The image is returned
+      /// as it is if its bounds are inside the given ones already, or if its pixels can't
+      /// be addressed.
+      ///
+      /// This takes over the caller's reference on the image.
+      Image *cropImage(Image *image, const OfxRectI &bounds);
+
+      /// as above, with bounds on the canonical image plane
+      Image *cropImage(Image *image, const OfxRectD &bounds);
+
+      /// Turn an image upside down, as an ImageView on the same pixels that walks its rows
+      /// in the other direction by negating the row bytes. This is what to do with a buffer
+      /// whose rows run top down, as most file formats and video APIs have them, rather
+      /// than copying it. The image is returned as it is if its pixels can't be addressed.
+      ///
+      /// This takes over the caller's reference on the image.
+      Image *flipImage(Image *image);
+
+      /// One field of an interlaced frame with each of its rows doubled, so it is the
+      /// frame's height, as kOfxImageFieldDoubled extraction asks for. The rows are only
+      /// doubled when the image's data pointer is first asked for, so an image fetched
+      /// only to look at its properties costs nothing.
+      class FieldDoubledImage : public Image, private Property::GetHook {
+      protected :
+        Image                    *_source;   ///< the interlaced frame
+        int                       _parity;   ///< 0 for the lower field, 1 for the upper
+        mutable std::mutex        _lock;     ///< guards the doubling
+        mutable bool              _doubled;
+        mutable Memory::Instance  _pixels;
+
+        /// double the field's rows into _pixels, if not done already
+        void *getDoubledPixels() const;
+
+        /// Property::GetHook overrides for kOfxImagePropData
+        virtual void *getPointerProperty(const std::string &name, int index) const OFX_EXCEPTION_SPEC;
+        virtual void getPointerPropertyN(const std::string &name, void **values, int count) const OFX_EXCEPTION_SPEC;
+
+      public :
+        /// the given field, kOfxImageFieldLower or kOfxImageFieldUpper, of source
+        FieldDoubledImage(Image &source, ClipInstance &instance, const std::string &field);
+
+        /// releases our reference on the source
+        virtual ~FieldDoubledImage();
+
+        /// the interlaced frame
+        Image &getSource() const { return *_source; }
+      };
+
+      /// Cut an image down to a single field, as the clip's kOfxImageClipPropFieldExtraction
+      /// asks. This only happens if the image holds both fields interlaced and the field is
+      /// kOfxImageFieldLower or kOfxImageFieldUpper. kOfxImageFieldSingle extraction gives
+      /// an ImageView of every other row of the frame, which has double its row bytes and
+      /// half its height and copies no pixels. kOfxImageFieldDoubled extraction gives a
+      /// FieldDoubledImage. Otherwise the image is returned as it is.
+      ///
+      /// This takes over the caller's reference on the image.
+      Image *extractField(Image *image, ClipInstance &clip, const std::string &field);
+
+      /// Says what is being rendered on the calling thread. Instance::renderAction makes
+      /// one for the length of the render, and jobs the thread hands the
+      /// MultiThread::ThreadPool run in the same scope, so images a render fetches from any
+      /// of its threads can be made to suit it, say by extracting the field it renders.
+      class RenderScope {
+      protected :
+        const char  *_previousField;
+        OfxPointD    _previousScale;
+
+      public :
+        /// make field, a kOfxImageField value, and renderScale the calling thread's current ones
+        RenderScope(const std::string &field, OfxPointD renderScale);
+
+        /// restores the previous scope
+        ~RenderScope();
+
+        /// the field being rendered on the calling thread, kOfxImageFieldNone if it isn't rendering
+        static const char *getCurrentField();
+
+        /// the render scale being rendered at on the calling thread, 1 if it isn't rendering
+        static OfxPointD getCurrentRenderScale();
+      };
+
 #   ifdef OFX_SUPPORTS_OPENGLRENDER
       /// instance of an OpenGL texture inside an image effect
       class Texture : public ImageBase {
@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "ofxCore.h"
 #include "ofxImageEffect.h"
+#include "ofxMultiThread.h"
 
 #include "ofxhHost.h"
 #include "ofxhClip.h"
@@ -40,6 +41,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ofxhTimeLine.h"
 #include "ofxhParam.h"
 #include "ofxhMemory.h"
+#include "ofxhMemoryGovernor.h"
 #include "ofxhInteract.h"
 
 #ifdef _MSC_VER
@@ -53,6 +55,7 @@ namespace OFX {
 
     // forward declare    
     class Plugin;
+    class CancelToken;
 
     namespace Memory {
       class Instance;
@@ -112,38 +115,41 @@ namespace OFX {
         /// created.
         virtual void initDescriptor(Descriptor* desc);
 
-#ifdef OFX_SUPPORTS_MULTITHREAD
-        // these functions must be implemented if the host supports OfxMultiThreadSuiteV1
+        // these functions implement OfxMultiThreadSuiteV1, by default they run on
+        // MultiThread::ThreadPool::getDefault(), override them to use your own threads
         // all the following functions are described in ofxMultiThread.h
         //
 
         /// @see OfxMultiThreadSuiteV1.multiThread()
-        virtual OfxStatus multiThread(OfxThreadFunctionV1 func,unsigned int nThreads, void *customArg) = 0;
+        virtual OfxStatus multiThread(OfxThreadFunctionV1 func,unsigned int nThreads, void *customArg);
+
+        /// as multiThread, but for the host's own work, the ParallelRenderer renders frames
+        /// at once with this, the jobs must not count as spawned threads to plugins
+        virtual OfxStatus multiThreadHost(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg);
           
         /// @see OfxMultiThreadSuiteV1.multiThreadNumCPUS()
-        virtual OfxStatus multiThreadNumCPUS(unsigned int *nCPUs) const = 0;
+        virtual OfxStatus multiThreadNumCPUS(unsigned int *nCPUs) const;
 
         /// @see OfxMultiThreadSuiteV1.multiThreadIndex()
-        virtual OfxStatus multiThreadIndex(unsigned int *threadIndex) const = 0;
+        virtual OfxStatus multiThreadIndex(unsigned int *threadIndex) const;
           
         /// @see OfxMultiThreadSuiteV1.multiThreadIsSpawnedThread()
-        virtual int multiThreadIsSpawnedThread() const = 0;
+        virtual int multiThreadIsSpawnedThread() const;
           
         /// @see OfxMultiThreadSuiteV1.mutexCreate()
-        virtual OfxStatus mutexCreate(OfxMutexHandle *mutex, int lockCount) = 0;
+        virtual OfxStatus mutexCreate(OfxMutexHandle *mutex, int lockCount);
           
         /// @see OfxMultiThreadSuiteV1.mutexDestroy()
-        virtual OfxStatus mutexDestroy(const OfxMutexHandle mutex) = 0;
+        virtual OfxStatus mutexDestroy(const OfxMutexHandle mutex);
 
         /// @see OfxMultiThreadSuiteV1.mutexLock()
-        virtual OfxStatus mutexLock(const OfxMutexHandle mutex) = 0;
+        virtual OfxStatus mutexLock(const OfxMutexHandle mutex);
           
         /// @see OfxMultiThreadSuiteV1.mutexUnLock()
-        virtual OfxStatus mutexUnLock(const OfxMutexHandle mutex) = 0;
+        virtual OfxStatus mutexUnLock(const OfxMutexHandle mutex);
           
         /// @see OfxMultiThreadSuiteV1.mutexTryLock()
-        virtual OfxStatus mutexTryLock(const OfxMutexHandle mutex) = 0;
-#endif // OFX_SUPPORTS_MULTITHREAD
+        virtual OfxStatus mutexTryLock(const OfxMutexHandle mutex);
 
 #     ifdef OFX_SUPPORTS_OPENGLRENDER
         /// @see OfxImageEffectOpenGLRenderSuiteV1.flushResources()
@@ -299,6 +305,32 @@ namespace OFX {
       /// a map used to specify needed frame ranges on set of clips
       typedef std::map<ClipInstance *, std::vector<OfxRangeD> > RangeMap;
 
+      class ActionCache;
+      class InputPrefetcher;
+      class ProxyCache;
+      class ParallelRenderer;
+      class ActionScope;
+      class FrameRenderListener;
+
+      /// how Instance::renderSequence renders
+      struct SequenceRenderOptions {
+        std::string   field;        ///< field to render, kOfxImageFieldNone by default
+        bool          interactive;  ///< is this an interactive render, false by default
+        bool          draft;        ///< render at draft quality, false by default
+        unsigned int  maxThreads;   ///< most frames to render at once, 0, the default, means the number of CPUs, 1 renders in order
+        unsigned int  lookAhead;    ///< when frames render in order, how many frames ahead to prefetch inputs for, 2 by default
+        CancelToken  *cancel;       ///< the render stops if this is cancelled, NULL, the default, means the calling thread's current token
+
+        SequenceRenderOptions()
+          : field(kOfxImageFieldNone)
+          , interactive(false)
+          , draft(false)
+          , maxThreads(0)
+          , lookAhead(2)
+          , cancel(0)
+        {}
+      };
+
       /// an image effect plugin instance.
       ///
       /// Client code needs to filling the pure virtuals in this.
@@ -307,7 +339,8 @@ namespace OFX {
                        public Progress::ProgressI,
                        public TimeLine::TimeLineI,
                        private Property::NotifyHook, 
-                       private Property::GetHook
+                       private Property::GetHook,
+                       private Memory::Purgeable
       {
       protected:
         OFX::Host::ImageEffect::ImageEffectPlugin    *_plugin;
@@ -318,12 +351,52 @@ namespace OFX {
         bool                                          _created;
 
         bool                                          _clipPrefsDirty; ///< do we need to re-run the clip prefs action
+        unsigned int                                  _clipPrefsRevision; ///< bumped when the clip prefs action gives a different result
         bool                                          _continuousSamples; ///< set by clip prefs
         bool                                          _frameVarying; ///< set by clip prefs
         std::string                                   _outputPreMultiplication;  ///< set by clip prefs
         std::string                                   _outputFielding;  ///< set by clip prefs
         double                                        _outputFrameRate; ///< set by clip prefs
 
+        std::atomic<unsigned int>                     _revision;    ///< bumped whenever a param or clip changes
+        ActionCache                                  *_actionCache; ///< memoised metadata actions, NULL if not caching
+        InputPrefetcher                              *_prefetcher;  ///< where plugin image fetches look first, may be NULL
+        ProxyCache                                   *_proxyCache;  ///< where plugin image fetches look next, may be NULL
+        ParallelRenderer                             *_renderer;    ///< used by renderSequence, made on first use
+        friend class ActionScope;
+
+        std::atomic<int>                              _inAction;    ///< actions in progress, bar the purge caches action
+        std::atomic<bool>                             _purging;     ///< the governor is running the purge caches action
+        unsigned long long                            _purgedAt;    ///< getLastUsed when the governor last purged us
+
+        int                                           _changeBatchDepth; ///< nested beginChangeBatch calls
+        std::string                                   _changeBatchWhy;   ///< reason of the batch's begin instance changed action, empty until one is sent
+
+        /// a clip as the clip preferences action sees it
+        struct UpstreamFormat {
+          bool        connected;
+          std::string components;  ///< unmapped components
+          std::string depth;       ///< unmapped pixel depth
+          std::string premult;
+          std::string fielding;
+          double      aspectRatio;
+          double      frameRate;   ///< unmapped frame rate
+
+          bool operator==(const UpstreamFormat &other) const;
+        };
+
+        std::map<std::string, UpstreamFormat>         _upstreamFormats; ///< each clip as the last clip prefs action saw it
+
+        /// get a clip's format as the clip preferences action would see it
+        static UpstreamFormat getUpstreamFormat(const ClipInstance &clip);
+
+        /// call the begin or end instance changed action, whatever the batching
+        OfxStatus callInstanceChangedBracket(const char *action, const std::string &why);
+
+        /// Memory::Purgeable override, runs the purge caches action if we have rendered
+        /// since the last time and no other action is running on us now
+        virtual size_t purge(size_t nBytes);
+
       public:        
         /// constructor based on clip descriptor
         Instance(ImageEffectPlugin* plugin,
@@ -380,9 +453,49 @@ namespace OFX {
           return int(_clips.size());
         }
 
-        /// are the clip preferences currently dirty
+        /// Are the clip preferences currently dirty. Only a change to a param named in
+        /// kOfxImageEffectPropClipPreferencesSlaveParam, or a clip changed action where
+        /// the clip's connection or upstream format is not what the last clip preferences
+        /// action saw, dirties them.
         bool areClipPrefsDirty() const {return _clipPrefsDirty;}
 
+        /// The revision of the clip preferences. This is bumped only when the clip
+        /// preferences action gives a different result to last time, so effects
+        /// downstream need to be renegotiated only when it changes.
+        unsigned int getClipPrefsRevision() const {return _clipPrefsRevision;}
+
+        /// The revision of the instance's params and clips. This is bumped by the
+        /// instance changed actions, by the plugin setting a param and by the clip
+        /// preferences action.
+        unsigned int getRevision() const {return _revision;}
+
+        /// Bump the revision. Call this if anything the metadata actions depend on
+        /// has changed without an instance changed action, eg: something upstream
+        /// of an input clip.
+        void bumpRevision() {++_revision;}
+
+        /// Turn memoisation of the region of definition, is identity, frames needed
+        /// and time domain actions on or off. Results are reused until the revision
+        /// changes. Off by default.
+        void setActionCaching(bool enable);
+
+        /// are the metadata actions being memoised
+        bool getActionCaching() const {return _actionCache != 0;}
+
+        /// Set the prefetcher images fetched by the plugin are looked for in first,
+        /// InputPrefetcher does this itself. Don't change it while rendering.
+        void setInputPrefetcher(InputPrefetcher *prefetcher) {_prefetcher = prefetcher;}
+
+        /// the prefetcher images fetched by the plugin are looked for in first, may be NULL
+        InputPrefetcher *getInputPrefetcher() const {return _prefetcher;}
+
+        /// Set the cache images fetched by the plugin go through when they aren't
+        /// prefetched, ProxyCache does this itself. Don't change it while rendering.
+        void setProxyCache(ProxyCache *cache) {_proxyCache = cache;}
+
+        /// the cache images fetched by the plugin go through, may be NULL
+        ProxyCache *getProxyCache() const {return _proxyCache;}
+
         /// are all the non optional clips connected
         bool checkClipConnectionStatus() const;
 
@@ -397,7 +510,8 @@ namespace OFX {
         /// pure virtuals that must  be overriden
         virtual ClipInstance* getClip(const std::string& name) const;
 
-        /// override this to make processing abort, return 1 to abort processing
+        /// override this to make processing abort, return 1 to abort processing,
+        /// the default aborts if the calling thread's current CancelToken is cancelled
         virtual int abort();
 
         /// override this to use your own memory instance - must inherrit from memory::instance
@@ -406,6 +520,15 @@ namespace OFX {
         // return an memory::instance calls makeMemoryInstance that can be overriden
         Memory::Instance* imageMemoryAlloc(size_t nBytes);
 
+        /// Make another instance of this effect that can render at the same time
+        /// as this one. This is used to frame thread instance safe plugins, the
+        /// clone's params are kept in step by the ParallelRenderer.
+        ///
+        /// The default creates and calls create instance on a new instance in the
+        /// same context with no client data. Override this if your clips need
+        /// wiring up to the same inputs, return NULL if the effect can't be cloned.
+        virtual Instance* newRenderClone();
+
         /// make a clip
         virtual ClipInstance* newClipInstance(ImageEffect::Instance* plugin,
                                               ClipDescriptor* descriptor, 
@@ -550,6 +673,25 @@ namespace OFX {
 
         virtual OfxStatus endInstanceChangedAction(const std::string &why);
 
+        /// Start batching instance changes, say while loading a preset or running a script
+        /// that sets many params.
+        ///
+        /// Until the matching endChangeBatch, the begin and end instance changed actions
+        /// are sent once, around all the instance changed actions, rather than around each
+        /// one. A begin and end with a different reason to the batch's first one, say the
+        /// plugin setting a param from its instance changed action, go straight through.
+        /// runGetClipPrefsConditionally does nothing until the batch ends. Batches nest.
+        void beginChangeBatch();
+
+        /// End a batch started with beginChangeBatch. When the outermost batch ends, this
+        /// sends the end instance changed action, if a begin was sent, then runs the clip
+        /// preferences action if anything in the batch dirtied them. Returns what the end
+        /// instance changed action returned.
+        OfxStatus endChangeBatch();
+
+        /// are instance changes being batched
+        bool isBatchingChanges() const {return _changeBatchDepth > 0;}
+
         // purge your caches
         virtual OfxStatus purgeCachesAction();
 
@@ -566,6 +708,25 @@ namespace OFX {
         virtual OfxStatus contextDetachedAction();
 #     endif
           
+        /// Render the frames in range, every step frames, going backwards if step is
+        /// negative. This calls the begin and end sequence render actions around the
+        /// render actions and gives each frame to the sink, if not NULL, as soon as it has
+        /// rendered, on the thread that rendered it.
+        ///
+        /// Frames render concurrently as far as the plugin's thread safety and the
+        /// options allow, see ParallelRenderer, whose clones are kept from call to call.
+        /// When they render one at a time the inputs for the frames after the current one
+        /// are prefetched meanwhile, see InputPrefetcher.
+        ///
+        /// Returns kOfxStatOK if every frame rendered, otherwise the status of the first
+        /// failure. Don't call this on the same instance from two threads at once.
+        virtual OfxStatus renderSequence(const OfxRangeD &range,
+                                         OfxTime step,
+                                         const OfxRectI &renderWindow,
+                                         OfxPointD renderScale,
+                                         const SequenceRenderOptions &options,
+                                         FrameRenderListener *sink);
+
         // render action
         virtual OfxStatus beginRenderAction(OfxTime  startFrame,
                                             OfxTime  endFrame,
@@ -627,6 +788,21 @@ namespace OFX {
         // time domain
         virtual OfxStatus getTimeDomainAction(OfxRangeD& range);
 
+        /// Run the is identity action and, if the effect is a no-op, fetch the image it
+        /// passes through so the host can use it as the output rather than rendering.
+        /// The image is fetched from the clip and at the time the plugin asked for. If
+        /// its RoD or bounds are not the output's it is wrapped in an ImageView of the
+        /// same pixels, no pixels are ever copied.
+        ///
+        /// Returns NULL if the effect needs rendering, or if the input can't be used as
+        /// it stands because the clip preferences give the output a different depth,
+        /// components or premultiplication. Otherwise the caller owns a reference on
+        /// the image and must release it.
+        virtual Image* getIdentityImage(OfxTime time,
+                                        const std::string &field,
+                                        const OfxRectI &renderWindow,
+                                        OfxPointD renderScale);
+
         /// Get the interact description, this will also call describe on the interact
         /// This will return NULL if there is not main entry point or if the description failed
         /// otherwise it will return the described overlay
@@ -668,7 +844,9 @@ namespace OFX {
         bool runGetClipPrefsConditionally()
         {
           if(areClipPrefsDirty()) {
-            getClipPreferences();
+            // a change batch runs it once, when it ends
+            if(!isBatchingChanges())
+              getClipPreferences();
             return true;
           }
           return false;
@@ -683,6 +861,24 @@ namespace OFX {
         virtual const std::string &findMostChromaticComponents(const std::string &a, const std::string &b) const;
       };
 
+      /// Batches an instance's changes for as long as it is in scope, see
+      /// Instance::beginChangeBatch.
+      class ChangeBatch {
+        Instance &_instance;
+
+      public :
+        explicit ChangeBatch(Instance &instance)
+          : _instance(instance)
+        {
+          _instance.beginChangeBatch();
+        }
+
+        ~ChangeBatch()
+        {
+          _instance.endChangeBatch();
+        }
+      };
+
       ////////////////////////////////////////////////////////////////////////////////
       /// An overlay interact for image effects, derived from one of these to
       /// be an overlay interact
@@ -0,0 +1,159 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_INTERACTIVE_RENDER_H
+#define OFXH_INTERACTIVE_RENDER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    // forward declare
+    class CancelToken;
+
+    namespace ImageEffect {
+
+      // forward declare
+      class Instance;
+
+      /// Client code derives from this to be given the frames an InteractiveRenderer renders.
+      class InteractiveRenderListener {
+      public :
+        virtual ~InteractiveRenderListener() {}
+
+        /// Called on the thread that rendered the frame, straight after it rendered, the
+        /// output is to be fetched from the instance's output clip. A frame is given first
+        /// as a preview, at a reduced render scale and/or draft quality, then again when
+        /// refined at full scale and quality, unless the preview was already at that.
+        virtual void frameRendered(Instance &effect,
+                                   OfxTime time,
+                                   OfxPointD renderScale,
+                                   bool draft,
+                                   OfxStatus stat) = 0;
+      };
+
+      /// Renders frames of an effect for an interactive session to a frame time budget.
+      ///
+      /// Render times are measured per render scale and quality. Each frame asked for is
+      /// first rendered on the calling thread at the best quality expected to render within
+      /// the budget, trying full quality then draft at each render scale down to the
+      /// minimum, halving each time. Render scales below 1 are only used if the plugin
+      /// supports multiple resolutions. If that preview was not at full scale and quality,
+      /// the frame is then refined in the background at full quality. Asking for another
+      /// frame drops a refine not yet started and cancels one in progress through its
+      /// CancelToken, so it stops as soon as the plugin next checks abort.
+      ///
+      /// Draft renders only differ from full quality renders if the host sets
+      /// kOfxImageEffectPropRenderQualityDraft, if not the measurements will soon
+      /// show draft is no faster and it will stop being picked.
+      class InteractiveRenderer {
+      public :
+        /// the scale and quality of a render
+        struct Quality {
+          double  scale;  ///< render scale, the same in x and y
+          bool    draft;
+        };
+
+      protected :
+        /// measured render cost at one quality
+        struct Cost {
+          double  secondsPerPixel;  ///< moving average, 0 if never measured
+        };
+
+        /// the most render scales we consider
+        enum { kMaxLevels = 8 };
+
+        Instance                   &_instance;
+        InteractiveRenderListener  *_listener;
+        double                      _budget;      ///< seconds a preview should take
+        double                      _minScale;    ///< lowest render scale used
+        Cost                        _costs[2];    ///< indexed by draft, scale is factored out as pixels rendered
+        std::mutex                  _renderLock;  ///< held while rendering, the instance renders one sequence at a time
+        std::mutex                  _lock;        ///< guards the members below and _costs
+        std::condition_variable     _wake;
+        bool                        _refinePending;
+        OfxTime                     _refineTime;
+        OfxRectI                    _refineWindow;
+        CancelToken                *_refineToken; ///< the token of the refine being rendered, NULL if none
+        bool                        _stop;
+        std::thread                 _thread;
+
+        /// the refine thread's main loop
+        void threadMain();
+
+        /// render the one frame and measure it, cancel may be NULL
+        OfxStatus render(OfxTime time, const OfxRectI &fullWindow, const Quality &quality, CancelToken *cancel);
+
+        /// forget any queued refine and cancel one in progress, called with _lock held
+        void dropRefine();
+
+      public :
+        /// the listener, which may be NULL, is not owned, budget is in seconds
+        InteractiveRenderer(Instance &instance, InteractiveRenderListener *listener, double budget = 1.0 / 24);
+
+        /// waits for any refine in progress
+        virtual ~InteractiveRenderer();
+
+        /// set the frame time budget, in seconds
+        void setBudget(double seconds);
+
+        /// set the lowest render scale a preview can use, 1 to never reduce it
+        void setMinimumScale(double scale);
+
+        /// how long a render at the quality of the given full scale window is expected to
+        /// take, in seconds, or a negative number if there is no measurement to go on
+        double estimate(const OfxRectI &fullWindow, const Quality &quality);
+
+        /// the best quality expected to render the full scale window within the budget
+        Quality choose(const OfxRectI &fullWindow);
+
+        /// Render a preview of the frame now, then queue its refinement. The window is
+        /// in pixels at full render scale and is scaled down for reduced scale renders.
+        /// Returns the status of the preview render.
+        virtual OfxStatus renderFrame(OfxTime time, const OfxRectI &fullWindow);
+
+        /// forget any queued refine, cancel one in progress and wait for it to stop
+        void cancelRefine();
+      };
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_INTERACTIVE_RENDER_H
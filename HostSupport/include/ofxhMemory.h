@@ -31,6 +31,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef OFX_MEMORY_H
 #define OFX_MEMORY_H
 
+#include <string>
+#include <mutex>
+#include <atomic>
+
+#include "ofxhMemoryGovernor.h"
+
 namespace OFX {
 
   namespace Host {
@@ -54,8 +60,54 @@ namespace OFX {
       protected:
         char*   _ptr;
         int     _locked;
+        size_t  _size;    ///< bytes allocated, as counted by the Governor
       };
 
+      /// Memory as the image effect memory suite describes it, which the host may move
+      /// or purge while it is not locked.
+      ///
+      /// While unlocked, the Governor may spill it to a file in the spill directory and
+      /// free it, locking it reads it back, possibly somewhere else. So the pointer from
+      /// getPtr is only good while the memory is locked. Blocks smaller than
+      /// kMinBytesToSpill are never spilt, and nothing is where memory can't be written to
+      /// files. A spill file is removed from the directory as soon as it is made, so it
+      /// goes when it is closed or the process dies.
+      class MovableInstance : public Instance, private Purgeable {
+      protected:
+        std::mutex         _mutex;    ///< guards everything, the governor purges from any thread
+        std::atomic<bool>  _busy;     ///< set while the mutex is held over a call that may purge, which purge skips
+        int                _spillFd;  ///< the file holding the memory while it is spilt, -1 if it isn't
+
+        /// read the memory back from its file, called with the mutex held and _busy set
+        bool faultIn();
+
+        /// Purgeable override, spills the memory if it is unlocked
+        virtual size_t purge(size_t nBytes);
+
+      public:
+        /// smallest block worth a file
+        static const size_t kMinBytesToSpill = 64 * 1024;
+
+        MovableInstance();
+
+        virtual ~MovableInstance();
+        virtual bool alloc(size_t nBytes);
+        virtual void freeMem();
+        virtual void* getPtr();
+        virtual void lock();
+        virtual void unlock();
+
+        /// is the memory out in a file at the moment
+        bool isSpilt();
+      };
+
+      /// set the directory memory is spilt to, which defaults to $OFX_HOST_SPILL_DIR, or
+      /// else the system's temporary directory
+      void setSpillDirectory(const std::string &directory);
+
+      /// the directory memory is spilt to
+      std::string getSpillDirectory();
+
     } // Memory
 
   } // Host
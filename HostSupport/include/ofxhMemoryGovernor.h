@@ -0,0 +1,171 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_MEMORY_GOVERNOR_H
+#define OFXH_MEMORY_GOVERNOR_H
+
+#include <cstddef>
+#include <vector>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace Memory {
+
+      /// Something holding memory it can give back when the Governor asks.
+      ///
+      /// Derived classes register themselves with Governor::add once they are constructed
+      /// and must call Governor::remove at the start of their dtor, the governor may call
+      /// purge from any thread until remove returns.
+      class Purgeable {
+      public :
+        /// the order things are purged in, lowest first
+        enum Priority {
+          ePurgePrefetched = 0,    ///< images fetched ahead of need, cheapest to get back
+          ePurgeCached = 10,       ///< results kept in case they are wanted again
+          ePurgeUnlocked = 15,     ///< plugin memory that is not locked, spilt to disk
+          ePurgePluginCaches = 20  ///< plugins' own caches, via the purge caches action
+        };
+
+      protected :
+        int                               _purgePriority;
+        std::atomic<unsigned long long>   _lastUsed;  ///< Governor::tick when last used
+
+      public :
+        explicit Purgeable(int priority);
+
+        virtual ~Purgeable();
+
+        /// get the priority this is purged at
+        int getPurgePriority() const { return _purgePriority; }
+
+        /// when this was last used, things of the same priority are purged least recently used first
+        unsigned long long getLastUsed() const { return _lastUsed.load(std::memory_order_relaxed); }
+
+        /// mark this as just used
+        void touch();
+
+        /// Give back memory, nBytes is how much the governor would like back. Returns how
+        /// many bytes were freed that the governor was not told about through released, as
+        /// far as is known. Called without any governor lock held.
+        virtual size_t purge(size_t nBytes) = 0;
+      };
+
+      /// Keeps the memory held by the host within one budget.
+      ///
+      /// It counts the bytes held by Memory::Instance allocations, which is where the image
+      /// effect memory suite's allocations come from, and by anything else reported through
+      /// allocated and released, such as cached images. When that goes over budget, or
+      /// the system reports memory pressure, it purges the registered Purgeables in priority
+      /// order, least recently used first, until enough is given back.
+      ///
+      /// With no budget set and no pressure monitor running it only counts.
+      class Governor {
+      protected :
+        std::atomic<size_t>       _held;         ///< bytes counted
+        std::atomic<size_t>       _budget;       ///< 0 means no budget
+        std::mutex                _lock;         ///< guards _purgeables and _purging
+        std::set<Purgeable *>     _purgeables;
+        Purgeable                *_purging;      ///< the one being purged right now, if any
+        std::condition_variable   _purged;       ///< signalled when _purging is cleared
+        std::mutex                _reclaimLock;  ///< held while reclaiming
+        std::atomic<bool>         _stopMonitor;
+        std::thread               _monitor;
+
+        /// the pressure monitor thread's main loop
+        void monitorMain(unsigned int stallMicros, unsigned int windowMicros);
+
+        /// purge until held is at most goal, called with _reclaimLock held
+        size_t reclaimTo(size_t goal);
+
+      public :
+        Governor();
+
+        /// stops the pressure monitor
+        virtual ~Governor();
+
+        /// the governor everything in HostSupport reports to, its budget may be set by
+        /// the OFX_HOST_MEMORY_BUDGET environment variable, in megabytes
+        static Governor &get();
+
+        /// a counter to stamp when things are used, it only ever goes up
+        static unsigned long long tick();
+
+        /// set the budget in bytes, 0 for none
+        void setBudget(size_t nBytes);
+
+        /// get the budget in bytes, 0 for none
+        size_t getBudget() const { return _budget; }
+
+        /// bytes currently counted
+        size_t getBytesHeld() const { return _held; }
+
+        /// count nBytes more as held, this does not purge, call enforce for that
+        void allocated(size_t nBytes);
+
+        /// count nBytes fewer as held
+        void released(size_t nBytes);
+
+        /// if over budget, purge down to a little under it, returns bytes given back. This
+        /// must not be called with any lock a Purgeable's purge may take.
+        size_t enforce();
+
+        /// purge until at least nBytes have been given back or there is nothing left to
+        /// purge, returns bytes given back
+        size_t reclaim(size_t nBytes);
+
+        /// register something that can be purged
+        void add(Purgeable *purgeable);
+
+        /// unregister it, this only waits if it is being purged on another thread right now
+        void remove(Purgeable *purgeable);
+
+        /// Start a thread that watches /proc/pressure/memory, and reclaims a quarter of
+        /// what is held whenever tasks have stalled on memory for stallMicros out of any
+        /// windowMicros. Returns false if the system does not report pressure.
+        bool startPressureMonitor(unsigned int stallMicros = 150000, unsigned int windowMicros = 2000000);
+
+        /// stop watching for pressure
+        void stopPressureMonitor();
+      };
+
+    } // namespace Memory
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_MEMORY_GOVERNOR_H
@@ -0,0 +1,187 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_MULTITHREAD_H
+#define OFXH_MULTITHREAD_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "ofxCore.h"
+#include "ofxMultiThread.h"
+
+#include "ofxhNuma.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace MultiThread {
+
+      /// one call to multiThread, shared by all the jobs it is split into
+      struct Region;
+
+      /// a single call of the thread function for a region
+      struct Job {
+        Region       *region;
+        unsigned int  index;
+      };
+
+      /// A persistent pool of worker threads that implements OfxMultiThreadSuiteV1::multiThread.
+      ///
+      /// Each worker has its own queue of jobs, which it takes from the back of, idle workers
+      /// steal from the front of other workers' queues. The thread calling multiThread runs
+      /// jobs from the region itself while it waits for the workers to finish it.
+      ///
+      /// Jobs run with the calling thread's current CancelToken, see CancelScope.
+      ///
+      /// Regions may nest, a worker calling multiThread queues the inner jobs on its own
+      /// queue for idle workers to steal and works through them itself meanwhile. A waiting
+      /// thread only ever runs jobs from the region it is waiting on, so no thread blocks
+      /// behind unrelated work and no extra threads are started.
+      ///
+      /// The workers are shared out over the nodes of a Numa::Topology in proportion to
+      /// their CPUs and pinned to them. Workers steal from others on their own node before
+      /// they steal from other nodes, so the threads a render spawns stay near the memory
+      /// it allocated, which Memory::Instance places on the node of the allocating worker.
+      class ThreadPool {
+      protected:
+        /// per worker state
+        struct Worker {
+          std::thread       thread;
+          std::mutex        lock;
+          std::deque<Job>   jobs;
+          unsigned int      node;   ///< the topology node the worker runs on
+        };
+
+        Numa::Topology          _topology;
+        std::vector<Worker *>   _workers;
+        std::mutex              _sleepLock;
+        std::condition_variable _wake;
+        std::atomic<int>        _pending;  ///< jobs queued but not yet taken
+        bool                    _stop;
+        std::atomic<unsigned long long> _localSteals;   ///< jobs taken from another queue on the same node
+        std::atomic<unsigned long long> _remoteSteals;  ///< and from other nodes
+
+        /// make and start nWorkers workers
+        void startWorkers(unsigned int nWorkers);
+
+        /// the main loop of a worker thread
+        void workerMain(unsigned int workerIndex);
+
+        /// take a job, from our own queue first if we are a worker, stealing otherwise,
+        /// if region is not NULL only jobs from that region are taken
+        bool takeJob(int workerIndex, Job &job, const Region *region);
+
+        /// queue the region's jobs and help run them until they are all done
+        OfxStatus runRegion(Region &region);
+
+        /// run a job on this thread
+        void runJob(const Job &job);
+
+      public:
+        /// make a pool with nWorkers threads over Numa::Topology::getDefault(), 0 makes one
+        /// less than the number of CPUs on the machine
+        explicit ThreadPool(unsigned int nWorkers = 0);
+
+        /// make a pool with nWorkers threads over the given topology, 0 makes one less than
+        /// the number of CPUs in it
+        ThreadPool(unsigned int nWorkers, const Numa::Topology &topology);
+
+        /// stops and joins all the workers
+        virtual ~ThreadPool();
+
+        /// the pool used by the default host multithread suite
+        static ThreadPool &getDefault();
+
+        /// number of threads that can run a region at once, including the calling thread
+        unsigned int getNumCPUs() const { return (unsigned int)_workers.size() + 1; }
+
+        /// the topology the workers are spread over
+        const Numa::Topology &getTopology() const { return _topology; }
+
+        /// the node worker n runs on
+        unsigned int getWorkerNode(unsigned int n) const { return _workers[n]->node; }
+
+        /// jobs taken from another thread's queue on the same node, and from other nodes
+        void getStealCounts(unsigned long long &local, unsigned long long &remote) const
+        {
+          local = _localSteals.load(std::memory_order_relaxed);
+          remote = _remoteSteals.load(std::memory_order_relaxed);
+        }
+
+        /// @see OfxMultiThreadSuiteV1.multiThread()
+        virtual OfxStatus multiThread(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg);
+
+        /// as multiThread, but for the host's own work, such as rendering several frames at
+        /// once, the jobs do not count as spawned threads to plugins and see a thread index of 0
+        virtual OfxStatus multiThreadHost(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg);
+
+        /// @see OfxMultiThreadSuiteV1.multiThreadIndex(), valid on any thread
+        static unsigned int getThreadIndex();
+
+        /// @see OfxMultiThreadSuiteV1.multiThreadIsSpawnedThread(), valid on any thread
+        static bool isSpawnedThread();
+      };
+
+      /// A recursive mutex as described by OfxMultiThreadSuiteV1, the owning thread
+      /// may lock it again and it is released when the lock count drops to zero.
+      class Mutex {
+      protected:
+        std::mutex              _lock;
+        std::condition_variable _released;
+        std::thread::id         _owner;
+        int                     _lockCount;
+
+      public:
+        /// a lockCount greater than zero creates the mutex already held that many times by this thread
+        explicit Mutex(int lockCount = 0);
+
+        /// block until we hold the mutex
+        void lock();
+
+        /// returns false if another thread holds the mutex
+        bool tryLock();
+
+        /// returns false if this thread did not hold the mutex
+        bool unlock();
+      };
+
+    } // namespace MultiThread
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_MULTITHREAD_H
@@ -0,0 +1,117 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_NUMA_H
+#define OFXH_NUMA_H
+
+#include <vector>
+#include <cstddef>
+
+namespace OFX {
+
+  namespace Host {
+
+    /// Where the machine's CPUs and memory are, for keeping render threads and the
+    /// images they work on together on multi-socket machines.
+    ///
+    /// This talks to Linux directly through sysfs, sched_setaffinity and mbind, it does
+    /// not need libnuma. Elsewhere, or with a single node, everything is one node and
+    /// nothing is pinned or bound.
+    ///
+    /// A topology can be simulated, which splits the CPUs into nodes so that the way
+    /// work is grouped and stolen can be tried out on a single node machine, but never
+    /// pins a thread or binds any memory. Setting the environment variable
+    /// OFX_HOST_NUMA_NODES to a number of nodes simulates that many in the default
+    /// topology.
+    namespace Numa {
+
+      /// the nodes of a machine and the CPUs in each
+      class Topology {
+      protected :
+        std::vector<std::vector<unsigned int> > _nodeCPUs;
+        std::vector<unsigned int>               _nodeIds;    ///< the kernel's number for each node
+        bool                                    _simulated;
+
+      public :
+        /// a single node holding every CPU, with nothing pinned or bound
+        Topology();
+
+        /// the machine's real topology, only counting CPUs this process may run on
+        static Topology detect();
+
+        /// a made up topology of nNodes nodes of cpusPerNode CPUs each
+        static Topology simulate(unsigned int nNodes, unsigned int cpusPerNode);
+
+        /// the topology the default thread pool and memory use
+        static const Topology &getDefault();
+
+        /// number of nodes, always at least one
+        unsigned int getNumNodes() const { return (unsigned int)_nodeCPUs.size(); }
+
+        /// the CPUs of a node
+        const std::vector<unsigned int> &getCPUs(unsigned int node) const { return _nodeCPUs[node]; }
+
+        /// the kernel's number for a node, which nodes without usable CPUs leave gaps in
+        unsigned int getNodeId(unsigned int node) const { return _nodeIds[node]; }
+
+        /// number of CPUs over all nodes
+        unsigned int getNumCPUs() const;
+
+        /// is this made up
+        bool isSimulated() const { return _simulated; }
+
+        /// are threads pinned and memory bound for this topology, which is so for real
+        /// topologies of more than one node
+        bool isBinding() const { return !_simulated && _nodeCPUs.size() > 1; }
+      };
+
+      /// Pin the calling thread to the CPUs of a node and record it as the thread's node.
+      /// The pinning only happens if the topology is binding, returns false if it was
+      /// attempted and failed. The topology must outlive the thread.
+      bool setThreadNode(const Topology &topology, unsigned int node);
+
+      /// the node recorded for the calling thread by setThreadNode, -1 if none
+      int getThreadNode();
+
+      /// Ask for the pages wholly inside nBytes at ptr to be placed on a node when they are
+      /// first touched, falling back to other nodes if it is full. Does nothing unless the
+      /// topology is binding, returns false if it was attempted and failed.
+      bool preferNode(const Topology &topology, void *ptr, size_t nBytes, unsigned int node);
+
+      /// as preferNode, for the calling thread's node, if it has one
+      bool preferThreadNode(void *ptr, size_t nBytes);
+
+    } // namespace Numa
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_NUMA_H
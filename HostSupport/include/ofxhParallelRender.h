@@ -0,0 +1,152 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_PARALLEL_RENDER_H
+#define OFXH_PARALLEL_RENDER_H
+
+#include <string>
+#include <vector>
+
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      // forward declare
+      class Instance;
+
+      /// Client code derives from this to be told when a ParallelRenderer has
+      /// finished a frame.
+      class FrameRenderListener {
+      public :
+        virtual ~FrameRenderListener() {}
+
+        /// Called on the thread that rendered the frame, straight after the
+        /// render action returned. The effect is the instance that actually
+        /// rendered the frame (the master instance or one of its render clones),
+        /// so the output for that time is to be fetched from its output clip.
+        ///
+        /// This may be called concurrently from several threads.
+        virtual void frameRendered(Instance &effect, OfxTime time, OfxStatus stat) = 0;
+      };
+
+      /// Renders a sequence of frames of an effect concurrently, as far as the
+      /// effect's render thread safety allows.
+      ///
+      ///   - kOfxImageEffectRenderFullySafe, several render actions are issued on the
+      ///     one instance at the same time,
+      ///   - kOfxImageEffectRenderInstanceSafe, a pool of clones of the instance is kept,
+      ///     each clone renders one frame at a time, their params are synchronised from the
+      ///     master instance before each sequence,
+      ///   - kOfxImageEffectRenderUnsafe, frames are rendered one at a time and no other
+      ///     ParallelRenderer will render any instance of the same plugin meanwhile.
+      ///
+      /// If the instance has kOfxImageEffectInstancePropSequentialRender set to 1, frames are
+      /// always rendered one at a time in frame order.
+      ///
+      /// Frames are rendered as host jobs through Host::multiThreadHost, and the number of
+      /// CPUs comes from Host::multiThreadNumCPUS. By default both use
+      /// MultiThread::ThreadPool::getDefault(), so any multiThread calls the plugin makes while
+      /// rendering share the same workers.
+      class ParallelRenderer {
+      public :
+        /// how frames are distributed over threads
+        enum Mode {
+          eRenderSerial,       ///< one frame at a time, in order, on the master instance
+          eRenderFullySafe,    ///< concurrent render actions on the master instance
+          eRenderInstanceSafe  ///< concurrent render actions on clones of the master instance
+        };
+
+      protected :
+        Instance               &_instance;      ///< the master instance
+        unsigned int            _maxThreads;    ///< most frames to render at once, 0 means the number of CPUs
+        std::vector<Instance *> _clones;        ///< render clones, owned by us, only used when instance safe
+        bool                    _clonesFailed;  ///< set if the instance could not be cloned
+        unsigned int            _lookAhead;     ///< frames to prefetch inputs for when rendering serially
+
+        /// make sure there are at least n-1 clones, returns how many instances can be used
+        unsigned int makeClones(unsigned int n);
+
+        /// copy the master's params onto the given clone
+        OfxStatus syncClone(Instance &clone);
+
+      public :
+        /// ctor, does not take ownership of the instance
+        explicit ParallelRenderer(Instance &instance, unsigned int maxThreads = 0);
+
+        /// dtor, destroys any render clones
+        virtual ~ParallelRenderer();
+
+        /// get the master instance
+        Instance &getInstance() { return _instance; }
+
+        /// the mode that would be used to render the instance as it currently stands
+        Mode getMode() const;
+
+        /// set the most frames to be rendered at once, 0 means the host's number of CPUs
+        void setMaxThreads(unsigned int n) { _maxThreads = n; }
+
+        /// the number of frames that could be rendered at once in the current mode
+        unsigned int getConcurrency() const;
+
+        /// When frames are rendered one at a time, fetch the inputs for the next n frames
+        /// in the background with an InputPrefetcher. 0, the default, turns this off.
+        void setLookAhead(unsigned int n) { _lookAhead = n; }
+
+        /// Render frames first to last inclusive, every step frames. This wraps the
+        /// begin/end sequence render actions around the render actions on every
+        /// instance used. The renderWindow is the one passed to each render action.
+        /// The listener, if not NULL, is told about each frame as it completes.
+        ///
+        /// Returns kOfxStatOK if all frames rendered, otherwise the status of the first
+        /// failing render action. Rendering stops early on failure, if the instance
+        /// asks to abort or if the calling thread's current CancelToken is cancelled.
+        virtual OfxStatus renderFrames(OfxTime             first,
+                                       OfxTime             last,
+                                       OfxTime             step,
+                                       const std::string  &field,
+                                       const OfxRectI     &renderWindow,
+                                       OfxPointD           renderScale,
+                                       bool                interactive,
+                                       bool                draft,
+                                       FrameRenderListener *listener);
+      };
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_PARALLEL_RENDER_H
@@ -0,0 +1,178 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_PIXEL_CONVERT_H
+#define OFXH_PIXEL_CONVERT_H
+
+#include <string>
+
+#include "ofxCore.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+      class Image;
+    }
+
+    namespace MultiThread {
+      class ThreadPool;
+    }
+
+    /// Conversion of pixels between the bit depths and components OFX images come in.
+    ///
+    /// When an effect cannot take a clip's depth or components, Instance::getClipPreferences
+    /// maps them to ones it can, and the host has to convert the images it passes. The
+    /// conversions here cover every pair of byte, short, half and float depths and RGBA,
+    /// RGB and Alpha components.
+    ///
+    /// Integer depths are clamped to 0..1 and rounded to nearest when converted to, half
+    /// conversion rounds to nearest even as the hardware does. Pixels are converted a row
+    /// at a time through float, with SSE2, AVX2 or AVX-512 kernels chosen when the first
+    /// conversion runs from what the CPU supports. Every kernel gives exactly the same
+    /// results as the scalar one.
+    ///
+    /// Components with no counterpart are filled in as follows, RGB to RGBA and RGB to
+    /// Alpha give an alpha of 1, Alpha to RGBA and Alpha to RGB copy the alpha into the
+    /// colour channels. YUVA only converts to YUVA.
+    ///
+    /// If an RGBA source is premultiplied and the destination unpremultiplied, or the
+    /// other way about, the colour is premultiplied or unpremultiplied in the same pass.
+    /// Unpremultiplying leaves the colour of pixels with zero alpha as it is.
+    namespace PixelConvert {
+
+      /// the OFX pixel depths
+      enum Depth {
+        eDepthNone,
+        eDepthByte,
+        eDepthShort,
+        eDepthHalf,
+        eDepthFloat
+      };
+
+      /// the OFX pixel components
+      enum Components {
+        eComponentsNone,
+        eComponentsRGBA,
+        eComponentsRGB,
+        eComponentsAlpha,
+        eComponentsYUVA
+      };
+
+      /// the OFX premultiplication states
+      enum PreMultiplication {
+        eImageOpaque,
+        eImagePreMultiplied,
+        eImageUnPreMultiplied
+      };
+
+      /// the instruction sets there are kernels for
+      enum InstructionSet {
+        eInstructionSetScalar,
+        eInstructionSetSSE2,
+        eInstructionSetAVX2,     ///< with F16C for halfs
+        eInstructionSetAVX512    ///< AVX-512F
+      };
+
+      /// map a kOfxBitDepth string, eDepthNone if it isn't one
+      Depth mapDepth(const std::string &depth);
+
+      /// map a kOfxImageComponent string, eComponentsNone if it isn't one
+      Components mapComponents(const std::string &components);
+
+      /// map a kOfxImageEffectPropPreMultiplication value, eImageOpaque if it isn't one
+      PreMultiplication mapPreMultiplication(const std::string &preMultiplication);
+
+      /// bytes in one component, 0 for eDepthNone
+      int getComponentBytes(Depth depth);
+
+      /// components in one pixel, 0 for eComponentsNone
+      int getComponentCount(Components components);
+
+      /// pixels in memory, laid out as an OFX image's
+      struct Buffer {
+        void              *data;              ///< address of pixel (bounds.x1, bounds.y1)
+        OfxRectI           bounds;            ///< the pixels addressable from data
+        int                rowBytes;          ///< bytes from one row to the next, may be negative
+        Depth              depth;
+        Components         components;
+        PreMultiplication  preMultiplication; ///< only matters for RGBA
+      };
+
+      /// a buffer describing an image's pixels
+      Buffer getBuffer(const ImageEffect::Image &image);
+
+      /// the best instruction set this CPU supports
+      InstructionSet getBestInstructionSet();
+
+      /// the instruction set conversions are using
+      InstructionSet getInstructionSet();
+
+      /// choose which kernels to use, clamped to the best this CPU supports, mostly
+      /// of use for testing and benchmarking
+      void setInstructionSet(InstructionSet set);
+
+      /// Convert n components of one depth to another, with no change of components.
+      void convertComponents(const void *src, Depth srcDepth, void *dst, Depth dstDepth, size_t n);
+
+      /// multiply the colour of n float RGBA pixels by their alpha, in place
+      void premultiply(float *rgba, size_t n);
+
+      /// divide the colour of n float RGBA pixels by their alpha, in place, pixels with
+      /// zero alpha are left as they are
+      void unpremultiply(float *rgba, size_t n);
+
+      /// Convert the pixels of src inside window into dst, the window is clipped to
+      /// both buffers' bounds. Large windows are split by rows over the pool, which is
+      /// MultiThread::ThreadPool::getDefault() if NULL. The buffers must not overlap.
+      ///
+      /// \returns
+      ///   - kOfxStatOK
+      ///   - kOfxStatErrUnsupported - if either format is unknown, or there is no
+      ///                              conversion between their components
+      OfxStatus convert(const Buffer &src,
+                        const Buffer &dst,
+                        const OfxRectI &window,
+                        MultiThread::ThreadPool *pool = 0);
+
+      /// as above, for images, the window defaulting to the intersection of their bounds
+      OfxStatus convert(const ImageEffect::Image &src,
+                        ImageEffect::Image &dst,
+                        const OfxRectI *window = 0,
+                        MultiThread::ThreadPool *pool = 0);
+
+    } // namespace PixelConvert
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_PIXEL_CONVERT_H
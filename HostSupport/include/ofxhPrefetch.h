@@ -0,0 +1,183 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_PREFETCH_H
+#define OFXH_PREFETCH_H
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+#include "ofxhMemoryGovernor.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      // forward declare
+      class Instance;
+      class ClipInstance;
+      class Image;
+
+      /// Fetches the input images an effect will need for the next few frames of a
+      /// sequence render on a background thread, while the effect renders the current one.
+      ///
+      /// Before rendering each frame the host calls prefetch, which runs the frames needed
+      /// and regions of interest actions for that frame and the lookAhead frames after it,
+      /// then queues a ClipInstance::getImage for every input image they ask for. While a
+      /// prefetcher is attached to an instance, images the plugin fetches through the image
+      /// effect suite come from the prefetched ones where they cover what was asked for,
+      /// waiting for one still being fetched rather than fetching it again.
+      ///
+      /// The host's ClipInstance::getImage on input clips is called from the prefetch
+      /// thread while the plugin renders, so it needs to be thread safe.
+      ///
+      /// Prefetched images count towards the Memory::Governor's budget and are the
+      /// first thing it purges.
+      class InputPrefetcher : private Memory::Purgeable {
+      protected :
+        /// an input image at a time
+        struct Key {
+          ClipInstance *clip;
+          OfxTime       time;
+
+          bool operator<(const Key &other) const
+          {
+            if(clip != other.clip)
+              return clip < other.clip;
+            return time < other.time;
+          }
+        };
+
+        /// a prefetched image, or one being fetched
+        struct Entry {
+          Image         *image;       ///< our reference, NULL until fetched or if the fetch failed
+          OfxRectD       bounds;      ///< canonical region fetched, already clipped to the rod
+          bool           pending;     ///< not fetched yet
+          bool           fetching;    ///< a thread is fetching it right now
+          unsigned int   generation;  ///< the last prefetch call that wanted it
+          size_t         bytes;       ///< size of the image, as counted by the memory governor
+        };
+
+        /// an image a frame's actions asked for
+        struct Request {
+          ClipInstance *clip;
+          OfxTime       time;
+          OfxRectD      bounds;
+        };
+
+        Instance                      &_instance;
+        unsigned int                   _lookAhead;   ///< frames after the current one to prefetch
+        std::map<Key, Entry>           _entries;
+        std::deque<Key>                _queue;       ///< entries waiting to be fetched, in order
+        unsigned int                   _generation;  ///< bumped by each prefetch call
+        std::mutex                     _lock;
+        std::condition_variable        _wake;        ///< something has been queued, or stop
+        std::condition_variable        _fetched;     ///< a pending entry has been fetched
+        bool                           _stop;
+        std::thread                    _thread;
+
+        // only used by the thread calling prefetch
+        std::map<OfxTime, std::vector<Request> > _frameRequests;  ///< what each frame in the window asked for
+        OfxPointD                      _requestScale;   ///< render scale _frameRequests were made at
+        OfxRectI                       _requestWindow;  ///< render window _frameRequests were made for
+        OfxTime                        _requestStep;    ///< step _frameRequests were made with
+
+        /// the main loop of the prefetch thread
+        void threadMain();
+
+        /// fetch a pending entry's image, called and returns with the lock held
+        void fetch(std::unique_lock<std::mutex> &guard, const Key &key);
+
+        /// run the frames needed and region of interest actions for one frame, called without the lock
+        void frameRequests(OfxTime frame, OfxPointD renderScale, const OfxRectD &window, std::vector<Request> &requests);
+
+        /// ask for one image, called with the lock held
+        void want(ClipInstance *clip, OfxTime time, const OfxRectD &bounds);
+
+        /// drop everything not wanted by the current generation, called with the lock held
+        void evict();
+
+        /// release an entry's image, called with the lock held
+        void release(Entry &entry);
+
+        /// Memory::Purgeable override, releases prefetched images that are not being waited on
+        virtual size_t purge(size_t nBytes);
+
+      public :
+        /// attaches itself to the instance and starts the prefetch thread
+        explicit InputPrefetcher(Instance &instance, unsigned int lookAhead = 2);
+
+        /// detaches from the instance, stops the thread and releases every prefetched
+        /// image, so this must be destroyed before the instance or its clips
+        virtual ~InputPrefetcher();
+
+        /// the instance we prefetch for
+        Instance &getInstance() { return _instance; }
+
+        /// set how many frames past the current one to prefetch
+        void setLookAhead(unsigned int n);
+
+        /// Call on the render thread before rendering time, as part of a sequence ending at
+        /// last going forwards or backwards by step. This queues fetches for whatever time and
+        /// the frames after it need that is not already prefetched, and releases anything no
+        /// longer needed. The frames needed and region of interest actions are only run for
+        /// frames new to the window, what earlier calls found is kept while the render scale,
+        /// window and step stay the same.
+        virtual void prefetch(OfxTime time,
+                              OfxTime last,
+                              OfxTime step,
+                              OfxPointD renderScale,
+                              const OfxRectI &renderWindow);
+
+        /// Get a prefetched image covering the bounds, which are as passed to clipGetImage,
+        /// waiting for it if it is still being fetched. Returns NULL if there is no such
+        /// image, otherwise the caller owns a new reference on it.
+        virtual Image *getImage(ClipInstance *clip, OfxTime time, const OfxRectD *optionalBounds);
+
+        /// release every prefetched image and forget anything queued
+        virtual void clear();
+      };
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_PREFETCH_H
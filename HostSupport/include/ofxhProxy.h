@@ -0,0 +1,190 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_PROXY_H
+#define OFXH_PROXY_H
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+#include "ofxhMemoryGovernor.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      // forward declare
+      class Instance;
+      class ClipInstance;
+      class Image;
+      class SpillCache;
+
+      /// Reduced render scale copies of an image, made on demand.
+      ///
+      /// Level 0 is the image itself, each level after it is half the render scale of the
+      /// one before, made from it with a 2x2 box filter when first asked for. An image at
+      /// a scale between two levels is resampled from the larger one with a bilinear
+      /// filter, and is not kept.
+      class ProxyPyramid {
+      protected :
+        ClipInstance         &_clip;     ///< the clip the image came from
+        std::vector<Image *>  _levels;   ///< our references, NULL until made, never resized
+        OfxPointD             _scale;    ///< render scale of level 0
+        std::atomic<size_t>   _bytes;    ///< bytes of pixels in the reduced levels
+        std::mutex            _lock;     ///< guards _levels, only held to read or publish one
+
+        /// Level n with a reference for the caller, making it and any before it that are
+        /// missing. Levels are made without the lock held, as allocating them may purge the
+        /// cache holding us, so two threads may make the same level, the first to publish
+        /// it wins.
+        Image *getLevel(int n);
+
+      public :
+        /// takes a reference on the image, which came from the clip
+        ProxyPyramid(ClipInstance &clip, Image &image);
+
+        /// releases every level
+        virtual ~ProxyPyramid();
+
+        /// render scale of the image the pyramid was made from
+        OfxPointD getScale() const { return _scale; }
+
+        /// the image the pyramid was made from
+        Image &getImage() const { return *_levels[0]; }
+
+        /// bytes of pixels in the reduced levels made so far
+        size_t getBytes() const;
+
+        /// The image at renderScale, with a reference for the caller. Returns NULL if
+        /// renderScale is larger than the pyramid's in either direction, or if the pixels
+        /// can't be filtered.
+        Image *getImage(OfxPointD renderScale);
+      };
+
+      /// Keeps the input images an effect fetched, so that fetches of the same frame at a
+      /// lower render scale are served from a ProxyPyramid of them rather than fetched from
+      /// the host again. This is what makes interactive renders at a proxy scale cheap
+      /// once the frame has been seen at full scale, and it also scales down images a host
+      /// returns at a larger render scale than the effect is rendering at.
+      ///
+      /// While a cache is attached to an instance, input images the plugin fetches through
+      /// the image effect suite go through it. The cache can't tell when upstream images
+      /// change, so the host must clear it when they do.
+      ///
+      /// Cached pyramids count towards the Memory::Governor's budget and are purged after
+      /// prefetched images. With a SpillCache set, evicted images are spilt to it rather
+      /// than lost, and misses look there before going to the clip.
+      class ProxyCache : private Memory::Purgeable {
+      protected :
+        /// an input frame
+        struct Key {
+          ClipInstance *clip;
+          OfxTime       time;
+
+          bool operator<(const Key &other) const
+          {
+            if(clip != other.clip)
+              return clip < other.clip;
+            return time < other.time;
+          }
+        };
+
+        /// a cached frame, the pyramid is shared with fetches still reading from it
+        struct Entry {
+          std::shared_ptr<ProxyPyramid>  pyramid;
+          size_t                         bytes;     ///< of the image, as counted by the memory governor
+          unsigned long long             lastUsed;  ///< when it was last fetched, for eviction
+        };
+
+        Instance                 &_instance;
+        SpillCache               *_spill;      ///< where evicted images go, if anywhere
+        size_t                    _maxFrames;  ///< most frames kept
+        std::map<Key, Entry>      _entries;
+        unsigned long long        _clock;      ///< ticks on every fetch
+        std::mutex                _lock;
+
+        /// drop the least recently used entry, spilling it if there is a spill cache,
+        /// called with the lock held, returns the bytes it held
+        size_t evictOne();
+
+        /// drop an entry, called with the lock held
+        void release(std::map<Key, Entry>::iterator it);
+
+        /// Memory::Purgeable override, drops the least recently used pyramids
+        virtual size_t purge(size_t nBytes);
+
+      public :
+        /// attaches itself to the instance
+        explicit ProxyCache(Instance &instance, size_t maxFrames = 8);
+
+        /// detaches from the instance and releases every cached image, so this must be
+        /// destroyed before the instance or its clips
+        virtual ~ProxyCache();
+
+        /// the instance we cache for
+        Instance &getInstance() { return _instance; }
+
+        /// set the most frames kept
+        void setMaxFrames(size_t n);
+
+        /// set the tier evicted images are spilt to, which must outlive us, NULL for none
+        void setSpillCache(SpillCache *spill);
+
+        /// the tier evicted images are spilt to, if any
+        SpillCache *getSpillCache() const { return _spill; }
+
+        /// Fetch an input image at renderScale, from the cache if a cached image at the
+        /// same or a larger scale covers the optional bounds, otherwise from the clip, in
+        /// which case the image is cached. Returns the image with a reference for the
+        /// caller, or NULL if the clip had none.
+        Image *getImage(ClipInstance *clip, OfxTime time, OfxPointD renderScale, const OfxRectD *optionalBounds);
+
+        /// forget every cached image, spilt ones included, call this when upstream images change
+        void clear();
+
+        /// forget every cached image of one clip, spilt ones included
+        void clear(ClipInstance *clip);
+      };
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_PROXY_H
@@ -0,0 +1,168 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OFXH_SPILL_H
+#define OFXH_SPILL_H
+
+#include <map>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      // forward declare
+      class ClipInstance;
+      class Image;
+
+      /// A second tier for an image cache, which keeps images the cache evicts in files
+      /// in a scratch directory rather than losing them. Reading a frame back is much
+      /// cheaper than rendering it again for expensive upstream effects.
+      ///
+      /// Spilling an image only queues it, an I/O thread writes it out through a memory
+      /// mapping while the image stays fetchable from memory. A fetch that hits promotes the
+      /// image back, it is mapped from its file and the entry and file are removed, so the
+      /// caller's cache owns it again. The files take no more than the disk budget, the
+      /// least recently spilled go first. Every file is removed when the cache is destroyed.
+      ///
+      /// Spilling needs memory mapped files, elsewhere nothing is kept.
+      class SpillCache {
+      protected :
+        /// a frame, as the RAM cache keys it
+        struct Key {
+          ClipInstance *clip;
+          OfxTime       time;
+
+          bool operator<(const Key &other) const
+          {
+            if(clip != other.clip)
+              return clip < other.clip;
+            return time < other.time;
+          }
+        };
+
+        /// a spilt image and what is needed to make it again
+        struct Entry {
+          Image              *pending;    ///< our reference while it waits to be written, NULL once it is
+          std::string         path;       ///< its file, once written
+          size_t              bytes;      ///< of pixels, as laid out in the file
+          unsigned long long  spilt;      ///< when it was spilt, for eviction
+
+          // the image's description, the file holds its rows bottom up with no padding
+          OfxRectI            bounds;
+          OfxRectI            rod;
+          int                 rowBytes;
+          OfxPointD           renderScale;
+          double              pixelAspectRatio;
+          std::string         depth;
+          std::string         components;
+          std::string         preMultiplication;
+          std::string         field;
+          std::string         uniqueIdentifier;
+        };
+
+        std::string               _directory;
+        size_t                    _budget;       ///< most bytes in files, including those being written
+        size_t                    _bytes;        ///< bytes in files and queued for them
+        std::map<Key, Entry>      _entries;
+        std::deque<Key>           _queue;        ///< entries waiting to be written
+        unsigned long long        _clock;        ///< ticks on every spill
+        unsigned long long        _nFiles;       ///< files ever made, to name them
+        bool                      _writing;      ///< the writer has an entry out of the queue
+        bool                      _stop;
+        std::mutex                _lock;
+        std::condition_variable   _wake;         ///< the writer waits on this for work
+        std::condition_variable   _idle;         ///< flush waits on this for the writer
+        std::thread               _writer;
+
+        /// the main loop of the I/O thread
+        void writerMain();
+
+        /// drop an entry and its file, called with the lock held
+        void remove(std::map<Key, Entry>::iterator it);
+
+        /// drop the least recently spilt entries until nBytes more fit in the budget,
+        /// called with the lock held, returns false if they never can
+        bool makeRoom(size_t nBytes);
+
+      public :
+        /// keep files in directory, which is made if need be, using at most diskBudget bytes
+        SpillCache(const std::string &directory, size_t diskBudget);
+
+        /// stops the I/O thread, dropping anything not yet written, and removes every file
+        virtual ~SpillCache();
+
+        /// the directory files go in
+        const std::string &getDirectory() const { return _directory; }
+
+        /// set the most bytes kept, dropping entries until they fit
+        void setBudget(size_t nBytes);
+
+        /// bytes in files and queued to be written
+        size_t getBytes();
+
+        /// number of images kept
+        size_t getCount();
+
+        /// Keep an image the RAM cache is evicting, replacing any kept for the same frame.
+        /// This takes a reference on the image and returns straight away. Images whose
+        /// pixels can't be addressed or that are larger than the budget are not kept.
+        void spill(ClipInstance *clip, OfxTime time, Image &image);
+
+        /// Take back an image, with a reference for the caller, or NULL if there is none.
+        /// The entry is removed from this tier.
+        Image *fetch(ClipInstance *clip, OfxTime time);
+
+        /// wait until everything queued so far has been written
+        void flush();
+
+        /// drop everything kept
+        void clear();
+
+        /// drop everything kept for one clip
+        void clear(ClipInstance *clip);
+      };
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
+
+#endif // OFXH_SPILL_H
@@ -124,6 +124,18 @@ namespace OFX {
     return r;
   }
 
+  /// get the intersection of the two rects, which has zero area if they don't overlap
+  inline OfxRectI Intersection(const OfxRectI &a,
+                               const OfxRectI &b)
+  {
+    OfxRectI r;
+    r.x1 = Maximum(a.x1, b.x1);
+    r.x2 = Maximum(r.x1, Minimum(a.x2, b.x2));
+    r.y1 = Maximum(a.y1, b.y1);
+    r.y2 = Maximum(r.y1, Minimum(a.y2, b.y2));
+    return r;
+  }
+
   /// get the union of the two rects
   inline OfxRectD Union(const OfxRectD &a,
                         const OfxRectD &b)
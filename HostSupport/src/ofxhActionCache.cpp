@@ -0,0 +1,226 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhParam.h"
+#include "ofxhImageEffect.h"
+#include "ofxhActionCache.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      bool ActionCache::RoDKey::operator<(const RoDKey &b) const
+      {
+        if(time != b.time) return time < b.time;
+        if(renderScale.x != b.renderScale.x) return renderScale.x < b.renderScale.x;
+        return renderScale.y < b.renderScale.y;
+      }
+
+      bool ActionCache::IdentityKey::operator<(const IdentityKey &b) const
+      {
+        if(time != b.time) return time < b.time;
+        if(renderScale.x != b.renderScale.x) return renderScale.x < b.renderScale.x;
+        if(renderScale.y != b.renderScale.y) return renderScale.y < b.renderScale.y;
+        if(renderWindow.x1 != b.renderWindow.x1) return renderWindow.x1 < b.renderWindow.x1;
+        if(renderWindow.y1 != b.renderWindow.y1) return renderWindow.y1 < b.renderWindow.y1;
+        if(renderWindow.x2 != b.renderWindow.x2) return renderWindow.x2 < b.renderWindow.x2;
+        if(renderWindow.y2 != b.renderWindow.y2) return renderWindow.y2 < b.renderWindow.y2;
+        return field < b.field;
+      }
+
+      ActionCache::ActionCache(size_t maxEntries)
+        : _revision(0)
+        , _maxEntries(maxEntries)
+        , _haveTimeDomain(false)
+        , _timeDomainStat(kOfxStatOK)
+      {
+        _timeDomain.min = _timeDomain.max = 0;
+      }
+
+      void ActionCache::clear()
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _rods.clear();
+        _identities.clear();
+        _framesNeeded.clear();
+        _haveTimeDomain = false;
+      }
+
+      bool ActionCache::checkRevision(unsigned int revision)
+      {
+        if(revision == _revision)
+          return true;
+
+        // a reader that started before the latest bump, just miss rather than throw away what
+        // was computed at the newer revision, the signed difference copes with wrapping
+        if((int)(revision - _revision) < 0)
+          return false;
+
+        _rods.clear();
+        _identities.clear();
+        _framesNeeded.clear();
+        _haveTimeDomain = false;
+        _revision = revision;
+        return false;
+      }
+
+      bool ActionCache::getRegionOfDefinition(unsigned int revision, OfxTime time, OfxPointD renderScale, OfxStatus &stat, OfxRectD &rod)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(!checkRevision(revision))
+          return false;
+
+        RoDKey key = { time, renderScale };
+        std::map<RoDKey, RoDResult>::const_iterator it = _rods.find(key);
+        if(it == _rods.end())
+          return false;
+
+        stat = it->second.stat;
+        rod = it->second.rod;
+        return true;
+      }
+
+      void ActionCache::setRegionOfDefinition(unsigned int revision, OfxTime time, OfxPointD renderScale, OfxStatus stat, const OfxRectD &rod)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        // computed against something that has since changed
+        if(revision != _revision)
+          return;
+
+        if(_rods.size() >= _maxEntries)
+          _rods.clear();
+
+        RoDKey key = { time, renderScale };
+        RoDResult &result = _rods[key];
+        result.stat = stat;
+        result.rod = rod;
+      }
+
+      bool ActionCache::getIdentity(unsigned int revision, OfxTime time, const std::string &field, const OfxRectI &renderWindow, OfxPointD renderScale,
+                                    OfxStatus &stat, OfxTime &identityTime, std::string &clip)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(!checkRevision(revision))
+          return false;
+
+        IdentityKey key = { time, field, renderWindow, renderScale };
+        std::map<IdentityKey, IdentityResult>::const_iterator it = _identities.find(key);
+        if(it == _identities.end())
+          return false;
+
+        stat = it->second.stat;
+        identityTime = it->second.time;
+        clip = it->second.clip;
+        return true;
+      }
+
+      void ActionCache::setIdentity(unsigned int revision, OfxTime time, const std::string &field, const OfxRectI &renderWindow, OfxPointD renderScale,
+                                    OfxStatus stat, OfxTime identityTime, const std::string &clip)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(revision != _revision)
+          return;
+
+        if(_identities.size() >= _maxEntries)
+          _identities.clear();
+
+        IdentityKey key = { time, field, renderWindow, renderScale };
+        IdentityResult &result = _identities[key];
+        result.stat = stat;
+        result.time = identityTime;
+        result.clip = clip;
+      }
+
+      bool ActionCache::getFramesNeeded(unsigned int revision, OfxTime time, OfxStatus &stat, RangeMap &rangeMap)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(!checkRevision(revision))
+          return false;
+
+        std::map<OfxTime, FramesNeededResult>::const_iterator it = _framesNeeded.find(time);
+        if(it == _framesNeeded.end())
+          return false;
+
+        stat = it->second.stat;
+        rangeMap = it->second.rangeMap;
+        return true;
+      }
+
+      void ActionCache::setFramesNeeded(unsigned int revision, OfxTime time, OfxStatus stat, const RangeMap &rangeMap)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(revision != _revision)
+          return;
+
+        if(_framesNeeded.size() >= _maxEntries)
+          _framesNeeded.clear();
+
+        FramesNeededResult &result = _framesNeeded[time];
+        result.stat = stat;
+        result.rangeMap = rangeMap;
+      }
+
+      bool ActionCache::getTimeDomain(unsigned int revision, OfxStatus &stat, OfxRangeD &range)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(!checkRevision(revision) || !_haveTimeDomain)
+          return false;
+
+        stat = _timeDomainStat;
+        range = _timeDomain;
+        return true;
+      }
+
+      void ActionCache::setTimeDomain(unsigned int revision, OfxStatus stat, const OfxRangeD &range)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(revision != _revision)
+          return;
+
+        _haveTimeDomain = true;
+        _timeDomainStat = stat;
+        _timeDomain = range;
+      }
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
@@ -0,0 +1,105 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+
+// ofx host
+#include "ofxhCancel.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    /// the current token on this thread
+    static thread_local CancelToken *tCurrent = 0;
+
+    CancelToken::CancelToken(CancelToken *parent)
+      : _cancelled(false)
+      , _parent(0)
+    {
+      if(parent) {
+        std::lock_guard<std::mutex> guard(parent->_lock);
+        _parent = parent;
+        parent->_children.push_back(this);
+
+        // the parent may have been cancelled already
+        if(parent->isCancelled())
+          _cancelled = true;
+      }
+    }
+
+    CancelToken::~CancelToken()
+    {
+      // children should have gone first, any left just stop hearing from us
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        for(size_t i = 0; i < _children.size(); ++i)
+          _children[i]->_parent = 0;
+        _children.clear();
+      }
+
+      // _parent is only changed under the parent's lock, which the parent takes to
+      // detach us in its dtor, so the parent has to be alive while we look at it
+      if(_parent) {
+        std::lock_guard<std::mutex> guard(_parent->_lock);
+        std::vector<CancelToken *> &siblings = _parent->_children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), this), siblings.end());
+      }
+    }
+
+    void CancelToken::cancel()
+    {
+      std::lock_guard<std::mutex> guard(_lock);
+      if(_cancelled.exchange(true))
+        return;
+
+      for(size_t i = 0; i < _children.size(); ++i)
+        _children[i]->cancel();
+    }
+
+    CancelToken *CancelToken::getCurrent()
+    {
+      return tCurrent;
+    }
+
+    CancelScope::CancelScope(CancelToken *token)
+      : _saved(tCurrent)
+    {
+      tCurrent = token;
+    }
+
+    CancelScope::~CancelScope()
+    {
+      tCurrent = _saved;
+    }
+
+  } // namespace Host
+
+} // namespace OFX
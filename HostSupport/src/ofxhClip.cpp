@@ -28,6 +28,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <assert.h>
+#include <string.h>
+#include <math.h>
 
 // ofx
 #include "ofxCore.h"
@@ -37,9 +39,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ofxhPropertySuite.h"
 #include "ofxhClip.h"
 #include "ofxhImageEffect.h"
+#include "ofxhTrace.h"
 #ifdef OFX_SUPPORTS_OPENGLRENDER
 #include "ofxOpenGLRender.h"
 #endif
+#include "ofxOld.h" // for YUVA
 
 namespace OFX {
 
@@ -422,19 +426,15 @@ namespace OFX {
         // add the second dimension of the render scale
         inArgs.setDoubleProperty(kOfxPropTime,time);
         inArgs.setDoublePropertyN(kOfxImageEffectPropRenderScale, &renderScale.x, 2);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)_effectInstance<<"->"<<kOfxActionInstanceChanged<<"("<<kOfxTypeClip<<","<<getName()<<","<<why<<","<<time<<",("<<renderScale.x<<","<<renderScale.y<<"))"<<std::endl;
-#       endif
 
         OfxStatus st;
         if(_effectInstance){
+          Trace::Scope trace(kOfxActionInstanceChanged, _effectInstance, time);
           st = _effectInstance->mainEntry(kOfxActionInstanceChanged, _effectInstance->getHandle(), &inArgs, 0);
+          trace.setStatus(st);
         } else {
           st = kOfxStatFailed;
         }
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)_effectInstance<<"->"<<kOfxActionInstanceChanged<<"("<<kOfxTypeClip<<","<<getName()<<","<<why<<","<<time<<",("<<renderScale.x<<","<<renderScale.y<<"))->"<<StatStr(st)<<std::endl;
-#       endif
         return st;
       }
 
@@ -454,8 +454,8 @@ namespace OFX {
         if(!_effectInstance->isChromaticComponent(s))
           return s;
 
-        /// Means we have RGBA or Alpha being passed in and the clip
-        /// only supports the other one, so return that
+        /// Means we have RGBA, RGB or Alpha being passed in and the clip
+        /// only supports one of the others, so return that
         if(s == rgba) {
           if(isSupportedComponent(rgb))
             return rgb;
@@ -466,6 +466,11 @@ namespace OFX {
             return rgba;
           if(isSupportedComponent(rgb))
             return rgb;
+        } else if(s == rgb) {
+          if(isSupportedComponent(rgba))
+            return rgba;
+          if(isSupportedComponent(alpha))
+            return alpha;
         }
 
         /// wierd, must be some custom bit , if only one, choose that, otherwise no idea
@@ -577,15 +582,40 @@ namespace OFX {
         return rod;
       }
 
+      int ImageBase::getPixelBytes() const
+      {
+        const std::string &comps = getStringProperty(kOfxImageEffectPropComponents);
+        const std::string &depth = getStringProperty(kOfxImageEffectPropPixelDepth);
+
+        int nComps = 0;
+        if(comps == kOfxImageComponentRGBA || comps == kOfxImageComponentYUVA)
+          nComps = 4;
+        else if(comps == kOfxImageComponentRGB)
+          nComps = 3;
+        else if(comps == kOfxImageComponentAlpha)
+          nComps = 1;
+
+        int compBytes = 0;
+        if(depth == kOfxBitDepthByte)
+          compBytes = 1;
+        else if(depth == kOfxBitDepthShort || depth == kOfxBitDepthHalf)
+          compBytes = 2;
+        else if(depth == kOfxBitDepthFloat)
+          compBytes = 4;
+
+        return nComps * compBytes;
+      }
+
       ImageBase::~ImageBase() {
         //assert(_referenceCount <= 0);
       }
 
-      // release the reference 
+      // release the reference, this may be called from any thread
       void ImageBase::releaseReference()
       {
-        _referenceCount -= 1;
-        if(_referenceCount <= 0)
+        // release our writes to the image, and have whoever drops the last reference
+        // acquire everyone else's before deleting it
+        if(_referenceCount.fetch_sub(1, std::memory_order_acq_rel) <= 1)
           delete this;
       }
 
@@ -629,6 +659,291 @@ namespace OFX {
       Image::~Image() {
         //assert(_referenceCount <= 0);
       }
+
+      ImageView::ImageView(Image &source,
+                           ClipInstance& instance,
+                           double renderScaleX, 
+                           double renderScaleY,
+                           void* data,
+                           const OfxRectI &bounds,
+                           const OfxRectI &rod,
+                           int rowBytes,
+                           std::string field,
+                           std::string uniqueIdentifier) 
+        : Image(instance, renderScaleX, renderScaleY, data, bounds, rod, rowBytes, field, uniqueIdentifier)
+        , _source(&source)
+      {
+        _source->addReference();
+      }
+
+      ImageView::ImageView(Image &source, const OfxRectI &bounds)
+        : Image()
+        , _source(&source)
+      {
+        static const char * const strings[] = {
+          kOfxImageEffectPropPixelDepth, kOfxImageEffectPropComponents, kOfxImageEffectPropPreMultiplication,
+          kOfxImagePropField, kOfxImageClipPropFieldOrder, kOfxImagePropUniqueIdentifier, 0
+        };
+        for(int i = 0; strings[i]; ++i)
+          setStringProperty(strings[i], source.getStringProperty(strings[i]));
+
+        double renderScale[2];
+        source.getDoublePropertyN(kOfxImageEffectPropRenderScale, renderScale, 2);
+        setDoublePropertyN(kOfxImageEffectPropRenderScale, renderScale, 2);
+        setDoubleProperty(kOfxImagePropPixelAspectRatio, source.getDoubleProperty(kOfxImagePropPixelAspectRatio));
+
+        OfxRectI rod = source.getROD();
+        setIntPropertyN(kOfxImagePropRegionOfDefinition, &rod.x1, 4);
+        setIntPropertyN(kOfxImagePropBounds, &bounds.x1, 4);
+
+        int rowBytes = source.getIntProperty(kOfxImagePropRowBytes);
+        setIntProperty(kOfxImagePropRowBytes, rowBytes);
+
+        char *data = static_cast<char *>(source.getPointerProperty(kOfxImagePropData));
+        OfxRectI srcBounds = source.getBounds();
+        if(data)
+          data += (ptrdiff_t)(bounds.y1 - srcBounds.y1) * rowBytes + (ptrdiff_t)(bounds.x1 - srcBounds.x1) * source.getPixelBytes();
+        setPointerProperty(kOfxImagePropData, data);
+
+        _source->addReference();
+      }
+
+      ImageView::~ImageView() {
+        _source->releaseReference();
+      }
+
+      Image *cropImage(Image *image, const OfxRectI &bounds)
+      {
+        if(!image)
+          return 0;
+
+        OfxRectI srcBounds = image->getBounds();
+        OfxRectI cropped = Intersection(srcBounds, bounds);
+        if(memcmp(&cropped, &srcBounds, sizeof(OfxRectI)) == 0)
+          return image;
+
+        // can't address into pixels we don't understand
+        if(image->getPixelBytes() == 0 || !image->getPointerProperty(kOfxImagePropData))
+          return image;
+
+        // nothing left, collapse the bounds onto the source's bottom left so the view's
+        // data pointer still points into the source's pixels
+        if(cropped.x1 >= cropped.x2 || cropped.y1 >= cropped.y2)
+          cropped.x1 = cropped.x2 = srcBounds.x1, cropped.y1 = cropped.y2 = srcBounds.y1;
+
+        ImageView *view = new ImageView(*image, cropped);
+
+        // the view holds its own reference
+        image->releaseReference();
+        return view;
+      }
+
+      Image *cropImage(Image *image, const OfxRectD &bounds)
+      {
+        if(!image)
+          return 0;
+
+        double renderScale[2];
+        image->getDoublePropertyN(kOfxImageEffectPropRenderScale, renderScale, 2);
+        double par = image->getDoubleProperty(kOfxImagePropPixelAspectRatio);
+        if(par <= 0)
+          par = 1;
+
+        OfxRectI pixels;
+        pixels.x1 = int(floor(bounds.x1 * renderScale[0] / par));
+        pixels.y1 = int(floor(bounds.y1 * renderScale[1]));
+        pixels.x2 = int(ceil(bounds.x2 * renderScale[0] / par));
+        pixels.y2 = int(ceil(bounds.y2 * renderScale[1]));
+        return cropImage(image, pixels);
+      }
+
+      Image *flipImage(Image *image)
+      {
+        if(!image)
+          return 0;
+
+        char *data = static_cast<char *>(image->getPointerProperty(kOfxImagePropData));
+        if(!data)
+          return image;
+
+        OfxRectI bounds = image->getBounds();
+        ImageView *view = new ImageView(*image, bounds);
+
+        // the top row becomes the bottom one
+        int rowBytes = image->getIntProperty(kOfxImagePropRowBytes);
+        if(bounds.y2 > bounds.y1)
+          data += (ptrdiff_t)(bounds.y2 - bounds.y1 - 1) * rowBytes;
+        view->setPointerProperty(kOfxImagePropData, data);
+        view->setIntProperty(kOfxImagePropRowBytes, -rowBytes);
+
+        // the view holds its own reference
+        image->releaseReference();
+        return view;
+      }
+
+      /// 0 for the lower field, rows 0,2,4..., 1 for the upper field, -1 for neither
+      static int fieldParity(const std::string &field)
+      {
+        if(field == kOfxImageFieldLower)
+          return 0;
+        if(field == kOfxImageFieldUpper)
+          return 1;
+        return -1;
+      }
+
+      /// the first row at or above y in the field with the given parity
+      static int firstFieldRow(int y, int parity)
+      {
+        return ((y - parity) & 1) ? y + 1 : y;
+      }
+
+      /// the rows y1 to y2 of a frame, as rows of one of its fields
+      static void fieldRows(int y1, int y2, int parity, int &fieldY1, int &fieldY2)
+      {
+        int first = firstFieldRow(y1, parity);
+        fieldY1 = (first - parity) / 2;
+        fieldY2 = fieldY1 + (y2 > first ? (y2 - first + 1) / 2 : 0);
+      }
+
+      FieldDoubledImage::FieldDoubledImage(Image &source, ClipInstance &instance, const std::string &field)
+        : Image(instance,
+                source.getDoubleProperty(kOfxImageEffectPropRenderScale, 0),
+                source.getDoubleProperty(kOfxImageEffectPropRenderScale, 1),
+                0,
+                source.getBounds(),
+                source.getROD(),
+                0,
+                field,
+                source.getStringProperty(kOfxImagePropUniqueIdentifier) + "/" + field)
+        , _source(&source)
+        , _parity(fieldParity(field))
+        , _doubled(false)
+      {
+        _source->addReference();
+
+        OfxRectI bounds = getBounds();
+        setIntProperty(kOfxImagePropRowBytes, (bounds.x2 - bounds.x1) * source.getPixelBytes());
+        setGetHook(kOfxImagePropData, this);
+      }
+
+      FieldDoubledImage::~FieldDoubledImage()
+      {
+        _source->releaseReference();
+      }
+
+      void *FieldDoubledImage::getDoubledPixels() const
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(_doubled)
+          return _pixels.getPtr();
+        _doubled = true;
+
+        const char *src = static_cast<const char *>(_source->getPointerProperty(kOfxImagePropData));
+        OfxRectI bounds = getBounds();
+        int srcRowBytes = _source->getIntProperty(kOfxImagePropRowBytes);
+        int rowBytes = getIntPropertyRaw(kOfxImagePropRowBytes);
+        int height = bounds.y2 - bounds.y1;
+        if(!src || rowBytes <= 0 || height <= 0 || !_pixels.alloc(size_t(rowBytes) * height))
+          return 0;
+
+        char *dst = static_cast<char *>(_pixels.getPtr());
+        for(int y = bounds.y1; y < bounds.y2; ++y) {
+          // each field row fills itself and the row above, the lowest row of the upper
+          // field also fills the one below it
+          int from = ((y - _parity) & 1) ? y - 1 : y;
+          if(from < bounds.y1)
+            from = Minimum(y + 1, bounds.y2 - 1);
+          memcpy(dst + ptrdiff_t(y - bounds.y1) * rowBytes, src + ptrdiff_t(from - bounds.y1) * srcRowBytes, rowBytes);
+        }
+        return dst;
+      }
+
+      void *FieldDoubledImage::getPointerProperty(const std::string &/*name*/, int /*index*/) const OFX_EXCEPTION_SPEC
+      {
+        return getDoubledPixels();
+      }
+
+      void FieldDoubledImage::getPointerPropertyN(const std::string &/*name*/, void **values, int count) const OFX_EXCEPTION_SPEC
+      {
+        if(count > 0)
+          values[0] = getDoubledPixels();
+      }
+
+      Image *extractField(Image *image, ClipInstance &clip, const std::string &field)
+      {
+        int parity = fieldParity(field);
+        if(!image || parity < 0 || image->getStringProperty(kOfxImagePropField) != kOfxImageFieldBoth)
+          return image;
+
+        const std::string &extraction = clip.getFieldExtraction();
+        if(extraction == kOfxImageFieldDoubled) {
+          Image *doubled = new FieldDoubledImage(*image, clip, field);
+          image->releaseReference();
+          return doubled;
+        }
+        if(extraction != kOfxImageFieldSingle)
+          return image;
+
+        // every other row of the frame, starting at the field's first
+        OfxRectI srcBounds = image->getBounds();
+        OfxRectI bounds = srcBounds;
+        OfxRectI rod = image->getROD();
+        fieldRows(srcBounds.y1, srcBounds.y2, parity, bounds.y1, bounds.y2);
+        fieldRows(rod.y1, rod.y2, parity, rod.y1, rod.y2);
+
+        int rowBytes = image->getIntProperty(kOfxImagePropRowBytes);
+        char *data = static_cast<char *>(image->getPointerProperty(kOfxImagePropData));
+        if(data)
+          data += ptrdiff_t(firstFieldRow(srcBounds.y1, parity) - srcBounds.y1) * rowBytes;
+
+        ImageView *view = new ImageView(*image, clip,
+                                        image->getDoubleProperty(kOfxImageEffectPropRenderScale, 0),
+                                        image->getDoubleProperty(kOfxImageEffectPropRenderScale, 1),
+                                        data, bounds, rod, rowBytes * 2,
+                                        field,
+                                        image->getStringProperty(kOfxImagePropUniqueIdentifier) + "/" + field);
+
+        // the view holds its own reference
+        image->releaseReference();
+        return view;
+      }
+
+      /// the field being rendered on this thread, always one of the kOfxImageField literals
+      static thread_local const char *tRenderField = kOfxImageFieldNone;
+
+      /// the render scale being rendered at on this thread
+      static thread_local OfxPointD tRenderScale = { 1, 1 };
+
+      RenderScope::RenderScope(const std::string &field, OfxPointD renderScale)
+        : _previousField(tRenderField)
+        , _previousScale(tRenderScale)
+      {
+        if(field == kOfxImageFieldLower)
+          tRenderField = kOfxImageFieldLower;
+        else if(field == kOfxImageFieldUpper)
+          tRenderField = kOfxImageFieldUpper;
+        else if(field == kOfxImageFieldBoth)
+          tRenderField = kOfxImageFieldBoth;
+        else
+          tRenderField = kOfxImageFieldNone;
+        tRenderScale = renderScale;
+      }
+
+      RenderScope::~RenderScope()
+      {
+        tRenderField = _previousField;
+        tRenderScale = _previousScale;
+      }
+
+      const char *RenderScope::getCurrentField()
+      {
+        return tRenderField;
+      }
+
+      OfxPointD RenderScope::getCurrentRenderScale()
+      {
+        return tRenderScale;
+      }
 #   ifdef OFX_SUPPORTS_OPENGLRENDER
       static const Property::PropSpec textureStuffs[] = {
         { kOfxImageEffectPropOpenGLTextureIndex, Property::eInt, 1, true, "-1" },
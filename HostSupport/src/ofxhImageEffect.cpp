@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <math.h>
+#include <thread>
 
 // ofx
 #include "ofxCore.h"
@@ -39,12 +40,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ofxhClip.h"
 #include "ofxhParam.h"
 #include "ofxhMemory.h"
+#include "ofxhMultiThread.h"
 #include "ofxhImageEffect.h"
+#include "ofxhActionCache.h"
+#include "ofxhPrefetch.h"
+#include "ofxhProxy.h"
+#include "ofxhParallelRender.h"
+#include "ofxhCancel.h"
 #include "ofxhPluginAPICache.h"
 #include "ofxhPluginCache.h"
 #include "ofxhHost.h"
 #include "ofxhImageEffectAPI.h"
 #include "ofxhUtilities.h"
+#include "ofxhTrace.h"
 #ifdef OFX_SUPPORTS_PARAMETRIC
 #include "ofxhParametricParam.h"
 #endif
@@ -350,15 +358,26 @@ namespace OFX {
                          const std::string  &context,
                          bool               interactive) 
         : Base(effectInstanceStuff)
+        , Memory::Purgeable(ePurgePluginCaches)
         , _plugin(plugin)
         , _context(context)
         , _descriptor(&other)
         , _interactive(interactive)
         , _created(false)
         , _clipPrefsDirty(true)
+        , _clipPrefsRevision(0)
         , _continuousSamples(false)
         , _frameVarying(false)
         , _outputFrameRate(24)
+        , _revision(0)
+        , _actionCache(0)
+        , _prefetcher(0)
+        , _proxyCache(0)
+        , _renderer(0)
+        , _inAction(0)
+        , _purging(false)
+        , _purgedAt(0)
+        , _changeBatchDepth(0)
       {
         int i = 0;
         _properties.setChainedSet(&other.getProps());
@@ -393,6 +412,9 @@ namespace OFX {
 
           i++;
         }
+
+        // let the memory governor purge our caches under pressure
+        Memory::Governor::get().add(this);
       }
 
       /// implemented for Param::SetDescriptor
@@ -561,15 +583,14 @@ namespace OFX {
       }
 
       Instance::~Instance(){
+        // before anything goes, the governor may be purging us on another thread
+        Memory::Governor::get().remove(this);
+
         // destroy the instance, only if succesfully created
         if (_created) {
-#       ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionDestroyInstance<<"()"<<std::endl;
-#       endif
+          Trace::Scope trace(kOfxActionDestroyInstance, this);
           OfxStatus st = mainEntry(kOfxActionDestroyInstance,this->getHandle(),0,0);
-#       ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionDestroyInstance<<"()->"<<StatStr(st)<<std::endl;
-#       endif
+          trace.setStatus(st);
           (void)st;
         }
         
@@ -580,6 +601,21 @@ namespace OFX {
             delete i->second;
           i->second = NULL;
         }
+
+        delete _renderer;
+        delete _actionCache;
+      }
+
+      /// turn memoisation of the metadata actions on or off
+      void Instance::setActionCaching(bool enable)
+      {
+        if(enable && !_actionCache) {
+          _actionCache = new ActionCache;
+        }
+        else if(!enable && _actionCache) {
+          delete _actionCache;
+          _actionCache = 0;
+        }
       }
 
       /// this is used to populate with any extra action in argumnents that may be needed
@@ -611,7 +647,7 @@ namespace OFX {
 
       // override this to make processing abort, return 1 to abort processing
       int Instance::abort() { 
-        return 0; 
+        return CancelToken::isCurrentCancelled() ? 1 : 0;
       }
 
       // override this to use your own memory instance - must inherrit from memory::instance
@@ -625,12 +661,60 @@ namespace OFX {
         if(instance)
           return instance;
         else{
-          Memory::Instance* instance = new Memory::Instance;
+          Memory::Instance* instance = new Memory::MovableInstance;
           instance->alloc(nBytes);
           return instance;
         }
       }
 
+      // make another instance that can render at the same time as this one
+      Instance* Instance::newRenderClone()
+      {
+        Instance *clone = _plugin->createInstance(_context, NULL);
+        if(!clone)
+          return 0;
+
+        OfxStatus st = clone->createInstanceAction();
+        if(st != kOfxStatOK && st != kOfxStatReplyDefault) {
+          delete clone;
+          return 0;
+        }
+        return clone;
+      }
+
+      /// Counts an action in progress on an instance for as long as it lives, after waiting
+      /// for the governor to finish purging the instance's caches if it is. The purge caches
+      /// action can be run by whichever thread is enforcing the memory budget, and OFX won't
+      /// have it overlap any other action on the instance.
+      class ActionScope {
+        std::atomic<int> *_inAction;
+
+      public :
+        ActionScope(Instance &instance, const char *action)
+          : _inAction(NULL)
+        {
+          // the purge caches action is the one the others wait for, see Instance::purge
+          if(strcmp(action, kOfxActionPurgeCaches) == 0)
+            return;
+
+          _inAction = &instance._inAction;
+          for(;;) {
+            ++*_inAction;
+            if(!instance._purging)
+              break;
+            --*_inAction;
+            while(instance._purging)
+              std::this_thread::yield();
+          }
+        }
+
+        ~ActionScope()
+        {
+          if(_inAction)
+            --*_inAction;
+        }
+      };
+
       // call the effect entry point
       OfxStatus Instance::mainEntry(const char *action, 
                                     const void *handle, 
@@ -655,6 +739,8 @@ namespace OFX {
                 outHandle = outArgs->getHandle();
               }
                 
+              ActionScope inAction(*this, action);
+
               OfxStatus stat;
               try {
                  stat = ofxPlugin->mainEntry(action, handle, inHandle, outHandle);
@@ -694,14 +780,10 @@ namespace OFX {
         /// they try and fetch something in create instance, which they are allowed
         setDefaultClipPreferences();
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionCreateInstance<<"()"<<std::endl;
-#       endif
         // now tell the plug-in to create instance
+        Trace::Scope trace(kOfxActionCreateInstance, this);
         OfxStatus st = mainEntry(kOfxActionCreateInstance,this->getHandle(),0,0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionCreateInstance<<"()->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
 
         if (st == kOfxStatOK) {
           _created = true;
@@ -710,8 +792,8 @@ namespace OFX {
         return st;
       }
 
-      // begin/change/end instance changed
-      OfxStatus Instance::beginInstanceChangedAction(const std::string & why)
+      // begin or end instance changed
+      OfxStatus Instance::callInstanceChangedBracket(const char *action, const std::string & why)
       {
         Property::PropSpec stuff[] = {
           { kOfxPropChangeReason, Property::eString, 1, true, why.c_str() },
@@ -720,16 +802,27 @@ namespace OFX {
 
         Property::Set inArgs(stuff);
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionBeginInstanceChanged<<"("<<why<<")"<<std::endl;
-#       endif
-        OfxStatus st = mainEntry(kOfxActionBeginInstanceChanged,this->getHandle(), &inArgs, 0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionBeginInstanceChanged<<"("<<why<<")->"<<StatStr(st)<<std::endl;
-#       endif
+        Trace::Scope trace(action, this);
+        OfxStatus st = mainEntry(action,this->getHandle(), &inArgs, 0);
+        trace.setStatus(st);
         return st;
       }
 
+      // begin/change/end instance changed
+      OfxStatus Instance::beginInstanceChangedAction(const std::string & why)
+      {
+        // the first begin of a batch is sent for the whole batch, later ones for the same
+        // reason are folded into it
+        if(isBatchingChanges()) {
+          if(why == _changeBatchWhy)
+            return kOfxStatOK;
+          if(_changeBatchWhy.empty())
+            _changeBatchWhy = why;
+        }
+
+        return callInstanceChangedBracket(kOfxActionBeginInstanceChanged, why);
+      }
+
       OfxStatus Instance::paramInstanceChangedAction(const std::string & paramName,
                                                      const std::string & why,
                                                      OfxTime     time,
@@ -740,6 +833,10 @@ namespace OFX {
         if(isClipPreferencesSlaveParam(paramName))
           _clipPrefsDirty = true;
 
+        // a change of time alone leaves the values at any one time as they were
+        if(why != kOfxChangeTime)
+          bumpRevision();
+
         if (!param) {
           return kOfxStatFailed;
         }
@@ -759,14 +856,10 @@ namespace OFX {
         inArgs.setDoubleProperty(kOfxPropTime,time);
 
         inArgs.setDoublePropertyN(kOfxImageEffectPropRenderScale, &renderScale.x, 2);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionInstanceChanged<<"("<<kOfxTypeParameter<<","<<paramName<<","<<why<<","<<time<<",("<<renderScale.x<<","<<renderScale.y<<"))"<<std::endl;
-#       endif
 
+        Trace::Scope trace(kOfxActionInstanceChanged, this, time);
         OfxStatus st = mainEntry(kOfxActionInstanceChanged,this->getHandle(), &inArgs, 0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionInstanceChanged<<"("<<kOfxTypeParameter<<","<<paramName<<","<<why<<","<<time<<",("<<renderScale.x<<","<<renderScale.y<<"))->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 
@@ -775,50 +868,64 @@ namespace OFX {
                                                     OfxTime     time,
                                                     OfxPointD   renderScale)
       {
-        _clipPrefsDirty = true;
+        if(why != kOfxChangeTime)
+          bumpRevision();
         std::map<std::string,ClipInstance*>::iterator it=_clips.find(clipName);
-        if(it!=_clips.end())
+        if(it!=_clips.end()) {
+          // only a new connection or upstream format can change the clip prefs
+          std::map<std::string, UpstreamFormat>::const_iterator format = _upstreamFormats.find(clipName);
+          if(format == _upstreamFormats.end() || !(format->second == getUpstreamFormat(*it->second)))
+            _clipPrefsDirty = true;
+
           return (it->second)->instanceChangedAction(why,time,renderScale);
-        else
+        }
+        else {
+          _clipPrefsDirty = true;
           return kOfxStatFailed;
+        }
       }
 
       OfxStatus Instance::endInstanceChangedAction(const std::string & why)
       {
-        Property::PropSpec whyStuff[] = {
-          { kOfxPropChangeReason, Property::eString, 1, true, why.c_str() },
-          Property::propSpecEnd
-        };
+        // the batch's own end is sent by endChangeBatch
+        if(isBatchingChanges() && why == _changeBatchWhy)
+          return kOfxStatOK;
 
-        Property::Set inArgs(whyStuff);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionEndInstanceChanged<<"("<<why<<")"<<std::endl;
-#       endif
+        return callInstanceChangedBracket(kOfxActionEndInstanceChanged, why);
+      }
+
+      void Instance::beginChangeBatch()
+      {
+        ++_changeBatchDepth;
+      }
 
-        OfxStatus st = mainEntry(kOfxActionEndInstanceChanged,this->getHandle(), &inArgs, 0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionEndInstanceChanged<<"("<<why<<")->"<<StatStr(st)<<std::endl;
-#       endif
+      OfxStatus Instance::endChangeBatch()
+      {
+        if(_changeBatchDepth == 0 || --_changeBatchDepth > 0)
+          return kOfxStatOK;
+
+        OfxStatus st = kOfxStatOK;
+        if(!_changeBatchWhy.empty()) {
+          std::string why;
+          why.swap(_changeBatchWhy);
+          st = callInstanceChangedBracket(kOfxActionEndInstanceChanged, why);
+        }
+
+        // once for the whole batch, rather than once per change
+        runGetClipPrefsConditionally();
         return st;
       }
 
       // purge your caches
       OfxStatus Instance::purgeCachesAction(){
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionPurgeCaches<<"()"<<std::endl;
-#       endif
+        Trace::Scope trace(kOfxActionPurgeCaches, this);
         OfxStatus st = mainEntry(kOfxActionPurgeCaches ,this->getHandle(),0,0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionPurgeCaches<<"()->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 
       // sync your private data
       OfxStatus Instance::syncPrivateDataAction(){
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionSyncPrivateData<<"()"<<std::endl;
-#       endif
         // Only call kOfxActionSyncPrivateData if kOfxPropParamSetNeedsSyncing is not set,
         // or if it is set to 1.
         // see http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#kOfxPropParamSetNeedsSyncing
@@ -826,61 +933,44 @@ namespace OFX {
         bool needsSyncing = s ? s->getValue() : true;
         OfxStatus st = kOfxStatReplyDefault;
         if (needsSyncing) {
+          Trace::Scope trace(kOfxActionSyncPrivateData, this);
           st = mainEntry(kOfxActionSyncPrivateData,this->getHandle(),0,0);
+          trace.setStatus(st);
           if (s) {
             s->setValue(0);
           }
         }
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionSyncPrivateData<<"()->"<<StatStr(st)<<std::endl;
-#       endif
         return st;
       }
 
       // begin/end edit instance
       OfxStatus Instance::beginInstanceEditAction(){
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionBeginInstanceEdit<<"()"<<std::endl;
-#       endif
+        Trace::Scope trace(kOfxActionBeginInstanceEdit, this);
         OfxStatus st = mainEntry(kOfxActionBeginInstanceEdit,this->getHandle(),0,0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionBeginInstanceEdit<<"()->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 
       OfxStatus Instance::endInstanceEditAction(){
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionEndInstanceEdit<<"()"<<std::endl;
-#       endif
+        Trace::Scope trace(kOfxActionEndInstanceEdit, this);
         OfxStatus st = mainEntry(kOfxActionEndInstanceEdit,this->getHandle(),0,0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionEndInstanceEdit<<"()->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 
 #   ifdef OFX_SUPPORTS_OPENGLRENDER
       // attach/detach OpenGL context
       OfxStatus Instance::contextAttachedAction(){
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionOpenGLContextAttached<<"()"<<std::endl;
-#       endif
+        Trace::Scope trace(kOfxActionOpenGLContextAttached, this);
         OfxStatus st = mainEntry(kOfxActionOpenGLContextAttached,this->getHandle(),0,0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionOpenGLContextAttached<<"()->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 
       OfxStatus Instance::contextDetachedAction(){
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionOpenGLContextDetached<<"()"<<std::endl;
-#       endif
+        Trace::Scope trace(kOfxActionOpenGLContextDetached, this);
         OfxStatus st = mainEntry(kOfxActionOpenGLContextDetached,this->getHandle(),0,0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxActionOpenGLContextDetached<<"()->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 #   endif
@@ -919,19 +1009,85 @@ namespace OFX {
         inArgs.setIntProperty(kOfxImageEffectPropSequentialRenderStatus,sequentialRender);
         inArgs.setIntProperty(kOfxImageEffectPropInteractiveRenderStatus,interactiveRender);
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionBeginSequenceRender<<"(("<<startFrame<<","<<endFrame<<"),"<<step<<","<<interactive<<",("<<renderScale.x<<","<<renderScale.y<<"),"<<sequentialRender<<","<<interactiveRender
-          <<")"<<std::endl;
-#       endif
 
+        Trace::Scope trace(kOfxImageEffectActionBeginSequenceRender, this, startFrame);
         OfxStatus st = mainEntry(kOfxImageEffectActionBeginSequenceRender, this->getHandle(), &inArgs, 0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionBeginSequenceRender<<"(("<<startFrame<<","<<endFrame<<"),"<<step<<","<<interactive<<",("<<renderScale.x<<","<<renderScale.y<<"),"<<sequentialRender<<","<<interactiveRender
-          <<")->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 
+      /// Memory::Purgeable override, runs the purge caches action if we have rendered
+      /// since the last time and no other action is running on us now
+      size_t Instance::purge(size_t /*nBytes*/)
+      {
+        unsigned long long lastUsed = getLastUsed();
+        if(!_created || lastUsed == _purgedAt)
+          return 0;
+
+        // the purge caches action can't run alongside any other action, ActionScope
+        // backs off while _purging is set
+        _purging = true;
+        if(_inAction == 0) {
+          purgeCachesAction();
+          _purgedAt = lastUsed;
+        }
+        _purging = false;
+
+        // whatever the plugin gave back through the memory suite has been counted
+        return 0;
+      }
+
+      /// The render action's in args, kept per thread and reused from frame to frame
+      /// rather than being built for every render. Each level of render nested on a
+      /// thread, say an upstream effect rendered from inside clipGetImage, has its own.
+      class RenderArgsScope {
+        struct Stack {
+          std::vector<Property::Set *> sets;
+          size_t                       depth;
+
+          Stack() : depth(0) {}
+
+          ~Stack()
+          {
+            for(size_t i = 0; i < sets.size(); ++i)
+              delete sets[i];
+          }
+        };
+
+        static thread_local Stack tStack;
+
+        Property::Set *_args;
+
+      public :
+        RenderArgsScope()
+        {
+          static const Property::PropSpec inStuff[] = {
+            { kOfxPropTime, Property::eDouble, 1, true, "0" },
+            { kOfxImageEffectPropFieldToRender, Property::eString, 1, true, "" }, 
+            { kOfxImageEffectPropRenderWindow, Property::eInt, 4, true, "0" },
+            { kOfxImageEffectPropRenderScale, Property::eDouble, 2, true, "0" },
+            { kOfxImageEffectPropSequentialRenderStatus, Property::eInt, 1, true, "0" },
+            { kOfxImageEffectPropInteractiveRenderStatus, Property::eInt, 1, true, "0" },
+            { kOfxImageEffectPropRenderQualityDraft, Property::eInt, 1, true, "0" },
+            Property::propSpecEnd
+          };
+
+          if(tStack.depth == tStack.sets.size())
+            tStack.sets.push_back(new Property::Set(inStuff));
+          _args = tStack.sets[tStack.depth++];
+        }
+
+        ~RenderArgsScope()
+        {
+          --tStack.depth;
+        }
+
+        /// the args, every property needs setting as they hold the last render's values
+        Property::Set &get() { return *_args; }
+      };
+
+      thread_local RenderArgsScope::Stack RenderArgsScope::tStack;
+
       OfxStatus Instance::renderAction(OfxTime      time,
                                        const std::string &  field,
                                        const OfxRectI    &renderRoI,
@@ -941,19 +1097,10 @@ namespace OFX {
                                        bool     draftRender
                                        )
       {
-        static const Property::PropSpec inStuff[] = {
-          { kOfxPropTime, Property::eDouble, 1, true, "0" },
-          { kOfxImageEffectPropFieldToRender, Property::eString, 1, true, "" }, 
-          { kOfxImageEffectPropRenderWindow, Property::eInt, 4, true, "0" },
-          { kOfxImageEffectPropRenderScale, Property::eDouble, 2, true, "0" },
-          { kOfxImageEffectPropSequentialRenderStatus, Property::eInt, 1, true, "0" },
-          { kOfxImageEffectPropInteractiveRenderStatus, Property::eInt, 1, true, "0" },
-          { kOfxImageEffectPropRenderQualityDraft, Property::eInt, 1, true, "0" },
-          Property::propSpecEnd
-        };
+        RenderScope renderScope(field, renderScale);
+        RenderArgsScope args;
+        Property::Set &inArgs = args.get();
 
-        Property::Set inArgs(inStuff);
-        
         inArgs.setStringProperty(kOfxImageEffectPropFieldToRender,field);
         inArgs.setDoubleProperty(kOfxPropTime,time);
         inArgs.setIntPropertyN(kOfxImageEffectPropRenderWindow, &renderRoI.x1, 4);
@@ -962,19 +1109,38 @@ namespace OFX {
         inArgs.setIntProperty(kOfxImageEffectPropInteractiveRenderStatus,interactiveRender);
         inArgs.setIntProperty(kOfxImageEffectPropRenderQualityDraft,draftRender);
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionRender<<"("<<time<<","<<field<<",("<<renderRoI.x1<<","<<renderRoI.y1<<","<<renderRoI.x2<<","<<renderRoI.y2<<"),("<<renderScale.x<<","<<renderScale.y<<"),"<<sequentialRender<<","<<interactiveRender
-          <<")"<<std::endl;
-#       endif
 
+        Trace::Scope trace(kOfxImageEffectActionRender, this, time, renderRoI);
         OfxStatus st = mainEntry(kOfxImageEffectActionRender,this->getHandle(), &inArgs, 0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionRender<<"("<<time<<","<<field<<",("<<renderRoI.x1<<","<<renderRoI.y1<<","<<renderRoI.x2<<","<<renderRoI.y2<<"),("<<renderScale.x<<","<<renderScale.y<<"),"<<sequentialRender<<","<<interactiveRender
-          <<")->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
+
+        // whatever the plugin cached rendering is there for the governor to purge
+        touch();
         return st;
       }
 
+      OfxStatus Instance::renderSequence(const OfxRangeD &range,
+                                         OfxTime step,
+                                         const OfxRectI &renderWindow,
+                                         OfxPointD renderScale,
+                                         const SequenceRenderOptions &options,
+                                         FrameRenderListener *sink)
+      {
+        if(!_renderer)
+          _renderer = new ParallelRenderer(*this);
+        _renderer->setMaxThreads(options.maxThreads);
+        _renderer->setLookAhead(options.lookAhead);
+
+        if(step == 0)
+          step = 1;
+        OfxTime first = step > 0 ? range.min : range.max;
+        OfxTime last = step > 0 ? range.max : range.min;
+
+        CancelScope cancelScope(options.cancel ? options.cancel : CancelToken::getCurrent());
+        return _renderer->renderFrames(first, last, step, options.field, renderWindow, renderScale,
+                                       options.interactive, options.draft, sink);
+      }
+
       OfxStatus Instance::endRenderAction(OfxTime  startFrame,
                                           OfxTime  endFrame,
                                           OfxTime  step,
@@ -1004,16 +1170,10 @@ namespace OFX {
         inArgs.setDoublePropertyN(kOfxImageEffectPropRenderScale, &renderScale.x, 2);
         inArgs.setIntProperty(kOfxImageEffectPropSequentialRenderStatus,sequentialRender);
         inArgs.setIntProperty(kOfxImageEffectPropInteractiveRenderStatus,interactiveRender);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionEndSequenceRender<<"(("<<startFrame<<","<<endFrame<<"),"<<step<<","<<interactive<<",("<<renderScale.x<<","<<renderScale.y<<"),"<<sequentialRender<<","<<interactiveRender
-          <<")"<<std::endl;
-#       endif
 
+        Trace::Scope trace(kOfxImageEffectActionEndSequenceRender, this, startFrame);
         OfxStatus st = mainEntry(kOfxImageEffectActionEndSequenceRender,this->getHandle(), &inArgs, 0);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionEndSequenceRender<<"(("<<startFrame<<","<<endFrame<<"),"<<step<<","<<interactive<<",("<<renderScale.x<<","<<renderScale.y<<"),"<<sequentialRender<<","<<interactiveRender
-          <<")->"<<StatStr(st)<<std::endl;
-#       endif
+        trace.setStatus(st);
         return st;
       }
 
@@ -1115,35 +1275,37 @@ namespace OFX {
           Property::propSpecEnd
         };
 
+        unsigned int revision = _revision;
+        OfxStatus stat;
+        if(_actionCache && _actionCache->getRegionOfDefinition(revision, time, renderScale, stat, rod))
+          return stat;
+
         Property::Set inArgs(inStuff);
         Property::Set outArgs(outStuff);
         
         inArgs.setDoubleProperty(kOfxPropTime,time);
         inArgs.setDoublePropertyN(kOfxImageEffectPropRenderScale, &renderScale.x, 2);
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetRegionOfDefinition<<"("<<time<<",("<<renderScale.x<<","<<renderScale.y<<"))"<<std::endl;
-#       endif
-        OfxStatus stat = mainEntry(kOfxImageEffectActionGetRegionOfDefinition,
-                                   this->getHandle(),
-                                   &inArgs,
-                                   &outArgs);
+        Trace::Scope trace(kOfxImageEffectActionGetRegionOfDefinition, this, time);
+        stat = mainEntry(kOfxImageEffectActionGetRegionOfDefinition,
+                         this->getHandle(),
+                         &inArgs,
+                         &outArgs);
+        trace.setStatus(stat);
         if(stat == kOfxStatOK) {
           outArgs.getDoublePropertyN(kOfxImageEffectPropRegionOfDefinition, &rod.x1, 4);
         }
         else if(stat == kOfxStatReplyDefault) {
           rod = calcDefaultRegionOfDefinition(time, renderScale);
         }        
+        if(stat == kOfxStatOK || stat == kOfxStatReplyDefault) {
+          trace.result("rod");
+          trace.value(rod);
+        }
 
+        if(_actionCache && (stat == kOfxStatOK || stat == kOfxStatReplyDefault))
+          _actionCache->setRegionOfDefinition(revision, time, renderScale, stat, rod);
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetRegionOfDefinition<<"("<<time<<",("<<renderScale.x<<","<<renderScale.y<<"))->"<<StatStr(stat);
-          if(stat == kOfxStatOK) {
-              std::cout << ": ("<<rod.x1<<","<<rod.y1<<","<<rod.x2<<","<<rod.y2<<")";
-          }
-          std::cout << std::endl;
-#       endif
-          
         return stat;
       }
 
@@ -1209,33 +1371,14 @@ namespace OFX {
             }
           }
 
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetRegionsOfInterest<<"("<<time<<",("<<renderScale.x<<","<<renderScale.y<<"),("<<roi.x1<<","<<roi.y1<<","<<roi.x2<<","<<roi.y2<<"))"<<std::endl;
-#         endif
           /// call the action
+          Trace::Scope trace(kOfxImageEffectActionGetRegionsOfInterest, this, time);
           stat = mainEntry(kOfxImageEffectActionGetRegionsOfInterest,
                            this->getHandle(),
                            &inArgs,
                            &outArgs);
+          trace.setStatus(stat);
 
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetRegionsOfInterest<<"("<<time<<",("<<renderScale.x<<","<<renderScale.y<<"),("<<roi.x1<<","<<roi.y1<<","<<roi.x2<<","<<roi.y2<<"))->"<<StatStr(stat);
-            if (stat == kOfxStatOK) {
-                std::cout << ": ";
-                for(std::map<std::string, ClipInstance*>::iterator it=_clips.begin();
-                    it!=_clips.end();
-                    ++it) {
-                    std::string name = "OfxImageClipPropRoI_"+it->first;
-                    OfxRectD thisRoi;
-                    thisRoi.x1 = outArgs.getDoubleProperty(name,0);
-                    thisRoi.y1 = outArgs.getDoubleProperty(name,1);
-                    thisRoi.x2 = outArgs.getDoubleProperty(name,2);
-                    thisRoi.y2 = outArgs.getDoubleProperty(name,3);
-                    std::cout << it->first << "->("<<thisRoi.x1<<","<<thisRoi.y1<<","<<thisRoi.x2<<","<<thisRoi.y2<<") ";
-                }
-            }
-            std::cout << std::endl;
-#           endif
           /// set the thing up
           for(std::map<std::string, ClipInstance*>::iterator it=_clips.begin();
               it!=_clips.end();
@@ -1269,6 +1412,13 @@ namespace OFX {
                 }
               }
             }
+
+          if(trace.isActive() && (stat == kOfxStatOK || stat == kOfxStatReplyDefault)) {
+            for(std::map<ClipInstance *, OfxRectD>::iterator it = rois.begin(); it != rois.end(); ++it) {
+              trace.result(it->first->getName().c_str());
+              trace.value(it->second);
+            }
+          }
         }
   
         return stat;
@@ -1281,6 +1431,11 @@ namespace OFX {
                                                RangeMap &rangeMap)
       {
         OfxStatus stat = kOfxStatReplyDefault;
+
+        unsigned int revision = _revision;
+        if(_actionCache && _actionCache->getFramesNeeded(revision, time, stat, rangeMap))
+          return stat;
+
         Property::Set outArgs;
       
         if(temporalAccess()) {
@@ -1311,42 +1466,23 @@ namespace OFX {
             }
           }
 
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetFramesNeeded<<"("<<time<<")"<<std::endl;
-#         endif
+          Trace::Scope trace(kOfxImageEffectActionGetFramesNeeded, this, time);
           stat = mainEntry(kOfxImageEffectActionGetFramesNeeded,
                            this->getHandle(),
                            &inArgs,
                            &outArgs);
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetFramesNeeded<<"("<<time<<")->"<<StatStr(stat);
-            if (stat == kOfxStatOK) {
-                std::cout << ": ";
-                for(std::map<std::string, ClipInstance*>::iterator it=_clips.begin();
-                    it!=_clips.end();
-                    ++it) {
-                    ClipInstance *clip = it->second;
-
-                    if(!clip->isOutput()) {
-                        std::string name = "OfxImageClipPropFrameRange_"+it->first;
-                        std::cout << it->first << "->[";
-
-                        int nRanges = outArgs.getDimension(name);
-                        for(int r=0;r<nRanges;){
-                            double min = outArgs.getDoubleProperty(name,r);
-                            double max = outArgs.getDoubleProperty(name,r+1);
-                            r += 2;
-                            std::cout <<"("<<min<<","<<max<<")";
-                            if (r < nRanges-1) {
-                                std::cout << ",";
-                            }
-                        }
-                        std::cout << "]";
-                    }
-                }
+          trace.setStatus(stat);
+
+          if(trace.isActive() && stat == kOfxStatOK) {
+            for(std::map<std::string, ClipInstance*>::iterator it=_clips.begin(); it!=_clips.end(); ++it) {
+              if(!it->second->isOutput()) {
+                std::string name = "OfxImageClipPropFrameRange_"+it->first;
+                trace.result(it->first.c_str());
+                for(int r = 0; r < outArgs.getDimension(name); ++r)
+                  trace.value(outArgs.getDoubleProperty(name, r));
+              }
             }
-            std::cout << std::endl;
-#         endif
+          }
         }
         
         OfxRangeD defaultRange;
@@ -1388,6 +1524,9 @@ namespace OFX {
           }
         }
 
+        if(_actionCache && (stat == kOfxStatOK || stat == kOfxStatReplyDefault))
+          _actionCache->setFramesNeeded(revision, time, stat, rangeMap);
+
         return stat;
       }
 
@@ -1411,6 +1550,12 @@ namespace OFX {
           Property::propSpecEnd
         };
 
+        unsigned int revision = _revision;
+        OfxTime inTime = time;
+        OfxStatus st;
+        if(_actionCache && _actionCache->getIdentity(revision, inTime, field, renderRoI, renderScale, st, time, clip))
+          return st;
+
         Property::Set inArgs(inStuff);        
 
         inArgs.setStringProperty(kOfxImageEffectPropFieldToRender,field);
@@ -1420,32 +1565,120 @@ namespace OFX {
 
         Property::Set outArgs(outStuff);
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionIsIdentity<<"("<<time<<","<<field<<",("<<renderRoI.x1<<","<<renderRoI.y1<<","<<renderRoI.x2<<","<<renderRoI.y2<<"),("<<renderScale.x<<","<<renderScale.y<<"))"<<std::endl;
-#       endif
         outArgs.setDoubleProperty(kOfxPropTime,time);
 
-        OfxStatus st = mainEntry(kOfxImageEffectActionIsIdentity,
-                                 this->getHandle(),
-                                 &inArgs,
-                                 &outArgs);        
+        Trace::Scope trace(kOfxImageEffectActionIsIdentity, this, inTime, renderRoI);
+        st = mainEntry(kOfxImageEffectActionIsIdentity,
+                       this->getHandle(),
+                       &inArgs,
+                       &outArgs);        
+        trace.setStatus(st);
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionIsIdentity<<"("<<time<<","<<field<<",("<<renderRoI.x1<<","<<renderRoI.y1<<","<<renderRoI.x2<<","<<renderRoI.y2<<"),("<<renderScale.x<<","<<renderScale.y<<"))->"<<StatStr(st);
-          if(st==kOfxStatOK){
-              std::cout << ": "<<outArgs.getDoubleProperty(kOfxPropTime)<<","<<outArgs.getStringProperty(kOfxPropName);
-          }
-          std::cout<<std::endl;
-#       endif
 
         if(st==kOfxStatOK){
           time = outArgs.getDoubleProperty(kOfxPropTime);
           clip = outArgs.getStringProperty(kOfxPropName);        
+          trace.result("clip");
+          trace.value(clip);
+          trace.result("time");
+          trace.value(time);
         }
+
+        if(_actionCache && (st == kOfxStatOK || st == kOfxStatReplyDefault))
+          _actionCache->setIdentity(revision, inTime, field, renderRoI, renderScale, st, time, clip);
         
         return st;
       }
 
+      Image* Instance::getIdentityImage(OfxTime time,
+                                        const std::string &field,
+                                        const OfxRectI &renderWindow,
+                                        OfxPointD renderScale)
+      {
+        OfxTime identityTime = time;
+        std::string clipName;
+        if(isIdentityAction(identityTime, field, renderWindow, renderScale, clipName) != kOfxStatOK)
+          return 0;
+
+        ClipInstance *input = getClip(clipName);
+        ClipInstance *output = getClip(kOfxImageEffectOutputClipName);
+        if(!input || !output || input->isOutput() || !input->getConnected())
+          return 0;
+
+        // the pixels can only be passed through if they are what the output clip says they are
+        if(input->getPixelDepth() != output->getPixelDepth() ||
+           input->getComponents() != output->getComponents() ||
+           input->getPremult() != output->getPremult())
+          return 0;
+
+        // the output's RoD in pixels
+        OfxRectD canonicalRoD;
+        OfxStatus st = getRegionOfDefinitionAction(time, renderScale, canonicalRoD);
+        if(st != kOfxStatOK && st != kOfxStatReplyDefault)
+          return 0;
+
+        double par = output->getAspectRatio();
+        if(par <= 0)
+          par = 1;
+        OfxRectI rod;
+        rod.x1 = int(floor(canonicalRoD.x1 * renderScale.x / par));
+        rod.y1 = int(floor(canonicalRoD.y1 * renderScale.y));
+        rod.x2 = int(ceil(canonicalRoD.x2 * renderScale.x / par));
+        rod.y2 = int(ceil(canonicalRoD.y2 * renderScale.y));
+
+        // fetch the window we were asked to render, in canonical coords
+        OfxRectD window;
+        window.x1 = renderWindow.x1 * par / renderScale.x;
+        window.y1 = renderWindow.y1 / renderScale.y;
+        window.x2 = renderWindow.x2 * par / renderScale.x;
+        window.y2 = renderWindow.y2 / renderScale.y;
+
+        Image *image = input->getImage(identityTime, &window);
+        if(!image)
+          return 0;
+
+        // relabelling can't fix pixels on a different grid to the output's
+        double srcScale[2];
+        image->getDoublePropertyN(kOfxImageEffectPropRenderScale, srcScale, 2);
+        if(srcScale[0] != renderScale.x || srcScale[1] != renderScale.y ||
+           image->getDoubleProperty(kOfxImagePropPixelAspectRatio) != par) {
+          image->releaseReference();
+          return 0;
+        }
+
+        // pixels outside the output's RoD are not part of the output
+        OfxRectI srcBounds = image->getBounds();
+        OfxRectI bounds = Intersection(srcBounds, rod);
+
+        OfxRectI srcRoD = image->getROD();
+        if(memcmp(&bounds, &srcBounds, sizeof(OfxRectI)) == 0 &&
+           memcmp(&rod, &srcRoD, sizeof(OfxRectI)) == 0)
+          return image;
+
+        // otherwise a view on the same pixels with the output's description
+        int rowBytes = image->getIntProperty(kOfxImagePropRowBytes);
+        char *data = static_cast<char *>(image->getPointerProperty(kOfxImagePropData));
+        if(data && bounds.x2 > bounds.x1 && bounds.y2 > bounds.y1) {
+          int pixelBytes = image->getPixelBytes();
+          if(pixelBytes == 0) {
+            // can't address into pixels we don't understand
+            image->releaseReference();
+            return 0;
+          }
+          data += (ptrdiff_t)(bounds.y1 - srcBounds.y1) * rowBytes + (ptrdiff_t)(bounds.x1 - srcBounds.x1) * pixelBytes;
+        }
+
+        ImageView *view = new ImageView(*image, *output,
+                                        renderScale.x, renderScale.y,
+                                        data, bounds, rod, rowBytes,
+                                        image->getStringProperty(kOfxImagePropField),
+                                        image->getStringProperty(kOfxImagePropUniqueIdentifier));
+
+        // the view holds its own reference
+        image->releaseReference();
+        return view;
+      }
+
       /// Get whether the component is a supported 'chromatic' component (RGBA or alpha) in
       /// the base API.
       /// Override this if you have extended your chromatic colour types (eg RGB) and want
@@ -1694,6 +1927,30 @@ namespace OFX {
 
       }
 
+      bool Instance::UpstreamFormat::operator==(const UpstreamFormat &other) const
+      {
+        return connected == other.connected &&
+          components == other.components &&
+          depth == other.depth &&
+          premult == other.premult &&
+          fielding == other.fielding &&
+          aspectRatio == other.aspectRatio &&
+          frameRate == other.frameRate;
+      }
+
+      Instance::UpstreamFormat Instance::getUpstreamFormat(const ClipInstance &clip)
+      {
+        UpstreamFormat format;
+        format.connected = clip.getConnected();
+        format.components = clip.getUnmappedComponents();
+        format.depth = clip.getUnmappedBitDepth();
+        format.premult = clip.getPremult();
+        format.fielding = clip.getFieldOrder();
+        format.aspectRatio = clip.getAspectRatio();
+        format.frameRate = clip.getUnmappedFrameRate();
+        return format;
+      }
+
       /// the idea here is the clip prefs live as active props on the effect
       /// and are set up by clip preferences. The action manages the clip
       /// preferences bits. We also monitor clip and param changes and
@@ -1704,31 +1961,36 @@ namespace OFX {
         /// create the out args with the stuff that does not depend on individual clips
         Property::Set outArgs;
 
+        // what the action is about to see, so later clip changes can tell if it needs to run again
+        std::map<std::string, UpstreamFormat> upstreamFormats;
+        for(std::map<std::string, ClipInstance*>::iterator it=_clips.begin(); it!=_clips.end(); ++it)
+          upstreamFormats[it->first] = getUpstreamFormat(*it->second);
+
+        // setting up the args resets these to their defaults
+        double oldFrameRate = _outputFrameRate;
+        std::string oldFielding = _outputFielding;
+        std::string oldPreMultiplication = _outputPreMultiplication;
+        bool oldContinuousSamples = _continuousSamples;
+        bool oldFrameVarying = _frameVarying;
+
         setupClipPreferencesArgs(outArgs);
 
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetClipPreferences<<"()"<<std::endl;
-#       endif
+        Trace::Scope trace(kOfxImageEffectActionGetClipPreferences, this);
         OfxStatus st = mainEntry(kOfxImageEffectActionGetClipPreferences,
                                  this->getHandle(),
                                  0,
                                  &outArgs);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetClipPreferences<<"()->"<<StatStr(st);
-#       endif
+        trace.setStatus(st);
 
         if(st!=kOfxStatOK && st!=kOfxStatReplyDefault) {
-#       ifdef OFX_DEBUG_ACTIONS
-            std::cout << std::endl;
-#       endif
           /// ouch
           return false;
         }
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << ": ";
-#       endif
+        // the first result is always a change
+        bool changed = _clipPrefsRevision == 0;
+
         /// OK, go pump the components/depths back into the clips themselves
         for(std::map<std::string, ClipInstance*>::iterator it=_clips.begin();
             it!=_clips.end();
@@ -1739,12 +2001,13 @@ namespace OFX {
             std::string depthParamName = "OfxImageClipPropDepth_"+it->first;
             std::string parParamName = "OfxImageClipPropPAR_"+it->first;
 
-#       ifdef OFX_DEBUG_ACTIONS
-            std::cout << it->first<<"->"<<outArgs.getStringProperty(depthParamName)<<","<<outArgs.getStringProperty(componentParamName)<<","<<outArgs.getDoubleProperty(parParamName)<<" ";
-#       endif
+            const std::string &depth = outArgs.getStringProperty(depthParamName);
+            const std::string &components = outArgs.getStringProperty(componentParamName);
+            if(depth != clip->getPixelDepth() || components != clip->getComponents())
+              changed = true;
 
-            clip->setPixelDepth(outArgs.getStringProperty(depthParamName));
-            clip->setComponents(outArgs.getStringProperty(componentParamName));
+            clip->setPixelDepth(depth);
+            clip->setComponents(components);
             //clip->setPixelAspect(outArgs.getDoubleProperty(parParamName));
           }
 
@@ -1753,12 +2016,37 @@ namespace OFX {
         _outputPreMultiplication   = outArgs.getStringProperty(kOfxImageEffectPropPreMultiplication);
         _continuousSamples = outArgs.getIntProperty(kOfxImageClipPropContinuousSamples) != 0;
         _frameVarying      = outArgs.getIntProperty(kOfxImageEffectFrameVarying) != 0;
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << _outputFrameRate<<","<<_outputFielding<<","<<_outputPreMultiplication<<","<<_continuousSamples<<","<<_frameVarying<<std::endl;
-#       endif
 
+        if(trace.isActive()) {
+          for(std::map<std::string, ClipInstance*>::iterator it=_clips.begin(); it!=_clips.end(); ++it) {
+            trace.result(it->first.c_str());
+            trace.value(it->second->getPixelDepth());
+            trace.value(it->second->getComponents());
+            trace.value(outArgs.getDoubleProperty("OfxImageClipPropPAR_"+it->first));
+          }
+          trace.result("preferences");
+          trace.value(_outputFrameRate);
+          trace.value(_outputFielding);
+          trace.value(_outputPreMultiplication);
+          trace.value(_continuousSamples ? 1.0 : 0.0);
+          trace.value(_frameVarying ? 1.0 : 0.0);
+        }
+
+        if(_outputFrameRate != oldFrameRate || _outputFielding != oldFielding ||
+           _outputPreMultiplication != oldPreMultiplication ||
+           _continuousSamples != oldContinuousSamples || _frameVarying != oldFrameVarying)
+          changed = true;
+
+        _upstreamFormats.swap(upstreamFormats);
         _clipPrefsDirty  = false;
 
+        // the output's components, depth, fielding etc... have changed, anything memoised
+        // and anything downstream negotiated against them is stale
+        if(changed) {
+          ++_clipPrefsRevision;
+          bumpRevision();
+        }
+
         return true;
       }
 
@@ -1842,26 +2130,29 @@ namespace OFX {
           Property::propSpecEnd
         };
 
+        unsigned int revision = _revision;
+        OfxStatus st;
+        if(_actionCache && _actionCache->getTimeDomain(revision, st, range))
+          return st;
+
         Property::Set outArgs(outStuff);  
 
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetTimeDomain<<"()"<<std::endl;
-#       endif
-        OfxStatus st = mainEntry(kOfxImageEffectActionGetTimeDomain,
-                                 this->getHandle(),
-                                 0,
-                                 &outArgs);
-#       ifdef OFX_DEBUG_ACTIONS
-          std::cout << "OFX: "<<(void*)this<<"->"<<kOfxImageEffectActionGetTimeDomain<<"()->"<<StatStr(st);
-          if (st == kOfxStatOK) {
-              std::cout << ": ("<<outArgs.getDoubleProperty(kOfxImageEffectPropFrameRange,0)<<","<<outArgs.getDoubleProperty(kOfxImageEffectPropFrameRange,1)<<")";
-          }
-          std::cout << std::endl;
-#       endif
+        Trace::Scope trace(kOfxImageEffectActionGetTimeDomain, this);
+        st = mainEntry(kOfxImageEffectActionGetTimeDomain,
+                       this->getHandle(),
+                       0,
+                       &outArgs);
+        trace.setStatus(st);
         if(st!=kOfxStatOK) return st;
 
         range.min = outArgs.getDoubleProperty(kOfxImageEffectPropFrameRange,0);
         range.max = outArgs.getDoubleProperty(kOfxImageEffectPropFrameRange,1);
+        trace.result("frameRange");
+        trace.value(range.min);
+        trace.value(range.max);
+
+        if(_actionCache)
+          _actionCache->setTimeDomain(revision, kOfxStatOK, range);
 
         return kOfxStatOK;
       }
@@ -1870,6 +2161,9 @@ namespace OFX {
       /// implemented for Param::SetInstance
       void Instance::paramChangedByPlugin(Param::Instance *param)
       {
+        // even during create instance, a new value invalidates anything memoised
+        bumpRevision();
+
         if (!_created) {
           // setValue() was probably called from kOfxActionCreateInstance 
           // this is legal according to http://openfx.sourceforge.net/Documentation/1.3/ofxProgrammingReference.html#SettingParams
@@ -2033,7 +2327,22 @@ namespace OFX {
           return kOfxStatErrBadHandle;
         }
 
-        Image* image = clipInstance->getImage(time,h2);
+        // see if it has already been fetched ahead of the render
+        Image* image = 0;
+        InputPrefetcher *prefetcher = clipInstance->getEffectInstance()->getInputPrefetcher();
+        if(prefetcher && !clipInstance->isOutput())
+          image = prefetcher->getImage(clipInstance, time, h2);
+
+        // then in the proxy cache, which fetches it if it has to
+        ProxyCache *proxies = clipInstance->getEffectInstance()->getProxyCache();
+        if(!image) {
+          if(proxies && !clipInstance->isOutput())
+            image = proxies->getImage(clipInstance, time, RenderScope::getCurrentRenderScale(), h2);
+          else
+            image = clipInstance->getImage(time,h2);
+        }
+        if(image && !clipInstance->isOutput())
+          image = extractField(image, *clipInstance, RenderScope::getCurrentField());
         if(!image) {
           *h3 = NULL;
 
@@ -2541,7 +2850,6 @@ namespace OFX {
       };
 
       ////////////////////////////////////////////////////////////////////////////////
-#ifdef OFX_SUPPORTS_MULTITHREAD
       // Forward all multithread suite calls to the host implementation.
  
       static OfxStatus multiThread(OfxThreadFunctionV1 func,
@@ -2585,75 +2893,6 @@ namespace OFX {
       static OfxStatus mutexTryLock(const OfxMutexHandle mutex){
         return gImageEffectHost->mutexTryLock(mutex);
       }
-#else // !OFX_SUPPORTS_MULTITHREAD
-      /// a simple multithread suite
-      static OfxStatus multiThread(OfxThreadFunctionV1 func,
-                                   unsigned int /*nThreads*/,
-                                   void *customArg)
-      {
-        if (!func)
-          return kOfxStatFailed;
-        func(0,1,customArg);
-        return kOfxStatOK;
-      }
-
-      static OfxStatus multiThreadNumCPUs(unsigned int *nCPUs)
-      {
-        if (!nCPUs)
-          return kOfxStatFailed;
-        *nCPUs = 1;
-        return kOfxStatOK;
-      }
-
-      static OfxStatus multiThreadIndex(unsigned int *threadIndex){
-        if (!threadIndex)
-          return kOfxStatFailed;
-        *threadIndex = 0;
-        return kOfxStatOK;
-      }
-
-      static int multiThreadIsSpawnedThread(void){
-        return false;
-      }
-
-      static OfxStatus mutexCreate(OfxMutexHandle *mutex, int /*lockCount*/)
-      {
-        if (!mutex)
-          return kOfxStatFailed;
-        // do nothing single threaded
-        *mutex = 0;
-        return kOfxStatOK;
-      }
-
-      static OfxStatus mutexDestroy(const OfxMutexHandle mutex)
-      {
-        if (mutex != 0)
-          return kOfxStatErrBadHandle;
-        // do nothing single threaded
-        return kOfxStatOK;
-      }
-
-      static OfxStatus mutexLock(const OfxMutexHandle mutex){
-        if (mutex != 0)
-          return kOfxStatErrBadHandle;
-        // do nothing single threaded
-        return kOfxStatOK;
-      }
-       
-      static OfxStatus mutexUnLock(const OfxMutexHandle mutex){
-        if (mutex != 0)
-          return kOfxStatErrBadHandle;
-        // do nothing single threaded
-        return kOfxStatOK;
-      }       
-
-      static OfxStatus mutexTryLock(const OfxMutexHandle mutex){
-        if (mutex != 0)
-          return kOfxStatErrBadHandle;
-        // do nothing single threaded
-        return kOfxStatOK;
-      }
-#endif // !OFX_SUPPORTS_MULTITHREAD
        
       static const struct OfxMultiThreadSuiteV1 gMultiThreadSuite = {
         multiThread,
@@ -2750,12 +2989,82 @@ namespace OFX {
         if(instance)
           return instance;
         else{
-          Memory::Instance* instance = new Memory::Instance;
+          Memory::Instance* instance = new Memory::MovableInstance;
           instance->alloc(nBytes);
           return instance;
         }
       }
 
+      OfxStatus Host::multiThread(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg)
+      {
+        return MultiThread::ThreadPool::getDefault().multiThread(func, nThreads, customArg);
+      }
+
+      OfxStatus Host::multiThreadHost(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg)
+      {
+        return MultiThread::ThreadPool::getDefault().multiThreadHost(func, nThreads, customArg);
+      }
+
+      OfxStatus Host::multiThreadNumCPUS(unsigned int *nCPUs) const
+      {
+        if(!nCPUs)
+          return kOfxStatFailed;
+        *nCPUs = MultiThread::ThreadPool::getDefault().getNumCPUs();
+        return kOfxStatOK;
+      }
+
+      OfxStatus Host::multiThreadIndex(unsigned int *threadIndex) const
+      {
+        if(!threadIndex)
+          return kOfxStatFailed;
+        *threadIndex = MultiThread::ThreadPool::getThreadIndex();
+        return kOfxStatOK;
+      }
+
+      int Host::multiThreadIsSpawnedThread() const
+      {
+        return MultiThread::ThreadPool::isSpawnedThread() ? 1 : 0;
+      }
+
+      OfxStatus Host::mutexCreate(OfxMutexHandle *mutex, int lockCount)
+      {
+        if(!mutex)
+          return kOfxStatFailed;
+        *mutex = reinterpret_cast<OfxMutexHandle>(new MultiThread::Mutex(lockCount));
+        return kOfxStatOK;
+      }
+
+      OfxStatus Host::mutexDestroy(const OfxMutexHandle mutex)
+      {
+        if(!mutex)
+          return kOfxStatErrBadHandle;
+        delete reinterpret_cast<MultiThread::Mutex *>(mutex);
+        return kOfxStatOK;
+      }
+
+      OfxStatus Host::mutexLock(const OfxMutexHandle mutex)
+      {
+        if(!mutex)
+          return kOfxStatErrBadHandle;
+        reinterpret_cast<MultiThread::Mutex *>(mutex)->lock();
+        return kOfxStatOK;
+      }
+
+      OfxStatus Host::mutexUnLock(const OfxMutexHandle mutex)
+      {
+        if(!mutex)
+          return kOfxStatErrBadHandle;
+        // unlocking a mutex we don't hold is as bad as a bad handle
+        return reinterpret_cast<MultiThread::Mutex *>(mutex)->unlock() ? kOfxStatOK : kOfxStatErrBadHandle;
+      }
+
+      OfxStatus Host::mutexTryLock(const OfxMutexHandle mutex)
+      {
+        if(!mutex)
+          return kOfxStatErrBadHandle;
+        return reinterpret_cast<MultiThread::Mutex *>(mutex)->tryLock() ? kOfxStatOK : kOfxStatFailed;
+      }
+
       /// our suite fetcher
       const void *Host::fetchSuite(const char *suiteName, int suiteVersion)
       {
@@ -48,6 +48,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ofxhHost.h"
 #include "ofxhImageEffectAPI.h"
 #include "ofxhXml.h"
+#include "ofxhTrace.h"
 
 // Disable the "this pointer used in base member initialiser list" warning in Windows
 namespace OFX {
@@ -105,13 +106,9 @@ namespace OFX {
           OfxPlugin *op = _pluginHandle->getOfxPlugin();
           OfxStatus stat;
           try {
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)op<<"->"<<kOfxActionUnload<<"()"<<std::endl;
-#           endif
+            Trace::Scope trace(kOfxActionUnload, op);
             stat = op->mainEntry(kOfxActionUnload, 0, 0, 0);
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)op<<"->"<<kOfxActionUnload<<"()->"<<StatStr(stat)<<std::endl;
-#           endif
+            trace.setStatus(stat);
           } CatchAllSetStatus(stat, gImageEffectHost, op, kOfxActionUnload);
           (void)stat;
         }
@@ -187,13 +184,9 @@ namespace OFX {
 
           OfxStatus stat;
           try {
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)op<<"->"<<kOfxActionLoad<<"()"<<std::endl;
-#           endif
+            Trace::Scope trace(kOfxActionLoad, op);
             stat = op->mainEntry(kOfxActionLoad, 0, 0, 0);
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)op<<"->"<<kOfxActionLoad<<"()->"<<StatStr(stat)<<std::endl;
-#           endif
+            trace.setStatus(stat);
           } CatchAllSetStatus(stat, gImageEffectHost, op, kOfxActionLoad);
 
           if (stat != kOfxStatOK && stat != kOfxStatReplyDefault) {
@@ -202,13 +195,9 @@ namespace OFX {
           }
           
           try {
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)op<<"->"<<kOfxActionDescribe<<"()"<<std::endl;
-#           endif
+            Trace::Scope trace(kOfxActionDescribe, op);
             stat = op->mainEntry(kOfxActionDescribe, getDescriptor().getHandle(), 0, 0);
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)op<<"->"<<kOfxActionDescribe<<"()->"<<StatStr(stat)<<std::endl;
-#           endif
+            trace.setStatus(stat);
           } CatchAllSetStatus(stat, gImageEffectHost, op, kOfxActionDescribe);
 
           if (stat != kOfxStatOK && stat != kOfxStatReplyDefault) {
@@ -247,13 +236,9 @@ namespace OFX {
 
         OfxStatus stat;
         try {
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)ph->getOfxPlugin()<<"->"<<kOfxImageEffectActionDescribeInContext<<"("<<context<<")"<<std::endl;
-#         endif
+          Trace::Scope trace(kOfxImageEffectActionDescribeInContext, ph->getOfxPlugin());
           stat = ph->getOfxPlugin()->mainEntry(kOfxImageEffectActionDescribeInContext, newContext->getHandle(), inarg.getHandle(), 0);
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)ph->getOfxPlugin()<<"->"<<kOfxImageEffectActionDescribeInContext<<"("<<context<<")->"<<StatStr(stat)<<std::endl;
-#         endif
+          trace.setStatus(stat);
         } CatchAllSetStatus(stat, gImageEffectHost, ph->getOfxPlugin(), kOfxImageEffectActionDescribeInContext);
 
         if (stat == kOfxStatOK || stat == kOfxStatReplyDefault) {
@@ -289,13 +274,9 @@ namespace OFX {
         if (_pluginHandle.get()) {
           OfxStatus stat;
           try {
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)_pluginHandle->getOfxPlugin()<<"->"<<kOfxActionUnload<<"()"<<std::endl;
-#           endif
+            Trace::Scope trace(kOfxActionUnload, _pluginHandle->getOfxPlugin());
             stat = (*_pluginHandle)->mainEntry(kOfxActionUnload, 0, 0, 0);
-#           ifdef OFX_DEBUG_ACTIONS
-              std::cout << "OFX: "<<(void*)_pluginHandle->getOfxPlugin()<<"->"<<kOfxActionUnload<<"()->"<<StatStr(stat)<<std::endl;
-#           endif
+            trace.setStatus(stat);
           } CatchAllSetStatus(stat, gImageEffectHost, (*_pluginHandle), kOfxActionUnload);
           (void)stat;
         }
@@ -411,13 +392,9 @@ namespace OFX {
 
         OfxStatus stat;
         try {
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)plug.getOfxPlugin()<<"->"<<kOfxActionLoad<<"()"<<std::endl;
-#         endif
+          Trace::Scope trace(kOfxActionLoad, plug.getOfxPlugin());
           stat = plug->mainEntry(kOfxActionLoad, 0, 0, 0);
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)plug.getOfxPlugin()<<"->"<<kOfxActionLoad<<"()->"<<StatStr(stat)<<std::endl;
-#         endif
+          trace.setStatus(stat);
         } CatchAllSetStatus(stat, gImageEffectHost, plug, kOfxActionLoad);
 
         if (stat != kOfxStatOK && stat != kOfxStatReplyDefault) {
@@ -426,13 +403,9 @@ namespace OFX {
         }
 
         try {
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)plug.getOfxPlugin()<<"->"<<kOfxActionDescribe<<"()"<<std::endl;
-#         endif
+          Trace::Scope trace(kOfxActionDescribe, plug.getOfxPlugin());
           stat = plug->mainEntry(kOfxActionDescribe, p->getDescriptor().getHandle(), 0, 0);
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)plug.getOfxPlugin()<<"->"<<kOfxActionDescribe<<"()->"<<StatStr(stat)<<std::endl;
-#         endif
+          trace.setStatus(stat);
         } CatchAllSetStatus(stat, gImageEffectHost, plug, kOfxActionDescribe);
 
         if (stat != kOfxStatOK && stat != kOfxStatReplyDefault) {
@@ -451,13 +424,9 @@ namespace OFX {
         }
 
         try {
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)plug.getOfxPlugin()<<"->"<<kOfxActionUnload<<"()"<<std::endl;
-#         endif
+          Trace::Scope trace(kOfxActionUnload, plug.getOfxPlugin());
           stat = plug->mainEntry(kOfxActionUnload, 0, 0, 0);
-#         ifdef OFX_DEBUG_ACTIONS
-            std::cout << "OFX: "<<(void*)plug.getOfxPlugin()<<"->"<<kOfxActionUnload<<"()->"<<StatStr(stat)<<std::endl;
-#         endif
+          trace.setStatus(stat);
         } CatchAllSetStatus(stat, gImageEffectHost, plug, kOfxActionUnload);
 
         if (stat != kOfxStatOK && stat != kOfxStatReplyDefault) {
@@ -0,0 +1,278 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <math.h>
+#include <chrono>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhParam.h"
+#include "ofxhImageEffect.h"
+#include "ofxhUtilities.h"
+#include "ofxhCancel.h"
+#include "ofxhInteractiveRender.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      /// weight of the latest measurement in the moving average of render costs
+      static const double kCostWeight = 0.25;
+
+      /// guess at how much cheaper a draft render is, until one has been measured
+      static const double kDraftGuess = 0.5;
+
+      /// scale a full render scale pixel window, rounding outwards
+      static OfxRectI scaleWindow(const OfxRectI &window, double scale)
+      {
+        OfxRectI r;
+        r.x1 = (int)floor(window.x1 * scale);
+        r.y1 = (int)floor(window.y1 * scale);
+        r.x2 = (int)ceil(window.x2 * scale);
+        r.y2 = (int)ceil(window.y2 * scale);
+        return r;
+      }
+
+      /// number of pixels in a window
+      static double windowPixels(const OfxRectI &window)
+      {
+        return double(Maximum(window.x2 - window.x1, 0)) * double(Maximum(window.y2 - window.y1, 0));
+      }
+
+      InteractiveRenderer::InteractiveRenderer(Instance &instance, InteractiveRenderListener *listener, double budget)
+        : _instance(instance)
+        , _listener(listener)
+        , _budget(budget)
+        , _minScale(1.0 / 8)
+        , _refinePending(false)
+        , _refineTime(0)
+        , _refineToken(0)
+        , _stop(false)
+      {
+        _costs[0].secondsPerPixel = 0;
+        _costs[1].secondsPerPixel = 0;
+        _thread = std::thread(&InteractiveRenderer::threadMain, this);
+      }
+
+      InteractiveRenderer::~InteractiveRenderer()
+      {
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          _stop = true;
+        }
+        _wake.notify_all();
+        _thread.join();
+      }
+
+      void InteractiveRenderer::setBudget(double seconds)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _budget = seconds;
+      }
+
+      void InteractiveRenderer::setMinimumScale(double scale)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _minScale = Minimum(Maximum(scale, 1.0 / (1 << (kMaxLevels - 1))), 1.0);
+      }
+
+      double InteractiveRenderer::estimate(const OfxRectI &fullWindow, const Quality &quality)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        double secondsPerPixel = _costs[quality.draft].secondsPerPixel;
+        if(secondsPerPixel <= 0) {
+          // go on the other quality's measurement
+          double other = _costs[!quality.draft].secondsPerPixel;
+          if(other <= 0)
+            return -1;
+          secondsPerPixel = quality.draft ? other * kDraftGuess : other / kDraftGuess;
+        }
+
+        return secondsPerPixel * windowPixels(scaleWindow(fullWindow, quality.scale));
+      }
+
+      InteractiveRenderer::Quality InteractiveRenderer::choose(const OfxRectI &fullWindow)
+      {
+        double budget, minScale;
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          budget = _budget;
+          minScale = _minScale;
+        }
+        if(!_instance.supportsMultiResolution())
+          minScale = 1;
+
+        Quality quality = { 1, false };
+        for(int level = 0; level < kMaxLevels; ++level) {
+          quality.scale = 1.0 / (1 << level);
+          if(quality.scale < minScale)
+            break;
+
+          for(int draft = 0; draft < 2; ++draft) {
+            quality.draft = draft != 0;
+            double seconds = estimate(fullWindow, quality);
+
+            // nothing measured yet, find out what a full render costs
+            if(seconds < 0) {
+              Quality full = { 1, false };
+              return full;
+            }
+
+            if(seconds <= budget)
+              return quality;
+          }
+        }
+
+        // nothing fits, go as fast as we can
+        quality.scale = Maximum(minScale, 1.0 / (1 << (kMaxLevels - 1)));
+        quality.draft = true;
+        return quality;
+      }
+
+      OfxStatus InteractiveRenderer::render(OfxTime time, const OfxRectI &fullWindow, const Quality &quality, CancelToken *cancel)
+      {
+        OfxRangeD range = { time, time };
+        OfxPointD renderScale = { quality.scale, quality.scale };
+        OfxRectI window = scaleWindow(fullWindow, quality.scale);
+
+        SequenceRenderOptions options;
+        options.interactive = true;
+        options.draft = quality.draft;
+        options.lookAhead = 0;
+        options.cancel = cancel;
+
+        OfxStatus st;
+        {
+          std::lock_guard<std::mutex> guard(_renderLock);
+
+          std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+          st = _instance.renderSequence(range, 1, window, renderScale, options, NULL);
+          double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+          // a cancelled render may have returned early, so says nothing about what one costs
+          double pixels = windowPixels(window);
+          if(st == kOfxStatOK && pixels > 0 && !(cancel && cancel->isCancelled())) {
+            std::lock_guard<std::mutex> guard(_lock);
+            double &cost = _costs[quality.draft].secondsPerPixel;
+            if(cost <= 0)
+              cost = seconds / pixels;
+            else
+              cost += kCostWeight * (seconds / pixels - cost);
+          }
+
+          // nobody wants to hear about cancelled renders
+          if(_listener && !(cancel && cancel->isCancelled()))
+            _listener->frameRendered(_instance, time, renderScale, quality.draft, st);
+        }
+
+        return st;
+      }
+
+      OfxStatus InteractiveRenderer::renderFrame(OfxTime time, const OfxRectI &fullWindow)
+      {
+        // the last frame's refine is no use now
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          dropRefine();
+        }
+
+        Quality quality = choose(fullWindow);
+        OfxStatus st = render(time, fullWindow, quality, NULL);
+
+        if(st == kOfxStatOK && (quality.scale != 1 || quality.draft)) {
+          {
+            std::lock_guard<std::mutex> guard(_lock);
+            _refinePending = true;
+            _refineTime = time;
+            _refineWindow = fullWindow;
+          }
+          _wake.notify_one();
+        }
+
+        return st;
+      }
+
+      void InteractiveRenderer::dropRefine()
+      {
+        _refinePending = false;
+        if(_refineToken)
+          _refineToken->cancel();
+      }
+
+      void InteractiveRenderer::cancelRefine()
+      {
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          dropRefine();
+        }
+
+        // wait out one in progress
+        std::lock_guard<std::mutex> guard(_renderLock);
+      }
+
+      void InteractiveRenderer::threadMain()
+      {
+        std::unique_lock<std::mutex> guard(_lock);
+        for(;;) {
+          while(!_stop && !_refinePending)
+            _wake.wait(guard);
+          if(_stop)
+            return;
+
+          OfxTime time = _refineTime;
+          OfxRectI window = _refineWindow;
+          _refinePending = false;
+
+          CancelToken token;
+          _refineToken = &token;
+
+          guard.unlock();
+          Quality full = { 1, false };
+          render(time, window, full, &token);
+          guard.lock();
+
+          _refineToken = 0;
+        }
+      }
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
@@ -29,12 +29,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 // ofx host
 
+#include <cstdlib>
+#include <cerrno>
+#include <new>
+
 // ofx
 #include "ofxCore.h"
 #include "ofxImageEffect.h"
 
 // ofx host
+#include "ofxhBinary.h"
 #include "ofxhMemory.h"
+#include "ofxhMemoryGovernor.h"
+#include "ofxhNuma.h"
+
+#if defined(UNIX)
+#include <unistd.h>
+#endif
 
 namespace OFX {
 
@@ -42,17 +53,40 @@ namespace OFX {
 
     namespace Memory {
 
-      Instance::Instance() : _ptr(0), _locked(0) {}
+      /// smallest allocation worth placing on the allocating thread's node, smaller ones
+      /// come out of pages the allocator shares between threads
+      static const size_t kMinBytesToPlace = 1 << 20;
+
+      Instance::Instance() : _ptr(0), _locked(0), _size(0) {}
 
       Instance::~Instance() {
         delete [] _ptr;
+        Governor::get().released(_size);
       }
 
       bool Instance::alloc(size_t nBytes) {
         if(!_locked){
           if(_ptr)
             freeMem();
-          _ptr = new char[nBytes];
+
+          // make room for it first if that takes us over budget
+          Governor &governor = Governor::get();
+          governor.allocated(nBytes);
+          governor.enforce();
+
+          try {
+            _ptr = new char[nBytes];
+          }
+          catch(...) {
+            governor.released(nBytes);
+            throw;
+          }
+          _size = nBytes;
+
+          // have the pages land on the node of the thread that asked for them, which is
+          // the one that will render into them, whoever happens to touch them first
+          if(nBytes >= kMinBytesToPlace)
+            Numa::preferThreadNode(_ptr, nBytes);
           return true;
         }
         else
@@ -67,6 +101,8 @@ namespace OFX {
         delete [] _ptr;
         _ptr = 0;
         _locked = 0;
+        Governor::get().released(_size);
+        _size = 0;
       }
 
       void* Instance::getPtr() {
@@ -83,9 +119,195 @@ namespace OFX {
         }
       }
 
+      /// where unlocked memory is spilt to, guarded by gSpillLock
+      static std::mutex gSpillLock;
+      static std::string gSpillDirectory;
+
+      void setSpillDirectory(const std::string &directory)
+      {
+        std::lock_guard<std::mutex> guard(gSpillLock);
+        gSpillDirectory = directory;
+      }
+
+      std::string getSpillDirectory()
+      {
+        std::lock_guard<std::mutex> guard(gSpillLock);
+        if(gSpillDirectory.empty()) {
+          const char *directory = getenv("OFX_HOST_SPILL_DIR");
+          if(!directory || !*directory)
+            directory = getenv("TMPDIR");
+          gSpillDirectory = directory && *directory ? directory : "/tmp";
+        }
+        return gSpillDirectory;
+      }
+
+#if defined(UNIX)
+      /// write or read nBytes at the start of a file, returns false on failure
+      static bool transfer(int fd, char *data, size_t nBytes, bool writing)
+      {
+        size_t done = 0;
+        while(done < nBytes) {
+          ssize_t n = writing ? pwrite(fd, data + done, nBytes - done, (off_t)done)
+                              : pread(fd, data + done, nBytes - done, (off_t)done);
+          if(n < 0 && errno == EINTR)
+            continue;
+          if(n <= 0)
+            return false;
+          done += size_t(n);
+        }
+        return true;
+      }
+#endif
+
+      /// Sets a MovableInstance's _busy flag for as long as it is in scope. Hold the mutex
+      /// over this around anything that may make the governor purge, as the purge would
+      /// otherwise try to lock a mutex the thread already holds.
+      class BusyScope {
+        std::atomic<bool> &_busy;
+
+      public :
+        explicit BusyScope(std::atomic<bool> &busy)
+          : _busy(busy)
+        {
+          _busy = true;
+        }
+
+        ~BusyScope()
+        {
+          _busy = false;
+        }
+      };
+
+      MovableInstance::MovableInstance()
+        : Purgeable(ePurgeUnlocked)
+        , _busy(false)
+        , _spillFd(-1)
+      {
+        Governor::get().add(this);
+      }
+
+      MovableInstance::~MovableInstance()
+      {
+        Governor::get().remove(this);
+        freeMem();
+      }
+
+      bool MovableInstance::alloc(size_t nBytes)
+      {
+        // free first, Instance::alloc would call back into freeMem with the mutex held
+        if(_locked)
+          return false;
+        freeMem();
+
+        // this may purge
+        std::lock_guard<std::mutex> guard(_mutex);
+        BusyScope busy(_busy);
+        return Instance::alloc(nBytes);
+      }
+
+      void MovableInstance::freeMem()
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+#if defined(UNIX)
+        if(_spillFd >= 0) {
+          // the governor was told when it was spilt
+          close(_spillFd);
+          _spillFd = -1;
+          _size = 0;
+        }
+#endif
+        Instance::freeMem();
+      }
+
+      void* MovableInstance::getPtr()
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _ptr;
+      }
+
+      bool MovableInstance::isSpilt()
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _spillFd >= 0;
+      }
+
+      bool MovableInstance::faultIn()
+      {
+#if defined(UNIX)
+        if(_spillFd < 0)
+          return true;
+
+        // this may purge, which passes over us as we are marked busy
+        Governor &governor = Governor::get();
+        governor.allocated(_size);
+        governor.enforce();
+
+        char *ptr = new (std::nothrow) char[_size];
+        if(!ptr || !transfer(_spillFd, ptr, _size, false)) {
+          delete [] ptr;
+          governor.released(_size);
+          return false;
+        }
+
+        close(_spillFd);
+        _spillFd = -1;
+        _ptr = ptr;
+        if(_size >= kMinBytesToPlace)
+          Numa::preferThreadNode(_ptr, _size);
+#endif
+        return true;
+      }
+
+      void MovableInstance::lock()
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        BusyScope busy(_busy);
+
+        // if it can't be read back getPtr stays NULL, which plugins see as out of memory
+        // and so won't unlock
+        if(faultIn())
+          ++_locked;
+      }
+
+      void MovableInstance::unlock()
+      {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if(_locked > 0 && --_locked == 0)
+          touch();
+      }
+
+      size_t MovableInstance::purge(size_t /*nBytes*/)
+      {
+        // whoever holds the mutex is using the memory, leave it be, and if it is held by
+        // this thread, in alloc or lock, don't try to take it again
+        if(_busy)
+          return 0;
+        std::unique_lock<std::mutex> guard(_mutex, std::try_to_lock);
+        if(!guard.owns_lock() || _locked || !_ptr || _size < kMinBytesToSpill)
+          return 0;
+
+#if defined(UNIX)
+        std::string path = getSpillDirectory() + "/ofxmemory-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if(fd < 0)
+          return 0;
+        unlink(path.c_str());
+
+        if(!transfer(fd, _ptr, _size, true)) {
+          close(fd);
+          return 0;
+        }
+
+        _spillFd = fd;
+        delete [] _ptr;
+        _ptr = 0;
+        Governor::get().released(_size);
+#endif
+        return 0;
+      }
+
     } // Memory
 
   } // Host
 
 } // OFX
-
@@ -0,0 +1,323 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// ofx host
+#include "ofxhUtilities.h"
+#include "ofxhMemoryGovernor.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace Memory {
+
+      /// set on a thread while it reclaims, so purges that allocate don't reclaim again
+      static thread_local bool tReclaiming = false;
+
+      /// over budget we purge down to this fraction of it, so we aren't purging on every allocation
+      static const double kBudgetSlack = 0.9;
+
+      /// fraction of what is held given back when the system reports pressure
+      static const double kPressureReclaim = 0.25;
+
+      Purgeable::Purgeable(int priority)
+        : _purgePriority(priority)
+        , _lastUsed(Governor::tick())
+      {
+      }
+
+      Purgeable::~Purgeable()
+      {
+      }
+
+      void Purgeable::touch()
+      {
+        _lastUsed.store(Governor::tick(), std::memory_order_relaxed);
+      }
+
+      /// orders purgeables, lowest priority then least recently used first
+      static bool purgeOrder(const Purgeable *a, const Purgeable *b)
+      {
+        if(a->getPurgePriority() != b->getPurgePriority())
+          return a->getPurgePriority() < b->getPurgePriority();
+        return a->getLastUsed() < b->getLastUsed();
+      }
+
+      Governor::Governor()
+        : _held(0)
+        , _budget(0)
+        , _purging(0)
+        , _stopMonitor(false)
+      {
+        const char *budget = getenv("OFX_HOST_MEMORY_BUDGET");
+        if(budget && *budget)
+          _budget = size_t(strtoull(budget, NULL, 10)) << 20;
+      }
+
+      Governor::~Governor()
+      {
+        stopPressureMonitor();
+      }
+
+      Governor &Governor::get()
+      {
+        static Governor gGovernor;
+        return gGovernor;
+      }
+
+      unsigned long long Governor::tick()
+      {
+        static std::atomic<unsigned long long> gTick(0);
+        return ++gTick;
+      }
+
+      void Governor::setBudget(size_t nBytes)
+      {
+        _budget = nBytes;
+      }
+
+      void Governor::allocated(size_t nBytes)
+      {
+        _held += nBytes;
+      }
+
+      void Governor::released(size_t nBytes)
+      {
+        _held -= nBytes;
+      }
+
+      size_t Governor::enforce()
+      {
+        size_t budget = _budget;
+        if(budget == 0 || _held <= budget || tReclaiming)
+          return 0;
+
+        // someone else is already on it
+        std::unique_lock<std::mutex> guard(_reclaimLock, std::try_to_lock);
+        if(!guard.owns_lock())
+          return 0;
+
+        return reclaimTo(size_t(budget * kBudgetSlack));
+      }
+
+      size_t Governor::reclaim(size_t nBytes)
+      {
+        if(tReclaiming)
+          return 0;
+
+        std::lock_guard<std::mutex> guard(_reclaimLock);
+        size_t held = _held;
+        return reclaimTo(held > nBytes ? held - nBytes : 0);
+      }
+
+      size_t Governor::reclaimTo(size_t goal)
+      {
+        std::vector<Purgeable *> order;
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          order.assign(_purgeables.begin(), _purgeables.end());
+        }
+        std::sort(order.begin(), order.end(), purgeOrder);
+
+        tReclaiming = true;
+        size_t freed = 0;
+        for(size_t i = 0; i < order.size(); ++i) {
+          size_t held = _held;
+          if(held <= goal)
+            break;
+
+          // it may have been removed since we took the copy, if not it stays alive until
+          // _purging is cleared, as remove waits for that
+          {
+            std::lock_guard<std::mutex> guard(_lock);
+            if(_purgeables.find(order[i]) == _purgeables.end())
+              continue;
+            _purging = order[i];
+          }
+
+          size_t unreported = 0;
+          try {
+            unreported = order[i]->purge(held - goal);
+          }
+          catch(...) {
+          }
+
+          {
+            std::lock_guard<std::mutex> guard(_lock);
+            _purging = 0;
+          }
+          _purged.notify_all();
+
+          size_t after = _held;
+          freed += unreported + (held > after ? held - after : 0);
+        }
+        tReclaiming = false;
+
+        return freed;
+      }
+
+      void Governor::add(Purgeable *purgeable)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _purgeables.insert(purgeable);
+      }
+
+      void Governor::remove(Purgeable *purgeable)
+      {
+        std::unique_lock<std::mutex> guard(_lock);
+        _purgeables.erase(purgeable);
+
+        // once erased a reclaim won't start purging it, but one may be purging it now, unless
+        // that is this thread and it is being destroyed from its own purge
+        if(!tReclaiming)
+          _purged.wait(guard, [&] { return _purging != purgeable; });
+      }
+
+      bool Governor::startPressureMonitor(unsigned int stallMicros, unsigned int windowMicros)
+      {
+#ifdef __linux__
+        if(_monitor.joinable())
+          return true;
+
+        FILE *f = fopen("/proc/pressure/memory", "r");
+        if(!f)
+          return false;
+        fclose(f);
+
+        _stopMonitor = false;
+        _monitor = std::thread(&Governor::monitorMain, this, stallMicros, windowMicros);
+        return true;
+#else
+        (void)stallMicros;
+        (void)windowMicros;
+        return false;
+#endif
+      }
+
+      void Governor::stopPressureMonitor()
+      {
+        if(!_monitor.joinable())
+          return;
+        _stopMonitor = true;
+        _monitor.join();
+      }
+
+#ifdef __linux__
+      /// read the some avg10 figure, the percentage of the last ten seconds some task was stalled on memory
+      static double readPressure()
+      {
+        double avg10 = -1;
+        FILE *f = fopen("/proc/pressure/memory", "r");
+        if(f) {
+          if(fscanf(f, "some avg10=%lf", &avg10) != 1)
+            avg10 = -1;
+          fclose(f);
+        }
+        return avg10;
+      }
+#endif
+
+      void Governor::monitorMain(unsigned int stallMicros, unsigned int windowMicros)
+      {
+#ifdef __linux__
+        // check for stopping this often
+        const int pollMillis = 250;
+
+        // ask the kernel to tell us when the stall threshold is crossed, this needs a
+        // kernel with psi triggers, failing that we read the averages
+        int fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK);
+        if(fd >= 0) {
+          char trigger[64];
+          snprintf(trigger, sizeof(trigger), "some %u %u", stallMicros, windowMicros);
+          if(write(fd, trigger, strlen(trigger) + 1) < 0) {
+            close(fd);
+            fd = -1;
+          }
+        }
+
+        double threshold = 100.0 * stallMicros / Maximum(windowMicros, 1u);
+        std::chrono::steady_clock::time_point lastReclaim;
+        bool reclaimed = false;
+
+        while(!_stopMonitor) {
+          bool pressure = false;
+
+          if(fd >= 0) {
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLPRI;
+            pfd.revents = 0;
+            int n = poll(&pfd, 1, pollMillis);
+            if(n > 0 && (pfd.revents & POLLERR)) {
+              close(fd);
+              fd = -1;
+            }
+            else
+              pressure = n > 0 && (pfd.revents & POLLPRI);
+          }
+          else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(pollMillis));
+            pressure = readPressure() >= threshold;
+          }
+
+          // give what we purged a window to take effect before going again
+          std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          if(pressure && (!reclaimed || now - lastReclaim >= std::chrono::microseconds(windowMicros))) {
+            reclaim(size_t(getBytesHeld() * kPressureReclaim));
+            lastReclaim = now;
+            reclaimed = true;
+          }
+        }
+
+        if(fd >= 0)
+          close(fd);
+#else
+        (void)stallMicros;
+        (void)windowMicros;
+#endif
+      }
+
+    } // namespace Memory
+
+  } // namespace Host
+
+} // namespace OFX
@@ -0,0 +1,393 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstddef>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxMultiThread.h"
+
+// ofx host
+#include "ofxhUtilities.h"
+#include "ofxhCancel.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhMultiThread.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace MultiThread {
+
+      /// the thread index and spawned flag the suite reports on this thread
+      static thread_local unsigned int tThreadIndex = 0;
+      static thread_local bool         tSpawned = false;
+
+      /// index of the pool worker this thread is, -1 if it is not a worker
+      static thread_local int          tWorkerIndex = -1;
+
+      struct Region {
+        OfxThreadFunctionV1     *func;
+        unsigned int             nThreads;
+        void                    *customArg;
+        std::atomic<unsigned int> remaining;  ///< jobs not yet finished
+        std::atomic<bool>        failed;
+        bool                     spawned;    ///< plugin region, rather than a host one
+        CancelToken             *cancel;     ///< the calling thread's cancel token, which the jobs run with
+        const char              *field;      ///< the field the calling thread is rendering, likewise
+        OfxPointD                renderScale; ///< and the render scale
+        std::mutex               doneLock;
+        std::condition_variable  done;
+
+        Region(OfxThreadFunctionV1 *f, unsigned int n, void *arg, bool isSpawned)
+          : func(f)
+          , nThreads(n)
+          , customArg(arg)
+          , remaining(n)
+          , failed(false)
+          , spawned(isSpawned)
+          , cancel(CancelToken::getCurrent())
+          , field(ImageEffect::RenderScope::getCurrentField())
+          , renderScale(ImageEffect::RenderScope::getCurrentRenderScale())
+        {}
+
+        /// call the function for one index with the thread locals set up for it
+        void call(unsigned int index)
+        {
+          unsigned int savedIndex = tThreadIndex;
+          bool savedSpawned = tSpawned;
+          tThreadIndex = spawned ? index : 0;
+          tSpawned = spawned;
+          CancelScope cancelScope(cancel);
+          ImageEffect::RenderScope renderScope(field, renderScale);
+
+          try {
+            func(index, nThreads, customArg);
+          }
+          catch(...) {
+            failed = true;
+          }
+
+          tThreadIndex = savedIndex;
+          tSpawned = savedSpawned;
+        }
+      };
+
+      ThreadPool::ThreadPool(unsigned int nWorkers)
+        : _topology(Numa::Topology::getDefault())
+        , _pending(0)
+        , _stop(false)
+        , _localSteals(0)
+        , _remoteSteals(0)
+      {
+        startWorkers(nWorkers);
+      }
+
+      ThreadPool::ThreadPool(unsigned int nWorkers, const Numa::Topology &topology)
+        : _topology(topology)
+        , _pending(0)
+        , _stop(false)
+        , _localSteals(0)
+        , _remoteSteals(0)
+      {
+        startWorkers(nWorkers);
+      }
+
+      void ThreadPool::startWorkers(unsigned int nWorkers)
+      {
+        if(nWorkers == 0)
+          nWorkers = Maximum(_topology.getNumCPUs(), 1u) - 1;
+
+        // make all the queues before any worker can go looking in them, workers on the
+        // same node are next to each other, each node getting its share of the CPUs
+        unsigned int nCPUs = _topology.getNumCPUs();
+        unsigned int node = 0, cpusBefore = 0;
+        for(unsigned int i = 0; i < nWorkers; ++i) {
+          unsigned long long cpu = (unsigned long long)i * nCPUs / nWorkers;
+          while(node + 1 < _topology.getNumNodes() && cpu >= cpusBefore + _topology.getCPUs(node).size())
+            cpusBefore += (unsigned int)_topology.getCPUs(node++).size();
+
+          Worker *worker = new Worker;
+          worker->node = node;
+          _workers.push_back(worker);
+        }
+        for(unsigned int i = 0; i < nWorkers; ++i)
+          _workers[i]->thread = std::thread(&ThreadPool::workerMain, this, i);
+      }
+
+      ThreadPool::~ThreadPool()
+      {
+        {
+          std::lock_guard<std::mutex> guard(_sleepLock);
+          _stop = true;
+        }
+        _wake.notify_all();
+
+        // workers still winding down may look in each other's queues
+        for(size_t i = 0; i < _workers.size(); ++i)
+          _workers[i]->thread.join();
+        for(size_t i = 0; i < _workers.size(); ++i)
+          delete _workers[i];
+        _workers.clear();
+      }
+
+      ThreadPool &ThreadPool::getDefault()
+      {
+        static ThreadPool gPool;
+        return gPool;
+      }
+
+      unsigned int ThreadPool::getThreadIndex()
+      {
+        return tThreadIndex;
+      }
+
+      bool ThreadPool::isSpawnedThread()
+      {
+        return tSpawned;
+      }
+
+      bool ThreadPool::takeJob(int workerIndex, Job &job, const Region *region)
+      {
+        int nWorkers = (int)_workers.size();
+
+        // newest job off our own queue, it is the one most likely to be in cache. Anything
+        // we queued since starting to wait on the region has been finished by now, so if the
+        // back job is not from the region neither is anything under it
+        if(workerIndex >= 0) {
+          Worker *self = _workers[workerIndex];
+          std::lock_guard<std::mutex> guard(self->lock);
+          if(!self->jobs.empty() && (!region || self->jobs.back().region == region)) {
+            job = self->jobs.back();
+            self->jobs.pop_back();
+            --_pending;
+            return true;
+          }
+        }
+
+        // oldest job off someone else's, from workers on our node first, a thread that
+        // isn't on a node treats them all as near
+        int node = workerIndex >= 0 ? (int)_workers[workerIndex]->node : Numa::getThreadNode();
+        for(int pass = 0; pass < 2; ++pass) {
+          for(int i = 1; i <= nWorkers; ++i) {
+            Worker *victim = _workers[(Maximum(workerIndex, 0) + i) % nWorkers];
+            bool local = node < 0 || (int)victim->node == node;
+            if(local != (pass == 0))
+              continue;
+
+            std::lock_guard<std::mutex> guard(victim->lock);
+            for(std::deque<Job>::iterator it = victim->jobs.begin(); it != victim->jobs.end(); ++it) {
+              if(!region || it->region == region) {
+                job = *it;
+                victim->jobs.erase(it);
+                --_pending;
+                ++(local ? _localSteals : _remoteSteals);
+                return true;
+              }
+            }
+          }
+        }
+
+        return false;
+      }
+
+      void ThreadPool::runJob(const Job &job)
+      {
+        Region *region = job.region;
+        region->call(job.index);
+
+        // the region lives on the caller's stack, so don't touch it once the caller can see it is done
+        std::lock_guard<std::mutex> guard(region->doneLock);
+        if(--region->remaining == 0)
+          region->done.notify_all();
+      }
+
+      void ThreadPool::workerMain(unsigned int workerIndex)
+      {
+        tWorkerIndex = (int)workerIndex;
+        Numa::setThreadNode(_topology, _workers[workerIndex]->node);
+
+        for(;;) {
+          Job job;
+          if(takeJob((int)workerIndex, job, NULL)) {
+            runJob(job);
+            continue;
+          }
+
+          std::unique_lock<std::mutex> guard(_sleepLock);
+          while(!_stop && _pending == 0)
+            _wake.wait(guard);
+          if(_stop && _pending == 0)
+            return;
+        }
+      }
+
+      OfxStatus ThreadPool::runRegion(Region &region)
+      {
+        // nothing to share out
+        if(region.nThreads == 1 || _workers.empty()) {
+          for(unsigned int i = 0; i < region.nThreads; ++i)
+            region.call(i);
+          return region.failed ? kOfxStatFailed : kOfxStatOK;
+        }
+
+        // count the jobs before queueing them, a worker that steals one first would take
+        // _pending below zero and spin instead of sleeping until we caught up
+        _pending += (int)region.nThreads;
+
+        if(tWorkerIndex >= 0) {
+          // a nested region, keep the jobs on our own queue for the idle workers to steal,
+          // they will take them in index order while we work back from the other end
+          Worker *self = _workers[tWorkerIndex];
+          std::lock_guard<std::mutex> guard(self->lock);
+          for(unsigned int i = 0; i < region.nThreads; ++i) {
+            Job job = { &region, i };
+            self->jobs.push_back(job);
+          }
+        }
+        else {
+          // deal the jobs out over the worker queues
+          static std::atomic<unsigned int> gNextWorker(0);
+          unsigned int first = gNextWorker++;
+          for(unsigned int i = 0; i < region.nThreads; ++i) {
+            Worker *worker = _workers[(first + i) % _workers.size()];
+            Job job = { &region, i };
+            std::lock_guard<std::mutex> guard(worker->lock);
+            worker->jobs.push_back(job);
+          }
+        }
+
+        // make sure no worker is between checking _pending and going to sleep
+        {
+          std::lock_guard<std::mutex> guard(_sleepLock);
+        }
+        _wake.notify_all();
+
+        // pitch in until there is nothing left of the region to take, only ever running
+        // its own jobs means we can't end up stuck under some unrelated long job
+        while(region.remaining > 0) {
+          Job job;
+          if(!takeJob(tWorkerIndex, job, &region))
+            break;
+          runJob(job);
+        }
+
+        // then wait for the jobs still running elsewhere, none are queued so they
+        // are all making progress
+        {
+          std::unique_lock<std::mutex> guard(region.doneLock);
+          while(region.remaining > 0)
+            region.done.wait(guard);
+        }
+
+        return region.failed ? kOfxStatFailed : kOfxStatOK;
+      }
+
+      OfxStatus ThreadPool::multiThread(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg)
+      {
+        if(!func)
+          return kOfxStatFailed;
+
+        if(nThreads == 0)
+          nThreads = getNumCPUs();
+
+        Region region(func, nThreads, customArg, true);
+        return runRegion(region);
+      }
+
+      OfxStatus ThreadPool::multiThreadHost(OfxThreadFunctionV1 func, unsigned int nThreads, void *customArg)
+      {
+        if(!func)
+          return kOfxStatFailed;
+
+        if(nThreads == 0)
+          nThreads = getNumCPUs();
+
+        Region region(func, nThreads, customArg, false);
+        return runRegion(region);
+      }
+
+      Mutex::Mutex(int lockCount)
+        : _lockCount(0)
+      {
+        if(lockCount > 0) {
+          _owner = std::this_thread::get_id();
+          _lockCount = lockCount;
+        }
+      }
+
+      void Mutex::lock()
+      {
+        std::thread::id self = std::this_thread::get_id();
+        std::unique_lock<std::mutex> guard(_lock);
+
+        if(_lockCount > 0 && _owner == self) {
+          ++_lockCount;
+          return;
+        }
+
+        while(_lockCount > 0)
+          _released.wait(guard);
+        _owner = self;
+        _lockCount = 1;
+      }
+
+      bool Mutex::tryLock()
+      {
+        std::thread::id self = std::this_thread::get_id();
+        std::lock_guard<std::mutex> guard(_lock);
+
+        if(_lockCount > 0 && _owner != self)
+          return false;
+        _owner = self;
+        ++_lockCount;
+        return true;
+      }
+
+      bool Mutex::unlock()
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        if(_lockCount <= 0 || _owner != std::this_thread::get_id())
+          return false;
+
+        if(--_lockCount == 0) {
+          _owner = std::thread::id();
+          _released.notify_one();
+        }
+        return true;
+      }
+
+    } // namespace MultiThread
+
+  } // namespace Host
+
+} // namespace OFX
@@ -0,0 +1,252 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+// ofx host
+#include "ofxhUtilities.h"
+#include "ofxhNuma.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace Numa {
+
+      /// the node the calling thread has been given, if any, and the topology it is in
+      static thread_local int             tNode = -1;
+      static thread_local const Topology *tTopology = 0;
+
+#ifdef __linux__
+      /// memory policy from <numaif.h>, which comes with libnuma rather than the kernel headers
+      static const int kMPolPreferred = 1;
+
+      /// Parse a sysfs CPU list such as "0-7,16-23". Returns false if it can't be read.
+      static bool readCPUList(const std::string &path, std::vector<unsigned int> &cpus)
+      {
+        FILE *file = fopen(path.c_str(), "r");
+        if(!file)
+          return false;
+
+        char line[4096];
+        bool ok = fgets(line, sizeof(line), file) != 0;
+        fclose(file);
+        if(!ok)
+          return false;
+
+        const char *p = line;
+        while(*p && *p != '\n') {
+          char *end;
+          unsigned long first = strtoul(p, &end, 10);
+          if(end == p)
+            return false;
+          unsigned long last = first;
+          p = end;
+          if(*p == '-') {
+            last = strtoul(p + 1, &end, 10);
+            p = end;
+          }
+          for(unsigned long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back((unsigned int)cpu);
+          if(*p == ',')
+            ++p;
+        }
+        return true;
+      }
+#endif
+
+      Topology::Topology()
+        : _nodeCPUs(1)
+        , _nodeIds(1, 0)
+        , _simulated(false)
+      {
+        unsigned int nCPUs = Maximum(std::thread::hardware_concurrency(), 1u);
+        for(unsigned int i = 0; i < nCPUs; ++i)
+          _nodeCPUs[0].push_back(i);
+      }
+
+      Topology Topology::detect()
+      {
+        Topology topology;
+
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+          return topology;
+
+        std::vector<std::vector<unsigned int> > nodes;
+        std::vector<unsigned int> ids;
+        for(int node = 0; ; ++node) {
+          char path[128];
+          snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+          std::vector<unsigned int> cpus;
+          if(!readCPUList(path, cpus))
+            break;
+
+          // nodes with no CPUs we may use are no use to us
+          std::vector<unsigned int> usable;
+          for(size_t i = 0; i < cpus.size(); ++i) {
+            if(cpus[i] < CPU_SETSIZE && CPU_ISSET(cpus[i], &allowed))
+              usable.push_back(cpus[i]);
+          }
+          if(!usable.empty()) {
+            nodes.push_back(usable);
+            ids.push_back((unsigned int)node);
+          }
+        }
+
+        if(!nodes.empty()) {
+          topology._nodeCPUs = nodes;
+          topology._nodeIds = ids;
+        }
+#endif
+
+        return topology;
+      }
+
+      Topology Topology::simulate(unsigned int nNodes, unsigned int cpusPerNode)
+      {
+        Topology topology;
+        nNodes = Maximum(nNodes, 1u);
+        cpusPerNode = Maximum(cpusPerNode, 1u);
+
+        topology._simulated = true;
+        topology._nodeCPUs.assign(nNodes, std::vector<unsigned int>());
+        topology._nodeIds.resize(nNodes);
+        for(unsigned int node = 0; node < nNodes; ++node) {
+          topology._nodeIds[node] = node;
+          for(unsigned int i = 0; i < cpusPerNode; ++i)
+            topology._nodeCPUs[node].push_back(node * cpusPerNode + i);
+        }
+        return topology;
+      }
+
+      const Topology &Topology::getDefault()
+      {
+        static Topology gTopology = []() {
+          const char *nodes = getenv("OFX_HOST_NUMA_NODES");
+          if(nodes && atoi(nodes) > 0) {
+            // share the real CPUs out over the simulated nodes
+            unsigned int nNodes = (unsigned int)atoi(nodes);
+            unsigned int nCPUs = Maximum(std::thread::hardware_concurrency(), 1u);
+            return simulate(nNodes, Maximum(nCPUs / nNodes, 1u));
+          }
+          return detect();
+        }();
+        return gTopology;
+      }
+
+      unsigned int Topology::getNumCPUs() const
+      {
+        size_t n = 0;
+        for(size_t i = 0; i < _nodeCPUs.size(); ++i)
+          n += _nodeCPUs[i].size();
+        return (unsigned int)n;
+      }
+
+      bool setThreadNode(const Topology &topology, unsigned int node)
+      {
+        if(node >= topology.getNumNodes())
+          return false;
+        tNode = (int)node;
+        tTopology = &topology;
+
+        if(!topology.isBinding())
+          return true;
+
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        const std::vector<unsigned int> &nodeCPUs = topology.getCPUs(node);
+        for(size_t i = 0; i < nodeCPUs.size(); ++i) {
+          if(nodeCPUs[i] < CPU_SETSIZE)
+            CPU_SET(nodeCPUs[i], &cpus);
+        }
+        return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+#else
+        return false;
+#endif
+      }
+
+      int getThreadNode()
+      {
+        return tNode;
+      }
+
+      bool preferNode(const Topology &topology, void *ptr, size_t nBytes, unsigned int node)
+      {
+        if(!topology.isBinding() || node >= topology.getNumNodes())
+          return true;
+
+#ifdef __linux__
+        // only whole pages can be bound
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t first = ((size_t)ptr + page - 1) & ~(page - 1);
+        size_t last = ((size_t)ptr + nBytes) & ~(page - 1);
+        if(last <= first)
+          return true;
+
+        unsigned long mask[16] = { 0 };
+        const unsigned int id = topology.getNodeId(node);
+        const unsigned int bitsPerLong = sizeof(unsigned long) * 8;
+        if(id >= sizeof(mask) * 8)
+          return false;
+        mask[id / bitsPerLong] = 1ul << (id % bitsPerLong);
+
+        return syscall(SYS_mbind, (void *)first, last - first, kMPolPreferred,
+                       mask, (unsigned long)(sizeof(mask) * 8), 0u) == 0;
+#else
+        return false;
+#endif
+      }
+
+      bool preferThreadNode(void *ptr, size_t nBytes)
+      {
+        if(tNode < 0 || !tTopology)
+          return true;
+        return preferNode(*tTopology, ptr, nBytes, (unsigned int)tNode);
+      }
+
+    } // namespace Numa
+
+  } // namespace Host
+
+} // namespace OFX
@@ -0,0 +1,358 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <map>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhParam.h"
+#include "ofxhMultiThread.h"
+#include "ofxhImageEffect.h"
+#include "ofxhPluginAPICache.h"
+#include "ofxhPluginCache.h"
+#include "ofxhImageEffectAPI.h"
+#include "ofxhUtilities.h"
+#include "ofxhPrefetch.h"
+#include "ofxhParallelRender.h"
+#include "ofxhCancel.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      /// how far short of a whole number of steps the last frame can be and still be rendered
+      static const double kFrameTolerance = 1e-6;
+
+      /// Get the lock that serialises render actions over all instances of a
+      /// thread unsafe plugin. These live as long as the process does.
+      static std::mutex &getPluginRenderLock(ImageEffectPlugin *plugin)
+      {
+        static std::mutex mapLock;
+        static std::map<ImageEffectPlugin *, std::mutex *> locks;
+
+        std::lock_guard<std::mutex> guard(mapLock);
+        std::mutex *&lock = locks[plugin];
+        if(!lock)
+          lock = new std::mutex;
+        return *lock;
+      }
+
+      /// state shared by all the threads rendering one sequence
+      struct SequenceState {
+        std::vector<OfxTime>  frames;
+        std::atomic<size_t>   next;        ///< index of the next frame to render
+        std::atomic<bool>     stop;        ///< set on failure or abort
+        std::mutex            statusLock;
+        OfxStatus             status;      ///< first failure
+        std::string           field;
+        OfxRectI              renderWindow;
+        OfxPointD             renderScale;
+        bool                  sequential;
+        bool                  interactive;
+        bool                  draft;
+        std::mutex           *pluginLock;  ///< non NULL if the plugin is thread unsafe
+        FrameRenderListener  *listener;
+        std::vector<Instance *> effects;   ///< the instance each job renders with
+        OfxTime               last;
+        OfxTime               step;
+        InputPrefetcher      *prefetcher;  ///< non NULL if prefetching, only when rendering serially
+
+        SequenceState()
+          : next(0)
+          , stop(false)
+          , status(kOfxStatOK)
+          , sequential(false)
+          , interactive(false)
+          , draft(false)
+          , pluginLock(0)
+          , listener(0)
+          , last(0)
+          , step(1)
+          , prefetcher(0)
+        {}
+
+        void fail(OfxStatus st)
+        {
+          std::lock_guard<std::mutex> guard(statusLock);
+          if(status == kOfxStatOK)
+            status = st;
+          stop = true;
+        }
+      };
+
+      /// render frames off the shared state with the given effect until there are none left
+      static void renderSequenceFrames(SequenceState *state, Instance *effect)
+      {
+        while(!state->stop) {
+          size_t i = state->next++;
+          if(i >= state->frames.size())
+            break;
+
+          // hosts overriding abort may not look at the cancel token
+          if(CancelToken::isCurrentCancelled() || effect->abort()) {
+            state->fail(kOfxStatFailed);
+            break;
+          }
+
+          OfxTime time = state->frames[i];
+          if(state->prefetcher)
+            state->prefetcher->prefetch(time, state->last, state->step, state->renderScale, state->renderWindow);
+
+          OfxStatus st;
+          try {
+            if(state->pluginLock) {
+              std::lock_guard<std::mutex> guard(*state->pluginLock);
+              st = effect->renderAction(time, state->field, state->renderWindow, state->renderScale,
+                                        state->sequential, state->interactive, state->draft);
+            }
+            else {
+              st = effect->renderAction(time, state->field, state->renderWindow, state->renderScale,
+                                        state->sequential, state->interactive, state->draft);
+            }
+          }
+          catch(...) {
+            st = kOfxStatFailed;
+          }
+
+          if(state->listener)
+            state->listener->frameRendered(*effect, time, st);
+
+          if(st != kOfxStatOK)
+            state->fail(st);
+        }
+      }
+
+      /// thread pool function, one job per rendering instance
+      static void renderSequenceJob(unsigned int index, unsigned int /*nJobs*/, void *arg)
+      {
+        SequenceState *state = static_cast<SequenceState *>(arg);
+        renderSequenceFrames(state, state->effects[index]);
+      }
+
+      ParallelRenderer::ParallelRenderer(Instance &instance, unsigned int maxThreads)
+        : _instance(instance)
+        , _maxThreads(maxThreads)
+        , _clonesFailed(false)
+        , _lookAhead(0)
+      {
+      }
+
+      ParallelRenderer::~ParallelRenderer()
+      {
+        for(std::vector<Instance *>::iterator it = _clones.begin(); it != _clones.end(); ++it)
+          delete *it;
+        _clones.clear();
+      }
+
+      /// the mode that would be used to render the instance as it currently stands
+      ParallelRenderer::Mode ParallelRenderer::getMode() const
+      {
+        // the plugin insists on frames being rendered in order on a single instance
+        if(_instance.getProps().getIntProperty(kOfxImageEffectInstancePropSequentialRender) == 1)
+          return eRenderSerial;
+
+        const std::string &safety = _instance.getRenderThreadSafety();
+        if(safety == kOfxImageEffectRenderFullySafe)
+          return eRenderFullySafe;
+        if(safety == kOfxImageEffectRenderInstanceSafe)
+          return eRenderInstanceSafe;
+        return eRenderSerial;
+      }
+
+      /// the number of frames that could be rendered at once in the current mode
+      unsigned int ParallelRenderer::getConcurrency() const
+      {
+        if(getMode() == eRenderSerial)
+          return 1;
+
+        unsigned int n = _maxThreads;
+        if(n == 0 && (!gImageEffectHost || gImageEffectHost->multiThreadNumCPUS(&n) != kOfxStatOK))
+          n = MultiThread::ThreadPool::getDefault().getNumCPUs();
+        return Maximum(n, 1u);
+      }
+
+      /// make sure there are at least n-1 clones, returns how many instances can be used
+      unsigned int ParallelRenderer::makeClones(unsigned int n)
+      {
+        while(_clones.size() + 1 < n && !_clonesFailed) {
+          Instance *clone = _instance.newRenderClone();
+          if(!clone) {
+            // don't keep trying on every sequence
+            _clonesFailed = true;
+            break;
+          }
+          _clones.push_back(clone);
+        }
+        return Minimum(n, (unsigned int)(_clones.size() + 1));
+      }
+
+      /// copy the master's params onto the given clone
+      OfxStatus ParallelRenderer::syncClone(Instance &clone)
+      {
+        const std::list<Param::Instance *> &params = _instance.getParamList();
+        for(std::list<Param::Instance *>::const_iterator it = params.begin(); it != params.end(); ++it) {
+          const std::string &type = (*it)->getType();
+
+          // these carry no value
+          if(type == kOfxParamTypeGroup || type == kOfxParamTypePage || type == kOfxParamTypePushButton)
+            continue;
+
+          Param::Instance *cloneParam = clone.getParam((*it)->getName());
+          if(!cloneParam)
+            return kOfxStatFailed;
+
+          OfxStatus st = cloneParam->copyFrom(**it, 0, NULL);
+          if(st != kOfxStatOK)
+            return st;
+        }
+
+        return clone.getClipPreferences() ? kOfxStatOK : kOfxStatFailed;
+      }
+
+      OfxStatus ParallelRenderer::renderFrames(OfxTime             first,
+                                               OfxTime             last,
+                                               OfxTime             step,
+                                               const std::string  &field,
+                                               const OfxRectI     &renderWindow,
+                                               OfxPointD           renderScale,
+                                               bool                interactive,
+                                               bool                draft,
+                                               FrameRenderListener *listener)
+      {
+        SequenceState state;
+
+        if(step == 0)
+          step = 1;
+
+        // step from first rather than adding it up, so fractional steps don't drift and
+        // rounding doesn't lose the last frame
+        double nSteps = (last - first) / step;
+        if(nSteps >= -kFrameTolerance) {
+          size_t nFrames = (size_t)floor(nSteps + kFrameTolerance) + 1;
+          for(size_t i = 0; i < nFrames; ++i)
+            state.frames.push_back(first + i * step);
+        }
+        if(state.frames.empty())
+          return kOfxStatOK;
+
+        Mode mode = getMode();
+        unsigned int nThreads = Minimum(getConcurrency(), (unsigned int)state.frames.size());
+
+        // work out which instance each job renders with
+        std::vector<Instance *> &effects = state.effects;
+        effects.push_back(&_instance);
+        if(mode == eRenderFullySafe) {
+          while(effects.size() < nThreads)
+            effects.push_back(&_instance);
+        }
+        else if(mode == eRenderInstanceSafe && nThreads > 1) {
+          nThreads = makeClones(nThreads);
+
+          // get any private data into the params before copying them over
+          _instance.syncPrivateDataAction();
+          for(unsigned int i = 0; i + 1 < nThreads; ++i) {
+            if(syncClone(*_clones[i]) != kOfxStatOK)
+              break;
+            effects.push_back(_clones[i]);
+          }
+        }
+        nThreads = (unsigned int)effects.size();
+
+        state.field        = field;
+        state.renderWindow = renderWindow;
+        state.renderScale  = renderScale;
+        state.sequential   = nThreads == 1;
+        state.interactive  = interactive;
+        state.draft        = draft;
+        state.listener     = listener;
+        state.last         = last;
+        state.step         = step;
+        if(_instance.getRenderThreadSafety() == kOfxImageEffectRenderUnsafe)
+          state.pluginLock = &getPluginRenderLock(_instance.getPlugin());
+
+        // the distinct instances that need begin/end sequence render calls
+        std::vector<Instance *> renderers;
+        renderers.push_back(&_instance);
+        if(mode == eRenderInstanceSafe)
+          renderers.assign(effects.begin(), effects.end());
+
+        size_t nBegun = 0;
+        OfxStatus st = kOfxStatOK;
+        for(; nBegun < renderers.size(); ++nBegun) {
+          st = renderers[nBegun]->beginRenderAction(first, last, step, interactive, renderScale,
+                                                    state.sequential, interactive);
+          if(st != kOfxStatOK && st != kOfxStatReplyDefault)
+            break;
+          st = kOfxStatOK;
+        }
+
+        // with a single instance rendering frames in order, fetch its inputs ahead of it
+        std::unique_ptr<InputPrefetcher> prefetcher;
+        if(nThreads == 1 && _lookAhead > 0 && !_instance.getInputPrefetcher()) {
+          prefetcher.reset(new InputPrefetcher(_instance, _lookAhead));
+          state.prefetcher = prefetcher.get();
+        }
+
+        if(st == kOfxStatOK) {
+          // render through the host's threads, by default the thread pool, where any
+          // multiThread calls the plugin makes from these jobs become nested regions, so idle
+          // workers can help with the last few frames of a sequence rather than sitting there
+          OfxStatus threaded = gImageEffectHost ? gImageEffectHost->multiThreadHost(renderSequenceJob, nThreads, &state)
+                                                : MultiThread::ThreadPool::getDefault().multiThreadHost(renderSequenceJob, nThreads, &state);
+          if(threaded != kOfxStatOK)
+            state.fail(kOfxStatFailed);
+          st = state.status;
+        }
+
+        for(size_t i = 0; i < nBegun; ++i) {
+          renderers[i]->endRenderAction(first, last, step, interactive, renderScale,
+                                        state.sequential, interactive);
+        }
+
+        return st;
+      }
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
@@ -0,0 +1,989 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include <cmath>
+#include <atomic>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+#include "ofxOld.h" // for YUVA
+
+// ofx host
+#include "ofxhUtilities.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhMultiThread.h"
+#include "ofxhPixelConvert.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  define OFXH_CONVERT_X86
+#  include <immintrin.h>
+#  if defined(__GNUC__)
+#    define OFXH_TARGET(isa) __attribute__((target(isa)))
+#  else
+#    include <intrin.h>
+#    define OFXH_TARGET(isa)
+#  endif
+#endif
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace PixelConvert {
+
+      /// pixels converted at a time through the float scratch rows
+      static const int kChunkPixels = 256;
+
+      /// fewest pixels worth handing to another thread
+      static const int kMinPixelsPerJob = 64 * 1024;
+
+      ////////////////////////////////////////////////////////////////////////////////
+      // scalar conversions, the SIMD kernels must give exactly the same results
+
+      static inline float clamp01(float v)
+      {
+        // NaNs become 0, as the SIMD max does
+        v = v > 0.0f ? v : 0.0f;
+        return v < 1.0f ? v : 1.0f;
+      }
+
+      static inline unsigned char floatToByte(float v)
+      {
+        // rounds to nearest even in the default rounding mode, as the SIMD conversions do
+        return (unsigned char)std::lrint(clamp01(v) * 255.0f);
+      }
+
+      static inline unsigned short floatToShort(float v)
+      {
+        return (unsigned short)std::lrint(clamp01(v) * 65535.0f);
+      }
+
+      /// round to nearest even, as F16C does
+      static inline unsigned short floatToHalf(float f)
+      {
+        unsigned int x;
+        memcpy(&x, &f, sizeof(x));
+        unsigned int sign = (x >> 16) & 0x8000;
+        unsigned int absx = x & 0x7fffffff;
+
+        // infinity, or NaN which is kept quiet with the top of its payload
+        if(absx >= 0x7f800000)
+          return (unsigned short)(sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 | ((absx >> 13) & 0x3ff) : 0));
+
+        // rounds to more than the largest half
+        if(absx >= 0x477ff000)
+          return (unsigned short)(sign | 0x7c00);
+
+        // normal half, rebias the exponent and round off 13 bits of mantissa
+        if(absx >= 0x38800000) {
+          unsigned int r = absx - 0x38000000;
+          unsigned int h = r >> 13;
+          unsigned int rem = r & 0x1fff;
+          if(rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+            ++h;
+          return (unsigned short)(sign | h);
+        }
+
+        // rounds to zero
+        if(absx <= 0x33000000)
+          return (unsigned short)sign;
+
+        // denormal half, in units of 2^-24
+        unsigned int shift = 126 - (absx >> 23);
+        unsigned int m = (absx & 0x7fffff) | 0x800000;
+        unsigned int h = m >> shift;
+        unsigned int rem = m & ((1u << shift) - 1);
+        unsigned int halfway = 1u << (shift - 1);
+        if(rem > halfway || (rem == halfway && (h & 1)))
+          ++h;
+        return (unsigned short)(sign | h);
+      }
+
+      static inline float halfToFloat(unsigned short h)
+      {
+        unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+        unsigned int e = (h >> 10) & 0x1f;
+        unsigned int m = h & 0x3ff;
+
+        unsigned int x;
+        if(e == 0x1f) {
+          // infinity, or NaN which is made quiet
+          x = sign | 0x7f800000 | (m ? 0x400000 | (m << 13) : 0);
+        }
+        else if(e == 0) {
+          // zero or denormal, exact in a float
+          float f = float(m) * (1.0f / 16777216.0f);
+          memcpy(&x, &f, sizeof(x));
+          x |= sign;
+        }
+        else
+          x = sign | ((e + 112) << 23) | (m << 13);
+
+        float f;
+        memcpy(&f, &x, sizeof(f));
+        return f;
+      }
+
+      static void byteToFloatScalar(const void *src, float *dst, size_t n)
+      {
+        const unsigned char *s = (const unsigned char *)src;
+        for(size_t i = 0; i < n; ++i)
+          dst[i] = float(s[i]) / 255.0f;
+      }
+
+      static void shortToFloatScalar(const void *src, float *dst, size_t n)
+      {
+        const unsigned short *s = (const unsigned short *)src;
+        for(size_t i = 0; i < n; ++i)
+          dst[i] = float(s[i]) / 65535.0f;
+      }
+
+      static void halfToFloatScalar(const void *src, float *dst, size_t n)
+      {
+        const unsigned short *s = (const unsigned short *)src;
+        for(size_t i = 0; i < n; ++i)
+          dst[i] = halfToFloat(s[i]);
+      }
+
+      static void floatToFloat(const void *src, float *dst, size_t n)
+      {
+        memcpy(dst, src, n * sizeof(float));
+      }
+
+      static void floatToByteScalar(const float *src, void *dst, size_t n)
+      {
+        unsigned char *d = (unsigned char *)dst;
+        for(size_t i = 0; i < n; ++i)
+          d[i] = floatToByte(src[i]);
+      }
+
+      static void floatToShortScalar(const float *src, void *dst, size_t n)
+      {
+        unsigned short *d = (unsigned short *)dst;
+        for(size_t i = 0; i < n; ++i)
+          d[i] = floatToShort(src[i]);
+      }
+
+      static void floatToHalfScalar(const float *src, void *dst, size_t n)
+      {
+        unsigned short *d = (unsigned short *)dst;
+        for(size_t i = 0; i < n; ++i)
+          d[i] = floatToHalf(src[i]);
+      }
+
+      static void floatFromFloat(const float *src, void *dst, size_t n)
+      {
+        memcpy(dst, src, n * sizeof(float));
+      }
+
+      static void premultiplyScalar(float *rgba, size_t n)
+      {
+        for(size_t i = 0; i < n; ++i, rgba += 4) {
+          rgba[0] *= rgba[3];
+          rgba[1] *= rgba[3];
+          rgba[2] *= rgba[3];
+        }
+      }
+
+      static void unpremultiplyScalar(float *rgba, size_t n)
+      {
+        for(size_t i = 0; i < n; ++i, rgba += 4) {
+          // a NaN alpha is not zero, as the SIMD compares have it
+          if(rgba[3] != 0.0f) {
+            rgba[0] /= rgba[3];
+            rgba[1] /= rgba[3];
+            rgba[2] /= rgba[3];
+          }
+        }
+      }
+
+      /// converts n components of some depth to float
+      typedef void (*ToFloatFunc)(const void *src, float *dst, size_t n);
+
+      /// converts n float components to some depth
+      typedef void (*FromFloatFunc)(const float *src, void *dst, size_t n);
+
+      /// changes the premultiplication of n float RGBA pixels in place
+      typedef void (*PreMultFunc)(float *rgba, size_t n);
+
+      /// the kernels for one instruction set, the conversions indexed by Depth
+      struct Kernels {
+        ToFloatFunc   toFloat[5];
+        FromFloatFunc fromFloat[5];
+        PreMultFunc   premultiply;
+        PreMultFunc   unpremultiply;
+      };
+
+      static const Kernels gScalarKernels = {
+        { 0, byteToFloatScalar, shortToFloatScalar, halfToFloatScalar, floatToFloat },
+        { 0, floatToByteScalar, floatToShortScalar, floatToHalfScalar, floatFromFloat },
+        premultiplyScalar,
+        unpremultiplyScalar
+      };
+
+#ifdef OFXH_CONVERT_X86
+
+      ////////////////////////////////////////////////////////////////////////////////
+      // SSE2, halfs are left to the scalar code as there is no F16C
+
+      OFXH_TARGET("sse2")
+      static void byteToFloatSSE2(const void *src, float *dst, size_t n)
+      {
+        const unsigned char *s = (const unsigned char *)src;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 scale = _mm_set1_ps(255.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+          __m128i b = _mm_loadu_si128((const __m128i *)(s + i));
+          __m128i lo = _mm_unpacklo_epi8(b, zero);
+          __m128i hi = _mm_unpackhi_epi8(b, zero);
+          _mm_storeu_ps(dst + i,      _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+          _mm_storeu_ps(dst + i + 4,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+          _mm_storeu_ps(dst + i + 8,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+          _mm_storeu_ps(dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+        }
+        byteToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      OFXH_TARGET("sse2")
+      static void shortToFloatSSE2(const void *src, float *dst, size_t n)
+      {
+        const unsigned short *s = (const unsigned short *)src;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 scale = _mm_set1_ps(65535.0f);
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+          __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+          _mm_storeu_ps(dst + i,     _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale));
+          _mm_storeu_ps(dst + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale));
+        }
+        shortToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      /// clamp to 0..1, scale and round to nearest even
+      OFXH_TARGET("sse2")
+      static inline __m128i scaleSSE2(const float *src, __m128 scale)
+      {
+        __m128 v = _mm_max_ps(_mm_loadu_ps(src), _mm_setzero_ps());
+        v = _mm_min_ps(v, _mm_set1_ps(1.0f));
+        return _mm_cvtps_epi32(_mm_mul_ps(v, scale));
+      }
+
+      OFXH_TARGET("sse2")
+      static void floatToByteSSE2(const float *src, void *dst, size_t n)
+      {
+        unsigned char *d = (unsigned char *)dst;
+        const __m128 scale = _mm_set1_ps(255.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+          __m128i a = _mm_packs_epi32(scaleSSE2(src + i, scale), scaleSSE2(src + i + 4, scale));
+          __m128i b = _mm_packs_epi32(scaleSSE2(src + i + 8, scale), scaleSSE2(src + i + 12, scale));
+          _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(a, b));
+        }
+        floatToByteScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("sse2")
+      static void floatToShortSSE2(const float *src, void *dst, size_t n)
+      {
+        unsigned short *d = (unsigned short *)dst;
+        const __m128 scale = _mm_set1_ps(65535.0f);
+        // there is no unsigned 32 to 16 bit pack before SSE4.1, so pack signed and flip the top bit
+        const __m128i bias = _mm_set1_epi32(32768);
+        const __m128i flip = _mm_set1_epi16(short(0x8000));
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+          __m128i a = _mm_sub_epi32(scaleSSE2(src + i, scale), bias);
+          __m128i b = _mm_sub_epi32(scaleSSE2(src + i + 4, scale), bias);
+          _mm_storeu_si128((__m128i *)(d + i), _mm_xor_si128(_mm_packs_epi32(a, b), flip));
+        }
+        floatToShortScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("sse2")
+      static void premultiplySSE2(float *rgba, size_t n)
+      {
+        const __m128 alphaLane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+        for(size_t i = 0; i < n; ++i, rgba += 4) {
+          __m128 p = _mm_loadu_ps(rgba);
+          __m128 a = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+          __m128 q = _mm_mul_ps(p, a);
+          _mm_storeu_ps(rgba, _mm_or_ps(_mm_andnot_ps(alphaLane, q), _mm_and_ps(alphaLane, p)));
+        }
+      }
+
+      OFXH_TARGET("sse2")
+      static void unpremultiplySSE2(float *rgba, size_t n)
+      {
+        const __m128 alphaLane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+        for(size_t i = 0; i < n; ++i, rgba += 4) {
+          __m128 p = _mm_loadu_ps(rgba);
+          __m128 a = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+          // keep the colour where alpha is zero, and the alpha everywhere
+          __m128 keep = _mm_or_ps(_mm_cmpeq_ps(a, _mm_setzero_ps()), alphaLane);
+          __m128 q = _mm_div_ps(p, a);
+          _mm_storeu_ps(rgba, _mm_or_ps(_mm_andnot_ps(keep, q), _mm_and_ps(keep, p)));
+        }
+      }
+
+      static const Kernels gSSE2Kernels = {
+        { 0, byteToFloatSSE2, shortToFloatSSE2, halfToFloatScalar, floatToFloat },
+        { 0, floatToByteSSE2, floatToShortSSE2, floatToHalfScalar, floatFromFloat },
+        premultiplySSE2,
+        unpremultiplySSE2
+      };
+
+      ////////////////////////////////////////////////////////////////////////////////
+      // AVX2 and F16C
+
+      OFXH_TARGET("avx2")
+      static void byteToFloatAVX2(const void *src, float *dst, size_t n)
+      {
+        const unsigned char *s = (const unsigned char *)src;
+        const __m256 scale = _mm256_set1_ps(255.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+          __m128i b = _mm_loadu_si128((const __m128i *)(s + i));
+          _mm256_storeu_ps(dst + i,     _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)), scale));
+          _mm256_storeu_ps(dst + i + 8, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b, 8))), scale));
+        }
+        byteToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      OFXH_TARGET("avx2")
+      static void shortToFloatAVX2(const void *src, float *dst, size_t n)
+      {
+        const unsigned short *s = (const unsigned short *)src;
+        const __m256 scale = _mm256_set1_ps(65535.0f);
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+          __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+          _mm256_storeu_ps(dst + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v)), scale));
+        }
+        shortToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      OFXH_TARGET("avx2,f16c")
+      static void halfToFloatAVX2(const void *src, float *dst, size_t n)
+      {
+        const unsigned short *s = (const unsigned short *)src;
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8)
+          _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(s + i))));
+        halfToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      /// clamp to 0..1, scale and round to nearest even
+      OFXH_TARGET("avx2")
+      static inline __m256i scaleAVX2(const float *src, __m256 scale)
+      {
+        __m256 v = _mm256_max_ps(_mm256_loadu_ps(src), _mm256_setzero_ps());
+        v = _mm256_min_ps(v, _mm256_set1_ps(1.0f));
+        return _mm256_cvtps_epi32(_mm256_mul_ps(v, scale));
+      }
+
+      OFXH_TARGET("avx2")
+      static void floatToByteAVX2(const float *src, void *dst, size_t n)
+      {
+        unsigned char *d = (unsigned char *)dst;
+        const __m256 scale = _mm256_set1_ps(255.0f);
+        // the packs work within 128 bit lanes, this puts the 32 bit groups back in order
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        size_t i = 0;
+        for(; i + 32 <= n; i += 32) {
+          __m256i a = _mm256_packs_epi32(scaleAVX2(src + i, scale), scaleAVX2(src + i + 8, scale));
+          __m256i b = _mm256_packs_epi32(scaleAVX2(src + i + 16, scale), scaleAVX2(src + i + 24, scale));
+          _mm256_storeu_si256((__m256i *)(d + i), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(a, b), order));
+        }
+        floatToByteScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("avx2")
+      static void floatToShortAVX2(const float *src, void *dst, size_t n)
+      {
+        unsigned short *d = (unsigned short *)dst;
+        const __m256 scale = _mm256_set1_ps(65535.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+          __m256i v = _mm256_packus_epi32(scaleAVX2(src + i, scale), scaleAVX2(src + i + 8, scale));
+          _mm256_storeu_si256((__m256i *)(d + i), _mm256_permute4x64_epi64(v, 0xd8));
+        }
+        floatToShortScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("avx2,f16c")
+      static void floatToHalfAVX2(const float *src, void *dst, size_t n)
+      {
+        unsigned short *d = (unsigned short *)dst;
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8)
+          _mm_storeu_si128((__m128i *)(d + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+        floatToHalfScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("avx2")
+      static void premultiplyAVX2(float *rgba, size_t n)
+      {
+        size_t i = 0;
+        for(; i + 2 <= n; i += 2, rgba += 8) {
+          __m256 p = _mm256_loadu_ps(rgba);
+          __m256 a = _mm256_permute_ps(p, _MM_SHUFFLE(3, 3, 3, 3));
+          _mm256_storeu_ps(rgba, _mm256_blend_ps(_mm256_mul_ps(p, a), p, 0x88));
+        }
+        premultiplyScalar(rgba, n - i);
+      }
+
+      OFXH_TARGET("avx2")
+      static void unpremultiplyAVX2(float *rgba, size_t n)
+      {
+        size_t i = 0;
+        for(; i + 2 <= n; i += 2, rgba += 8) {
+          __m256 p = _mm256_loadu_ps(rgba);
+          __m256 a = _mm256_permute_ps(p, _MM_SHUFFLE(3, 3, 3, 3));
+          __m256 q = _mm256_blendv_ps(_mm256_div_ps(p, a), p, _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_EQ_OQ));
+          _mm256_storeu_ps(rgba, _mm256_blend_ps(q, p, 0x88));
+        }
+        unpremultiplyScalar(rgba, n - i);
+      }
+
+      static const Kernels gAVX2Kernels = {
+        { 0, byteToFloatAVX2, shortToFloatAVX2, halfToFloatAVX2, floatToFloat },
+        { 0, floatToByteAVX2, floatToShortAVX2, floatToHalfAVX2, floatFromFloat },
+        premultiplyAVX2,
+        unpremultiplyAVX2
+      };
+
+      ////////////////////////////////////////////////////////////////////////////////
+      // AVX-512F
+      //
+      // GCC 12's unmasked AVX-512 intrinsics start from _mm512_undefined_*, which
+      // -Wmaybe-uninitialized reports when they are inlined into a target function. The
+      // zero masked forms with every lane set start from zero instead and do the same work.
+
+      /// every lane of a 16 lane vector
+      static const __mmask16 kAllLanes = 0xffff;
+
+
+      OFXH_TARGET("avx512f")
+      static void byteToFloatAVX512(const void *src, float *dst, size_t n)
+      {
+        const unsigned char *s = (const unsigned char *)src;
+        const __m512 scale = _mm512_set1_ps(255.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+          __m128i b = _mm_loadu_si128((const __m128i *)(s + i));
+          _mm512_storeu_ps(dst + i, _mm512_div_ps(_mm512_maskz_cvtepi32_ps(kAllLanes, _mm512_maskz_cvtepu8_epi32(kAllLanes, b)), scale));
+        }
+        byteToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      OFXH_TARGET("avx512f")
+      static void shortToFloatAVX512(const void *src, float *dst, size_t n)
+      {
+        const unsigned short *s = (const unsigned short *)src;
+        const __m512 scale = _mm512_set1_ps(65535.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+          __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+          _mm512_storeu_ps(dst + i, _mm512_div_ps(_mm512_maskz_cvtepi32_ps(kAllLanes, _mm512_maskz_cvtepu16_epi32(kAllLanes, v)), scale));
+        }
+        shortToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      OFXH_TARGET("avx512f")
+      static void halfToFloatAVX512(const void *src, float *dst, size_t n)
+      {
+        const unsigned short *s = (const unsigned short *)src;
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16)
+          _mm512_storeu_ps(dst + i, _mm512_maskz_cvtph_ps(kAllLanes, _mm256_loadu_si256((const __m256i *)(s + i))));
+        halfToFloatScalar(s + i, dst + i, n - i);
+      }
+
+      /// clamp to 0..1, scale and round to nearest even
+      OFXH_TARGET("avx512f")
+      static inline __m512i scaleAVX512(const float *src, __m512 scale)
+      {
+        __m512 v = _mm512_maskz_max_ps(kAllLanes, _mm512_loadu_ps(src), _mm512_setzero_ps());
+        v = _mm512_maskz_min_ps(kAllLanes, v, _mm512_set1_ps(1.0f));
+        return _mm512_maskz_cvtps_epi32(kAllLanes, _mm512_mul_ps(v, scale));
+      }
+
+      OFXH_TARGET("avx512f")
+      static void floatToByteAVX512(const float *src, void *dst, size_t n)
+      {
+        unsigned char *d = (unsigned char *)dst;
+        const __m512 scale = _mm512_set1_ps(255.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16)
+          _mm_storeu_si128((__m128i *)(d + i), _mm512_maskz_cvtusepi32_epi8(kAllLanes, scaleAVX512(src + i, scale)));
+        floatToByteScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("avx512f")
+      static void floatToShortAVX512(const float *src, void *dst, size_t n)
+      {
+        unsigned short *d = (unsigned short *)dst;
+        const __m512 scale = _mm512_set1_ps(65535.0f);
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16)
+          _mm256_storeu_si256((__m256i *)(d + i), _mm512_maskz_cvtusepi32_epi16(kAllLanes, scaleAVX512(src + i, scale)));
+        floatToShortScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("avx512f")
+      static void floatToHalfAVX512(const float *src, void *dst, size_t n)
+      {
+        unsigned short *d = (unsigned short *)dst;
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16)
+          _mm256_storeu_si256((__m256i *)(d + i), _mm512_maskz_cvtps_ph(kAllLanes, _mm512_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+        floatToHalfScalar(src + i, d + i, n - i);
+      }
+
+      OFXH_TARGET("avx512f")
+      static void premultiplyAVX512(float *rgba, size_t n)
+      {
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4, rgba += 16) {
+          __m512 p = _mm512_loadu_ps(rgba);
+          __m512 a = _mm512_maskz_permute_ps(kAllLanes, p, _MM_SHUFFLE(3, 3, 3, 3));
+          _mm512_storeu_ps(rgba, _mm512_mask_mul_ps(p, 0x7777, p, a));
+        }
+        premultiplyScalar(rgba, n - i);
+      }
+
+      OFXH_TARGET("avx512f")
+      static void unpremultiplyAVX512(float *rgba, size_t n)
+      {
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4, rgba += 16) {
+          __m512 p = _mm512_loadu_ps(rgba);
+          __m512 a = _mm512_maskz_permute_ps(kAllLanes, p, _MM_SHUFFLE(3, 3, 3, 3));
+          __mmask16 colour = 0x7777 & _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+          _mm512_storeu_ps(rgba, _mm512_mask_div_ps(p, colour, p, a));
+        }
+        unpremultiplyScalar(rgba, n - i);
+      }
+
+      static const Kernels gAVX512Kernels = {
+        { 0, byteToFloatAVX512, shortToFloatAVX512, halfToFloatAVX512, floatToFloat },
+        { 0, floatToByteAVX512, floatToShortAVX512, floatToHalfAVX512, floatFromFloat },
+        premultiplyAVX512,
+        unpremultiplyAVX512
+      };
+
+      /// what the CPU and OS support
+      static InstructionSet detectInstructionSet()
+      {
+#  if defined(__GNUC__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f"))
+          return eInstructionSetAVX512;
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+          return eInstructionSetAVX2;
+        if(__builtin_cpu_supports("sse2"))
+          return eInstructionSetSSE2;
+#  else
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        bool sse2 = (info[3] & (1 << 26)) != 0;
+        bool f16c = (info[2] & (1 << 29)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        if(maxLeaf >= 7 && (xcr0 & 0x6) == 0x6) {
+          __cpuidex(info, 7, 0);
+          if((info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6)
+            return eInstructionSetAVX512;
+          if((info[1] & (1 << 5)) && f16c)
+            return eInstructionSetAVX2;
+        }
+        if(sse2)
+          return eInstructionSetSSE2;
+#  endif
+        return eInstructionSetScalar;
+      }
+
+#else
+
+      static InstructionSet detectInstructionSet()
+      {
+        return eInstructionSetScalar;
+      }
+
+#endif
+
+      InstructionSet getBestInstructionSet()
+      {
+        static const InstructionSet gBest = detectInstructionSet();
+        return gBest;
+      }
+
+      /// the instruction set in use, -1 until it is first asked for
+      static std::atomic<int> gInstructionSet(-1);
+
+      InstructionSet getInstructionSet()
+      {
+        int set = gInstructionSet.load(std::memory_order_relaxed);
+        if(set < 0) {
+          set = getBestInstructionSet();
+          gInstructionSet.store(set, std::memory_order_relaxed);
+        }
+        return InstructionSet(set);
+      }
+
+      void setInstructionSet(InstructionSet set)
+      {
+        gInstructionSet.store(Minimum(set, getBestInstructionSet()), std::memory_order_relaxed);
+      }
+
+      static const Kernels &getKernels()
+      {
+        switch(getInstructionSet()) {
+#ifdef OFXH_CONVERT_X86
+        case eInstructionSetAVX512 : return gAVX512Kernels;
+        case eInstructionSetAVX2   : return gAVX2Kernels;
+        case eInstructionSetSSE2   : return gSSE2Kernels;
+#endif
+        default                    : return gScalarKernels;
+        }
+      }
+
+      Depth mapDepth(const std::string &depth)
+      {
+        if(depth == kOfxBitDepthByte)
+          return eDepthByte;
+        if(depth == kOfxBitDepthShort)
+          return eDepthShort;
+        if(depth == kOfxBitDepthHalf)
+          return eDepthHalf;
+        if(depth == kOfxBitDepthFloat)
+          return eDepthFloat;
+        return eDepthNone;
+      }
+
+      Components mapComponents(const std::string &components)
+      {
+        if(components == kOfxImageComponentRGBA)
+          return eComponentsRGBA;
+        if(components == kOfxImageComponentRGB)
+          return eComponentsRGB;
+        if(components == kOfxImageComponentAlpha)
+          return eComponentsAlpha;
+        if(components == kOfxImageComponentYUVA)
+          return eComponentsYUVA;
+        return eComponentsNone;
+      }
+
+      PreMultiplication mapPreMultiplication(const std::string &preMultiplication)
+      {
+        if(preMultiplication == kOfxImagePreMultiplied)
+          return eImagePreMultiplied;
+        if(preMultiplication == kOfxImageUnPreMultiplied)
+          return eImageUnPreMultiplied;
+        return eImageOpaque;
+      }
+
+      int getComponentBytes(Depth depth)
+      {
+        switch(depth) {
+        case eDepthByte  : return 1;
+        case eDepthShort : return 2;
+        case eDepthHalf  : return 2;
+        case eDepthFloat : return 4;
+        default          : return 0;
+        }
+      }
+
+      int getComponentCount(Components components)
+      {
+        switch(components) {
+        case eComponentsRGBA  : return 4;
+        case eComponentsRGB   : return 3;
+        case eComponentsAlpha : return 1;
+        case eComponentsYUVA  : return 4;
+        default               : return 0;
+        }
+      }
+
+      Buffer getBuffer(const ImageEffect::Image &image)
+      {
+        Buffer buffer;
+        buffer.data = image.getPointerProperty(kOfxImagePropData);
+        buffer.bounds = image.getBounds();
+        buffer.rowBytes = image.getIntProperty(kOfxImagePropRowBytes);
+        buffer.depth = mapDepth(image.getStringProperty(kOfxImageEffectPropPixelDepth));
+        buffer.components = mapComponents(image.getStringProperty(kOfxImageEffectPropComponents));
+        buffer.preMultiplication = mapPreMultiplication(image.getStringProperty(kOfxImageEffectPropPreMultiplication));
+        return buffer;
+      }
+
+      /// converts with the given kernels, n components
+      static void convertComponents(const Kernels &kernels, const void *src, Depth srcDepth, void *dst, Depth dstDepth, size_t n)
+      {
+        if(srcDepth == dstDepth) {
+          memcpy(dst, src, n * getComponentBytes(srcDepth));
+        }
+        else if(srcDepth == eDepthFloat) {
+          kernels.fromFloat[dstDepth]((const float *)src, dst, n);
+        }
+        else if(dstDepth == eDepthFloat) {
+          kernels.toFloat[srcDepth](src, (float *)dst, n);
+        }
+        else {
+          // through float a chunk at a time, so it stays in the cache
+          float scratch[kChunkPixels * 4];
+          const size_t srcBytes = getComponentBytes(srcDepth);
+          const size_t dstBytes = getComponentBytes(dstDepth);
+          for(size_t i = 0; i < n; i += kChunkPixels * 4) {
+            size_t count = Minimum(n - i, size_t(kChunkPixels * 4));
+            kernels.toFloat[srcDepth]((const char *)src + i * srcBytes, scratch, count);
+            kernels.fromFloat[dstDepth](scratch, (char *)dst + i * dstBytes, count);
+          }
+        }
+      }
+
+      void convertComponents(const void *src, Depth srcDepth, void *dst, Depth dstDepth, size_t n)
+      {
+        convertComponents(getKernels(), src, srcDepth, dst, dstDepth, n);
+      }
+
+      void premultiply(float *rgba, size_t n)
+      {
+        getKernels().premultiply(rgba, n);
+      }
+
+      void unpremultiply(float *rgba, size_t n)
+      {
+        getKernels().unpremultiply(rgba, n);
+      }
+
+      /// rearrange n float pixels from one set of components to another
+      static void remapComponents(const float *src, Components srcComponents, float *dst, Components dstComponents, size_t n)
+      {
+        if(srcComponents == eComponentsRGBA && dstComponents == eComponentsRGB) {
+          for(size_t i = 0; i < n; ++i, src += 4, dst += 3) {
+            dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2];
+          }
+        }
+        else if(srcComponents == eComponentsRGBA && dstComponents == eComponentsAlpha) {
+          for(size_t i = 0; i < n; ++i)
+            dst[i] = src[i * 4 + 3];
+        }
+        else if(srcComponents == eComponentsRGB && dstComponents == eComponentsRGBA) {
+          for(size_t i = 0; i < n; ++i, src += 3, dst += 4) {
+            dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 1.0f;
+          }
+        }
+        else if(srcComponents == eComponentsRGB && dstComponents == eComponentsAlpha) {
+          for(size_t i = 0; i < n; ++i)
+            dst[i] = 1.0f;
+        }
+        else if(srcComponents == eComponentsAlpha && dstComponents == eComponentsRGBA) {
+          for(size_t i = 0; i < n; ++i, dst += 4)
+            dst[0] = dst[1] = dst[2] = dst[3] = src[i];
+        }
+        else if(srcComponents == eComponentsAlpha && dstComponents == eComponentsRGB) {
+          for(size_t i = 0; i < n; ++i, dst += 3)
+            dst[0] = dst[1] = dst[2] = src[i];
+        }
+      }
+
+      /// can we convert between the two
+      static bool canRemap(Components srcComponents, Components dstComponents)
+      {
+        if(srcComponents == eComponentsNone || dstComponents == eComponentsNone)
+          return false;
+        if(srcComponents == dstComponents)
+          return true;
+        return srcComponents != eComponentsYUVA && dstComponents != eComponentsYUVA;
+      }
+
+      /// how the premultiplication changes
+      enum PreMultChange {
+        eKeepPreMult,
+        ePremultiply,
+        eUnpremultiply
+      };
+
+      /// what to do to the source's colour to get the destination's premultiplication
+      static PreMultChange getPreMultChange(const Buffer &src, const Buffer &dst)
+      {
+        // no colour to change, or no alpha to change it by
+        if(src.components != eComponentsRGBA || dst.components == eComponentsAlpha)
+          return eKeepPreMult;
+        if(src.preMultiplication == eImagePreMultiplied && dst.preMultiplication == eImageUnPreMultiplied)
+          return eUnpremultiply;
+        if(src.preMultiplication == eImageUnPreMultiplied && dst.preMultiplication == eImagePreMultiplied)
+          return ePremultiply;
+        return eKeepPreMult;
+      }
+
+      /// a conversion, shared by all the threads doing it
+      struct Conversion {
+        const Kernels *kernels;
+        Buffer         src;
+        Buffer         dst;
+        OfxRectI       window;
+        PreMultChange  preMultChange;
+      };
+
+      /// address of pixel x, y in a buffer
+      static inline char *pixelAddress(const Buffer &buffer, int x, int y)
+      {
+        int pixelBytes = getComponentBytes(buffer.depth) * getComponentCount(buffer.components);
+        return (char *)buffer.data + ptrdiff_t(y - buffer.bounds.y1) * buffer.rowBytes + ptrdiff_t(x - buffer.bounds.x1) * pixelBytes;
+      }
+
+      /// convert rows y1 to y2 of the window
+      static void convertRows(const Conversion &conversion, int y1, int y2)
+      {
+        const Kernels &kernels = *conversion.kernels;
+        const Buffer &src = conversion.src;
+        const Buffer &dst = conversion.dst;
+        const int x1 = conversion.window.x1;
+        const size_t width = conversion.window.x2 - conversion.window.x1;
+
+        if(src.components == dst.components && conversion.preMultChange == eKeepPreMult) {
+          size_t n = width * getComponentCount(src.components);
+          for(int y = y1; y < y2; ++y)
+            convertComponents(kernels, pixelAddress(src, x1, y), src.depth, pixelAddress(dst, x1, y), dst.depth, n);
+          return;
+        }
+
+        // a chunk of pixels at a time, to float, to the new premultiplication and
+        // components, to the new depth
+        float srcScratch[kChunkPixels * 4];
+        float dstScratch[kChunkPixels * 4];
+        const int srcCount = getComponentCount(src.components);
+        const int dstCount = getComponentCount(dst.components);
+        const size_t srcPixelBytes = srcCount * getComponentBytes(src.depth);
+        const size_t dstPixelBytes = dstCount * getComponentBytes(dst.depth);
+
+        for(int y = y1; y < y2; ++y) {
+          const char *srcRow = pixelAddress(src, x1, y);
+          char *dstRow = pixelAddress(dst, x1, y);
+          for(size_t x = 0; x < width; x += kChunkPixels) {
+            size_t count = Minimum(width - x, size_t(kChunkPixels));
+            const char *s = srcRow + x * srcPixelBytes;
+            char *d = dstRow + x * dstPixelBytes;
+
+            // float sources are only copied if their premultiplication changes
+            const float *from = (const float *)s;
+            if(src.depth != eDepthFloat || conversion.preMultChange != eKeepPreMult) {
+              kernels.toFloat[src.depth](s, srcScratch, count * srcCount);
+              from = srcScratch;
+            }
+
+            if(conversion.preMultChange == ePremultiply)
+              kernels.premultiply(srcScratch, count);
+            else if(conversion.preMultChange == eUnpremultiply)
+              kernels.unpremultiply(srcScratch, count);
+
+            if(src.components != dst.components) {
+              float *to = dst.depth == eDepthFloat ? (float *)d : dstScratch;
+              remapComponents(from, src.components, to, dst.components, count);
+              if(dst.depth != eDepthFloat)
+                kernels.fromFloat[dst.depth](dstScratch, d, count * dstCount);
+            }
+            else
+              kernels.fromFloat[dst.depth](from, d, count * dstCount);
+          }
+        }
+      }
+
+      /// thread function, each thread takes an even share of the rows
+      static void convertThread(unsigned int threadIndex, unsigned int threadMax, void *customArg)
+      {
+        const Conversion &conversion = *(const Conversion *)customArg;
+        int rows = conversion.window.y2 - conversion.window.y1;
+        int y1 = conversion.window.y1 + int((long long)rows * threadIndex / threadMax);
+        int y2 = conversion.window.y1 + int((long long)rows * (threadIndex + 1) / threadMax);
+        convertRows(conversion, y1, y2);
+      }
+
+      OfxStatus convert(const Buffer &src,
+                        const Buffer &dst,
+                        const OfxRectI &window,
+                        MultiThread::ThreadPool *pool)
+      {
+        if(src.depth == eDepthNone || dst.depth == eDepthNone || !canRemap(src.components, dst.components))
+          return kOfxStatErrUnsupported;
+
+        Conversion conversion;
+        conversion.kernels = &getKernels();
+        conversion.src = src;
+        conversion.dst = dst;
+        conversion.window.x1 = Maximum(window.x1, Maximum(src.bounds.x1, dst.bounds.x1));
+        conversion.window.y1 = Maximum(window.y1, Maximum(src.bounds.y1, dst.bounds.y1));
+        conversion.window.x2 = Minimum(window.x2, Minimum(src.bounds.x2, dst.bounds.x2));
+        conversion.window.y2 = Minimum(window.y2, Minimum(src.bounds.y2, dst.bounds.y2));
+        conversion.preMultChange = getPreMultChange(src, dst);
+
+        int width = conversion.window.x2 - conversion.window.x1;
+        int rows = conversion.window.y2 - conversion.window.y1;
+        if(width <= 0 || rows <= 0)
+          return kOfxStatOK;
+
+        if(!pool)
+          pool = &MultiThread::ThreadPool::getDefault();
+
+        long long nJobs = (long long)width * rows / kMinPixelsPerJob;
+        nJobs = Minimum(nJobs, (long long)rows);
+        nJobs = Minimum(nJobs, (long long)pool->getNumCPUs());
+
+        if(nJobs <= 1)
+          convertRows(conversion, conversion.window.y1, conversion.window.y2);
+        else
+          pool->multiThreadHost(convertThread, (unsigned int)nJobs, &conversion);
+
+        return kOfxStatOK;
+      }
+
+      OfxStatus convert(const ImageEffect::Image &src,
+                        ImageEffect::Image &dst,
+                        const OfxRectI *window,
+                        MultiThread::ThreadPool *pool)
+      {
+        Buffer srcBuffer = getBuffer(src);
+        Buffer dstBuffer = getBuffer(dst);
+        return convert(srcBuffer, dstBuffer, window ? *window : dstBuffer.bounds, pool);
+      }
+
+    } // namespace PixelConvert
+
+  } // namespace Host
+
+} // namespace OFX
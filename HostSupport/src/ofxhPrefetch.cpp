@@ -0,0 +1,420 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <vector>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhParam.h"
+#include "ofxhImageEffect.h"
+#include "ofxhUtilities.h"
+#include "ofxhPrefetch.h"
+#include "ofxhMemoryGovernor.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      /// most frames of any one frame range we prefetch
+      static const int kMaxFramesPerRange = 64;
+
+      /// intersection of two canonical rects, x1 > x2 or y1 > y2 if they don't overlap
+      static OfxRectD intersectRect(const OfxRectD &a, const OfxRectD &b)
+      {
+        OfxRectD r;
+        r.x1 = Maximum(a.x1, b.x1);
+        r.y1 = Maximum(a.y1, b.y1);
+        r.x2 = Minimum(a.x2, b.x2);
+        r.y2 = Minimum(a.y2, b.y2);
+        return r;
+      }
+
+      /// union of two canonical rects
+      static OfxRectD unionRect(const OfxRectD &a, const OfxRectD &b)
+      {
+        OfxRectD r;
+        r.x1 = Minimum(a.x1, b.x1);
+        r.y1 = Minimum(a.y1, b.y1);
+        r.x2 = Maximum(a.x2, b.x2);
+        r.y2 = Maximum(a.y2, b.y2);
+        return r;
+      }
+
+      /// does outer cover all of inner, an empty inner is covered by anything
+      static bool containsRect(const OfxRectD &outer, const OfxRectD &inner)
+      {
+        if(inner.x1 >= inner.x2 || inner.y1 >= inner.y2)
+          return true;
+        return outer.x1 <= inner.x1 && outer.y1 <= inner.y1 && outer.x2 >= inner.x2 && outer.y2 >= inner.y2;
+      }
+
+      /// how many bytes an image's pixels take up
+      static size_t imageBytes(Image *image)
+      {
+        int rowBytes = image->getIntProperty(kOfxImagePropRowBytes);
+        int height = image->getIntProperty(kOfxImagePropBounds, 3) - image->getIntProperty(kOfxImagePropBounds, 1);
+        if(rowBytes < 0)
+          rowBytes = -rowBytes;
+        return height > 0 ? size_t(rowBytes) * size_t(height) : 0;
+      }
+
+      InputPrefetcher::InputPrefetcher(Instance &instance, unsigned int lookAhead)
+        : Memory::Purgeable(ePurgePrefetched)
+        , _instance(instance)
+        , _lookAhead(lookAhead)
+        , _generation(0)
+        , _stop(false)
+        , _requestStep(0)
+      {
+        _requestScale.x = _requestScale.y = 0;
+        _requestWindow.x1 = _requestWindow.y1 = _requestWindow.x2 = _requestWindow.y2 = 0;
+        _thread = std::thread(&InputPrefetcher::threadMain, this);
+        _instance.setInputPrefetcher(this);
+        Memory::Governor::get().add(this);
+      }
+
+      InputPrefetcher::~InputPrefetcher()
+      {
+        Memory::Governor::get().remove(this);
+
+        if(_instance.getInputPrefetcher() == this)
+          _instance.setInputPrefetcher(0);
+
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          _stop = true;
+        }
+        _wake.notify_all();
+        _thread.join();
+
+        for(std::map<Key, Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it)
+          release(it->second);
+      }
+
+      void InputPrefetcher::setLookAhead(unsigned int n)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _lookAhead = n;
+      }
+
+      void InputPrefetcher::threadMain()
+      {
+        std::unique_lock<std::mutex> guard(_lock);
+        for(;;) {
+          while(!_stop && _queue.empty())
+            _wake.wait(guard);
+          if(_stop)
+            return;
+
+          Key key = _queue.front();
+          _queue.pop_front();
+
+          // it may have been evicted, or taken by a render thread that couldn't wait
+          std::map<Key, Entry>::iterator it = _entries.find(key);
+          if(it == _entries.end() || !it->second.pending || it->second.fetching)
+            continue;
+
+          fetch(guard, key);
+
+          // what we just fetched may have taken us over budget
+          guard.unlock();
+          Memory::Governor::get().enforce();
+          guard.lock();
+        }
+      }
+
+      /// fetch a pending entry's image, called and returns with the lock held
+      void InputPrefetcher::fetch(std::unique_lock<std::mutex> &guard, const Key &key)
+      {
+        Entry &entry = _entries[key];
+        entry.fetching = true;
+        OfxRectD bounds = entry.bounds;
+
+        guard.unlock();
+        Image *image = 0;
+        try {
+          image = key.clip->getImage(key.time, &bounds);
+        }
+        catch(...) {
+          image = 0;
+        }
+        guard.lock();
+
+        // entries are never erased while they are being fetched
+        std::map<Key, Entry>::iterator it = _entries.find(key);
+        Entry &fetched = it->second;
+        fetched.fetching = false;
+
+        if(fetched.generation != _generation) {
+          // no longer wanted
+          if(image)
+            image->releaseReference();
+          _entries.erase(it);
+        }
+        else if(image && !containsRect(bounds, fetched.bounds)) {
+          // someone asked for more of it meanwhile, go round again
+          image->releaseReference();
+          _queue.push_front(key);
+          _wake.notify_one();
+        }
+        else {
+          // a failed fetch is remembered as a NULL image, the plugin's own fetch will retry it
+          fetched.image = image;
+          fetched.pending = false;
+          if(image) {
+            fetched.bytes = imageBytes(image);
+            Memory::Governor::get().allocated(fetched.bytes);
+          }
+        }
+
+        _fetched.notify_all();
+      }
+
+      void InputPrefetcher::want(ClipInstance *clip, OfxTime time, const OfxRectD &bounds)
+      {
+        Key key = { clip, time };
+        std::map<Key, Entry>::iterator it = _entries.find(key);
+
+        if(it == _entries.end()) {
+          Entry entry = { 0, bounds, true, false, _generation, 0 };
+          _entries[key] = entry;
+          _queue.push_back(key);
+          return;
+        }
+
+        Entry &entry = it->second;
+        entry.generation = _generation;
+        if(containsRect(entry.bounds, bounds))
+          return;
+
+        entry.bounds = unionRect(entry.bounds, bounds);
+        if(!entry.pending) {
+          // fetched, but not enough of it
+          release(entry);
+          entry.pending = true;
+          _queue.push_back(key);
+        }
+        // otherwise the fetch in flight will notice it is short and requeue
+      }
+
+      void InputPrefetcher::evict()
+      {
+        std::map<Key, Entry>::iterator it = _entries.begin();
+        while(it != _entries.end()) {
+          // ones being fetched are dropped when they land
+          if(it->second.generation != _generation && !it->second.fetching) {
+            release(it->second);
+            _entries.erase(it++);
+          }
+          else
+            ++it;
+        }
+      }
+
+      void InputPrefetcher::release(Entry &entry)
+      {
+        if(entry.image) {
+          entry.image->releaseReference();
+          Memory::Governor::get().released(entry.bytes);
+        }
+        entry.image = 0;
+        entry.bytes = 0;
+      }
+
+      size_t InputPrefetcher::purge(size_t nBytes)
+      {
+        // the released counts are what the governor sees as freed
+        std::lock_guard<std::mutex> guard(_lock);
+        size_t freed = 0;
+        std::map<Key, Entry>::iterator it = _entries.begin();
+        while(it != _entries.end() && freed < nBytes) {
+          if(!it->second.pending && !it->second.fetching) {
+            freed += it->second.bytes;
+            release(it->second);
+            _entries.erase(it++);
+          }
+          else
+            ++it;
+        }
+        return 0;
+      }
+
+      void InputPrefetcher::frameRequests(OfxTime frame, OfxPointD renderScale, const OfxRectD &window, std::vector<Request> &requests)
+      {
+        // run the actions on this thread, they must not overlap the render action
+        RangeMap ranges;
+        OfxStatus st = _instance.getFrameNeededAction(frame, ranges);
+        if(st != kOfxStatOK && st != kOfxStatReplyDefault)
+          return;
+
+        std::map<ClipInstance *, OfxRectD> rois;
+        st = _instance.getRegionOfInterestAction(frame, renderScale, window, rois);
+        if(st != kOfxStatOK && st != kOfxStatReplyDefault)
+          return;
+
+        for(RangeMap::iterator it = ranges.begin(); it != ranges.end(); ++it) {
+          ClipInstance *clip = it->first;
+          if(clip->isOutput() || !clip->getConnected())
+            continue;
+
+          std::map<ClipInstance *, OfxRectD>::iterator roi = rois.find(clip);
+
+          for(size_t r = 0; r < it->second.size(); ++r) {
+            const OfxRangeD &range = it->second[r];
+            int n = 0;
+            for(OfxTime t = range.min; t <= range.max && n < kMaxFramesPerRange; t += 1, ++n) {
+              OfxRectD rod = clip->getRegionOfDefinition(t);
+              Request request = { clip, t, roi != rois.end() ? intersectRect(roi->second, rod) : rod };
+              requests.push_back(request);
+            }
+          }
+        }
+      }
+
+      void InputPrefetcher::prefetch(OfxTime time,
+                                     OfxTime last,
+                                     OfxTime step,
+                                     OfxPointD renderScale,
+                                     const OfxRectI &renderWindow)
+      {
+        if(step == 0)
+          step = 1;
+
+        unsigned int lookAhead;
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          lookAhead = _lookAhead;
+        }
+
+        // the render window in canonical coordinates
+        double par = _instance.getProjectPixelAspectRatio();
+        OfxRectD window;
+        window.x1 = renderWindow.x1 * par / renderScale.x;
+        window.y1 = renderWindow.y1 / renderScale.y;
+        window.x2 = renderWindow.x2 * par / renderScale.x;
+        window.y2 = renderWindow.y2 / renderScale.y;
+
+        // forget what was asked for if it was asked under different conditions
+        if(renderScale.x != _requestScale.x || renderScale.y != _requestScale.y ||
+           renderWindow.x1 != _requestWindow.x1 || renderWindow.y1 != _requestWindow.y1 ||
+           renderWindow.x2 != _requestWindow.x2 || renderWindow.y2 != _requestWindow.y2 ||
+           step != _requestStep) {
+          _frameRequests.clear();
+          _requestScale = renderScale;
+          _requestWindow = renderWindow;
+          _requestStep = step;
+        }
+
+        // keep the frames still in the window, running the actions only for ones new to it,
+        // normally just the one entering at the far end
+        std::map<OfxTime, std::vector<Request> > frames;
+        for(unsigned int i = 0; i <= lookAhead; ++i) {
+          OfxTime frame = time + i * step;
+          if(step > 0 ? frame > last : frame < last)
+            break;
+
+          std::vector<Request> &requests = frames[frame];
+          std::map<OfxTime, std::vector<Request> >::iterator known = _frameRequests.find(frame);
+          if(known != _frameRequests.end())
+            requests.swap(known->second);
+          else
+            frameRequests(frame, renderScale, window, requests);
+        }
+        _frameRequests.swap(frames);
+
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          ++_generation;
+          for(std::map<OfxTime, std::vector<Request> >::iterator it = _frameRequests.begin(); it != _frameRequests.end(); ++it) {
+            const std::vector<Request> &requests = it->second;
+            for(size_t i = 0; i < requests.size(); ++i)
+              want(requests[i].clip, requests[i].time, requests[i].bounds);
+          }
+          evict();
+        }
+        _wake.notify_one();
+      }
+
+      Image *InputPrefetcher::getImage(ClipInstance *clip, OfxTime time, const OfxRectD *optionalBounds)
+      {
+        // no bounds means the region of interest, which is what we fetched
+        OfxRectD bounds = { 0, 0, 0, 0 };
+        if(optionalBounds)
+          bounds = intersectRect(*optionalBounds, clip->getRegionOfDefinition(time));
+
+        Key key = { clip, time };
+        std::unique_lock<std::mutex> guard(_lock);
+        for(;;) {
+          std::map<Key, Entry>::iterator it = _entries.find(key);
+          if(it == _entries.end())
+            return 0;
+
+          Entry &entry = it->second;
+          if(!entry.pending)
+            break;
+
+          // don't wait behind the rest of the queue for it
+          if(!entry.fetching)
+            fetch(guard, key);
+          else
+            _fetched.wait(guard);
+        }
+
+        Entry &entry = _entries[key];
+        if(!entry.image || !containsRect(entry.bounds, bounds))
+          return 0;
+
+        entry.image->addReference();
+        return entry.image;
+      }
+
+      void InputPrefetcher::clear()
+      {
+        _frameRequests.clear();
+
+        std::lock_guard<std::mutex> guard(_lock);
+        ++_generation;
+        _queue.clear();
+        evict();
+      }
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
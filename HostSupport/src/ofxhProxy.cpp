@@ -0,0 +1,636 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#  define OFXH_PROXY_SSE2
+#endif
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhUtilities.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhParam.h"
+#include "ofxhImageEffect.h"
+#include "ofxhMemory.h"
+#include "ofxhMultiThread.h"
+#include "ofxhPixelConvert.h"
+#include "ofxhProxy.h"
+#include "ofxhSpill.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+      /// most levels a pyramid has
+      static const int kMaxLevels = 16;
+
+      /// fewest pixels worth handing to another thread
+      static const int kMinPixelsPerJob = 64 * 1024;
+
+      /// scales this close are the same
+      static const double kScaleTolerance = 1e-6;
+
+      /// x / 2 rounded down
+      static inline int floorHalf(int x)
+      {
+        return x >= 0 ? x / 2 : -((1 - x) / 2);
+      }
+
+      /// x / 2 rounded up
+      static inline int ceilHalf(int x)
+      {
+        return -floorHalf(-x);
+      }
+
+      /// bytes an image's pixels take up
+      static size_t imageBytes(const Image &image)
+      {
+        OfxRectI bounds = image.getBounds();
+        int rowBytes = image.getIntProperty(kOfxImagePropRowBytes);
+        if(rowBytes < 0)
+          rowBytes = -rowBytes;
+        return bounds.y2 > bounds.y1 ? size_t(rowBytes) * size_t(bounds.y2 - bounds.y1) : 0;
+      }
+
+      /// An image made by filtering another, which owns its pixels.
+      class ProxyImage : public Image {
+      protected :
+        Memory::Instance _pixels;
+
+      public :
+        ProxyImage(ClipInstance &clip, const Image &from, OfxPointD renderScale, const OfxRectI &bounds, const OfxRectI &rod)
+          : Image(clip, renderScale.x, renderScale.y, 0, bounds, rod, 0,
+                  from.getStringProperty(kOfxImagePropField),
+                  from.getStringProperty(kOfxImagePropUniqueIdentifier))
+        {
+          // the pixels are as the source's, which may not be as the clip's now
+          setStringProperty(kOfxImageEffectPropPixelDepth, from.getStringProperty(kOfxImageEffectPropPixelDepth));
+          setStringProperty(kOfxImageEffectPropComponents, from.getStringProperty(kOfxImageEffectPropComponents));
+          setStringProperty(kOfxImageEffectPropPreMultiplication, from.getStringProperty(kOfxImageEffectPropPreMultiplication));
+          setDoubleProperty(kOfxImagePropPixelAspectRatio, from.getDoubleProperty(kOfxImagePropPixelAspectRatio));
+
+          std::ostringstream id;
+          id << from.getStringProperty(kOfxImagePropUniqueIdentifier) << "@" << renderScale.x << "," << renderScale.y;
+          setStringProperty(kOfxImagePropUniqueIdentifier, id.str());
+
+          int rowBytes = (bounds.x2 - bounds.x1) * getPixelBytes();
+          setIntProperty(kOfxImagePropRowBytes, rowBytes);
+          if(rowBytes > 0 && bounds.y2 > bounds.y1 && _pixels.alloc(size_t(rowBytes) * (bounds.y2 - bounds.y1)))
+            setPointerProperty(kOfxImagePropData, _pixels.getPtr());
+        }
+      };
+
+      /// a filter from one image to another, shared by the threads running it
+      struct Filter {
+        PixelConvert::Buffer  src;
+        PixelConvert::Buffer  dst;
+        int                   nComps;
+        double                ratioX;   ///< dst pixels per src pixel, for resampling
+        double                ratioY;
+        void                (*rows)(const Filter &filter, int y1, int y2);
+      };
+
+      /// address of row y of a buffer
+      static inline char *rowAddress(const PixelConvert::Buffer &buffer, int y)
+      {
+        return (char *)buffer.data + ptrdiff_t(y - buffer.bounds.y1) * buffer.rowBytes;
+      }
+
+      /// convert a row of a buffer to float
+      static void rowToFloat(const PixelConvert::Buffer &buffer, int y, int nComps, float *out)
+      {
+        PixelConvert::convertComponents(rowAddress(buffer, y), buffer.depth, out, PixelConvert::eDepthFloat,
+                                        size_t(buffer.bounds.x2 - buffer.bounds.x1) * nComps);
+      }
+
+      /// convert a float row into a row of a buffer
+      static void rowFromFloat(const float *in, const PixelConvert::Buffer &buffer, int y, int nComps)
+      {
+        PixelConvert::convertComponents(in, PixelConvert::eDepthFloat, rowAddress(buffer, y), buffer.depth,
+                                        size_t(buffer.bounds.x2 - buffer.bounds.x1) * nComps);
+      }
+
+      /// average n 2x2 blocks of pixels from two rows
+      static void boxPixels(const float *row0, const float *row1, float *out, size_t n, int nComps)
+      {
+#ifdef OFXH_PROXY_SSE2
+        if(nComps == 4) {
+          const __m128 quarter = _mm_set1_ps(0.25f);
+          for(size_t i = 0; i < n; ++i, row0 += 8, row1 += 8, out += 4) {
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0), _mm_loadu_ps(row0 + 4)),
+                                    _mm_add_ps(_mm_loadu_ps(row1), _mm_loadu_ps(row1 + 4)));
+            _mm_storeu_ps(out, _mm_mul_ps(sum, quarter));
+          }
+          return;
+        }
+#endif
+        for(size_t i = 0; i < n; ++i, row0 += 2 * nComps, row1 += 2 * nComps, out += nComps) {
+          for(int c = 0; c < nComps; ++c)
+            out[c] = (row0[c] + row0[c + nComps] + row1[c] + row1[c + nComps]) * 0.25f;
+        }
+      }
+
+      /// make rows y1 to y2 of a level from the level above, a pixel at the edge with no
+      /// neighbour in the level above is averaged with itself
+      static void halveRows(const Filter &filter, int y1, int y2)
+      {
+        const OfxRectI &sb = filter.src.bounds;
+        const OfxRectI &db = filter.dst.bounds;
+        const int c = filter.nComps;
+        const int srcWidth = sb.x2 - sb.x1;
+
+        // pad the source rows by a pixel at either end so every block is whole
+        std::vector<float> rows[2];
+        for(int r = 0; r < 2; ++r)
+          rows[r].resize(size_t(srcWidth + 2) * c);
+        std::vector<float> out(size_t(db.x2 - db.x1) * c);
+
+        // the padded row index of the first pixel of the first block
+        const int first = 2 * db.x1 - sb.x1 + 1;
+
+        for(int y = y1; y < y2; ++y) {
+          int sy[2] = { 2 * y, 2 * y + 1 };
+          if(sy[0] < sb.y1)
+            sy[0] = sy[1];
+          if(sy[1] >= sb.y2)
+            sy[1] = sy[0];
+
+          for(int r = 0; r < 2; ++r) {
+            float *row = &rows[r][0];
+            rowToFloat(filter.src, sy[r], c, row + c);
+            memcpy(row, row + c, c * sizeof(float));
+            memcpy(row + size_t(srcWidth + 1) * c, row + size_t(srcWidth) * c, c * sizeof(float));
+          }
+
+          boxPixels(&rows[0][size_t(first) * c], &rows[1][size_t(first) * c], &out[0], db.x2 - db.x1, c);
+          rowFromFloat(&out[0], filter.dst, y, c);
+        }
+      }
+
+      /// resample rows y1 to y2 bilinearly, sampling at pixel centres and clamping at the edges
+      static void resampleRows(const Filter &filter, int y1, int y2)
+      {
+        const OfxRectI &sb = filter.src.bounds;
+        const OfxRectI &db = filter.dst.bounds;
+        const int c = filter.nComps;
+        const int srcWidth = sb.x2 - sb.x1;
+        const int dstWidth = db.x2 - db.x1;
+
+        // where each column samples from, as offsets into a source row
+        std::vector<int> x0(dstWidth), x1(dstWidth);
+        std::vector<float> fx(dstWidth);
+        for(int x = 0; x < dstWidth; ++x) {
+          double u = (db.x1 + x + 0.5) / filter.ratioX - 0.5 - sb.x1;
+          int i = int(floor(u));
+          fx[x] = float(u - i);
+          x0[x] = Maximum(0, Minimum(i, srcWidth - 1)) * c;
+          x1[x] = Maximum(0, Minimum(i + 1, srcWidth - 1)) * c;
+        }
+
+        std::vector<float> rows[2];
+        int rowY[2] = { sb.y1 - 1, sb.y1 - 1 };
+        for(int r = 0; r < 2; ++r)
+          rows[r].resize(size_t(srcWidth) * c);
+        std::vector<float> out(size_t(dstWidth) * c);
+
+        for(int y = y1; y < y2; ++y) {
+          double v = (y + 0.5) / filter.ratioY - 0.5;
+          int j = int(floor(v));
+          float fy = float(v - j);
+          int sy[2] = { Maximum(sb.y1, Minimum(j, sb.y2 - 1)), Maximum(sb.y1, Minimum(j + 1, sb.y2 - 1)) };
+
+          // rows only move forward, so keep what we can of the last two
+          for(int r = 0; r < 2; ++r) {
+            if(rowY[r] == sy[r])
+              continue;
+            if(r == 0 && rowY[1] == sy[0]) {
+              rows[0].swap(rows[1]);
+              rowY[0] = sy[0];
+              rowY[1] = sb.y1 - 1;
+              continue;
+            }
+            rowToFloat(filter.src, sy[r], c, &rows[r][0]);
+            rowY[r] = sy[r];
+          }
+
+          const float *r0 = &rows[0][0];
+          const float *r1 = &rows[1][0];
+          float *o = &out[0];
+          for(int x = 0; x < dstWidth; ++x, o += c) {
+            const float *a0 = r0 + x0[x], *a1 = r0 + x1[x];
+            const float *b0 = r1 + x0[x], *b1 = r1 + x1[x];
+            for(int k = 0; k < c; ++k) {
+              float top = a0[k] + (a1[k] - a0[k]) * fx[x];
+              float bottom = b0[k] + (b1[k] - b0[k]) * fx[x];
+              o[k] = top + (bottom - top) * fy;
+            }
+          }
+          rowFromFloat(&out[0], filter.dst, y, c);
+        }
+      }
+
+      /// thread function, each thread takes an even share of the rows
+      static void filterThread(unsigned int threadIndex, unsigned int threadMax, void *customArg)
+      {
+        const Filter &filter = *(const Filter *)customArg;
+        int rows = filter.dst.bounds.y2 - filter.dst.bounds.y1;
+        int y1 = filter.dst.bounds.y1 + int((long long)rows * threadIndex / threadMax);
+        int y2 = filter.dst.bounds.y1 + int((long long)rows * (threadIndex + 1) / threadMax);
+        filter.rows(filter, y1, y2);
+      }
+
+      /// filter src into dst, returns false if either's pixels can't be addressed
+      static bool runFilter(Filter &filter, const Image &src, const Image &dst)
+      {
+        filter.src = PixelConvert::getBuffer(src);
+        filter.dst = PixelConvert::getBuffer(dst);
+        filter.nComps = PixelConvert::getComponentCount(filter.src.components);
+        if(!filter.src.data || !filter.dst.data || filter.nComps == 0 || filter.src.depth == PixelConvert::eDepthNone)
+          return false;
+
+        int width = filter.dst.bounds.x2 - filter.dst.bounds.x1;
+        int rows = filter.dst.bounds.y2 - filter.dst.bounds.y1;
+        if(width <= 0 || rows <= 0 || filter.src.bounds.x2 <= filter.src.bounds.x1 || filter.src.bounds.y2 <= filter.src.bounds.y1)
+          return true;
+
+        MultiThread::ThreadPool &pool = MultiThread::ThreadPool::getDefault();
+        long long nJobs = (long long)width * rows / kMinPixelsPerJob;
+        nJobs = Minimum(nJobs, (long long)rows);
+        nJobs = Minimum(nJobs, (long long)pool.getNumCPUs());
+
+        if(nJobs <= 1)
+          filter.rows(filter, filter.dst.bounds.y1, filter.dst.bounds.y2);
+        else
+          pool.multiThreadHost(filterThread, (unsigned int)nJobs, &filter);
+        return true;
+      }
+
+      ////////////////////////////////////////////////////////////////////////////////
+      // ProxyPyramid
+
+      ProxyPyramid::ProxyPyramid(ClipInstance &clip, Image &image)
+        : _clip(clip)
+        , _levels(kMaxLevels, (Image *)0)
+        , _bytes(0)
+      {
+        _levels[0] = &image;
+        image.addReference();
+        image.getDoublePropertyN(kOfxImageEffectPropRenderScale, &_scale.x, 2);
+      }
+
+      ProxyPyramid::~ProxyPyramid()
+      {
+        for(size_t i = 0; i < _levels.size(); ++i) {
+          if(_levels[i])
+            _levels[i]->releaseReference();
+        }
+      }
+
+      size_t ProxyPyramid::getBytes() const
+      {
+        // not under the lock, a cache evicting us may be purging from inside getLevel
+        return _bytes;
+      }
+
+      Image *ProxyPyramid::getLevel(int n)
+      {
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          if(_levels[n]) {
+            _levels[n]->addReference();
+            return _levels[n];
+          }
+        }
+
+        Image *above = getLevel(n - 1);
+        if(!above)
+          return 0;
+
+        OfxPointD scale = { _scale.x / (1 << n), _scale.y / (1 << n) };
+        OfxRectI bounds = above->getBounds();
+        OfxRectI rod = above->getROD();
+        bounds.x1 = floorHalf(bounds.x1); bounds.y1 = floorHalf(bounds.y1);
+        bounds.x2 = ceilHalf(bounds.x2);  bounds.y2 = ceilHalf(bounds.y2);
+        rod.x1 = floorHalf(rod.x1); rod.y1 = floorHalf(rod.y1);
+        rod.x2 = ceilHalf(rod.x2);  rod.y2 = ceilHalf(rod.y2);
+
+        // allocating this may purge, so the lock must not be held
+        Image *level = new ProxyImage(_clip, *above, scale, bounds, rod);
+        Filter filter;
+        filter.rows = halveRows;
+        bool filtered = runFilter(filter, *above, *level);
+        above->releaseReference();
+        if(!filtered) {
+          level->releaseReference();
+          return 0;
+        }
+
+        std::lock_guard<std::mutex> guard(_lock);
+        if(_levels[n]) {
+          // another thread got there first
+          level->releaseReference();
+          level = _levels[n];
+        }
+        else {
+          _levels[n] = level;
+          _bytes += imageBytes(*level);
+        }
+        level->addReference();
+        return level;
+      }
+
+      Image *ProxyPyramid::getImage(OfxPointD renderScale)
+      {
+        if(renderScale.x <= 0 || renderScale.y <= 0 ||
+           renderScale.x > _scale.x * (1 + kScaleTolerance) ||
+           renderScale.y > _scale.y * (1 + kScaleTolerance))
+          return 0;
+
+        // the smallest level still at least as large as asked for
+        int n = 0;
+        while(n + 1 < kMaxLevels &&
+              _scale.x / (2 << n) >= renderScale.x * (1 - kScaleTolerance) &&
+              _scale.y / (2 << n) >= renderScale.y * (1 - kScaleTolerance))
+          ++n;
+
+        Image *level = getLevel(n);
+        if(!level)
+          return 0;
+
+        OfxPointD levelScale = { _scale.x / (1 << n), _scale.y / (1 << n) };
+        if(fabs(levelScale.x - renderScale.x) <= levelScale.x * kScaleTolerance &&
+           fabs(levelScale.y - renderScale.y) <= levelScale.y * kScaleTolerance)
+          return level;
+
+        // in between levels, resample the larger
+        Filter filter;
+        filter.rows = resampleRows;
+        filter.ratioX = renderScale.x / levelScale.x;
+        filter.ratioY = renderScale.y / levelScale.y;
+
+        OfxRectI bounds = level->getBounds();
+        OfxRectI rod = level->getROD();
+        bounds.x1 = int(floor(bounds.x1 * filter.ratioX)); bounds.y1 = int(floor(bounds.y1 * filter.ratioY));
+        bounds.x2 = int(ceil(bounds.x2 * filter.ratioX));  bounds.y2 = int(ceil(bounds.y2 * filter.ratioY));
+        rod.x1 = int(floor(rod.x1 * filter.ratioX)); rod.y1 = int(floor(rod.y1 * filter.ratioY));
+        rod.x2 = int(ceil(rod.x2 * filter.ratioX));  rod.y2 = int(ceil(rod.y2 * filter.ratioY));
+
+        ProxyImage *image = new ProxyImage(_clip, *level, renderScale, bounds, rod);
+        bool filtered = runFilter(filter, *level, *image);
+        level->releaseReference();
+        if(!filtered) {
+          image->releaseReference();
+          return 0;
+        }
+        return image;
+      }
+
+      ////////////////////////////////////////////////////////////////////////////////
+      // ProxyCache
+
+      ProxyCache::ProxyCache(Instance &instance, size_t maxFrames)
+        : Memory::Purgeable(ePurgeCached)
+        , _instance(instance)
+        , _spill(0)
+        , _maxFrames(maxFrames)
+        , _clock(0)
+      {
+        _instance.setProxyCache(this);
+        Memory::Governor::get().add(this);
+      }
+
+      ProxyCache::~ProxyCache()
+      {
+        Memory::Governor::get().remove(this);
+
+        if(_instance.getProxyCache() == this)
+          _instance.setProxyCache(0);
+        clear();
+      }
+
+      void ProxyCache::setMaxFrames(size_t n)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _maxFrames = n;
+        while(_entries.size() > _maxFrames)
+          evictOne();
+      }
+
+      void ProxyCache::setSpillCache(SpillCache *spill)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _spill = spill;
+      }
+
+      void ProxyCache::release(std::map<Key, Entry>::iterator it)
+      {
+        Memory::Governor::get().released(it->second.bytes);
+        _entries.erase(it);
+      }
+
+      size_t ProxyCache::evictOne()
+      {
+        std::map<Key, Entry>::iterator oldest = _entries.begin();
+        for(std::map<Key, Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+          if(it->second.lastUsed < oldest->second.lastUsed)
+            oldest = it;
+        }
+        if(oldest == _entries.end())
+          return 0;
+
+        // only the image itself is worth keeping, the levels are quick to make again
+        if(_spill)
+          _spill->spill(oldest->first.clip, oldest->first.time, oldest->second.pyramid->getImage());
+
+        size_t bytes = oldest->second.bytes + oldest->second.pyramid->getBytes();
+        release(oldest);
+        return bytes;
+      }
+
+      size_t ProxyCache::purge(size_t nBytes)
+      {
+        // the released counts and the levels' own memory are what the governor sees as freed
+        std::lock_guard<std::mutex> guard(_lock);
+        size_t freed = 0;
+        while(!_entries.empty() && freed < nBytes)
+          freed += evictOne();
+        return 0;
+      }
+
+      /// does the image cover the canonical bounds, or all its RoD if there are none
+      static bool covers(const Image &image, const OfxRectD *optionalBounds)
+      {
+        OfxRectI bounds = image.getBounds();
+        OfxRectI want = image.getROD();
+        if(optionalBounds) {
+          double scale[2];
+          image.getDoublePropertyN(kOfxImageEffectPropRenderScale, scale, 2);
+          double par = image.getDoubleProperty(kOfxImagePropPixelAspectRatio);
+          if(par <= 0)
+            par = 1;
+          OfxRectI asked;
+          asked.x1 = int(floor(optionalBounds->x1 * scale[0] / par));
+          asked.y1 = int(floor(optionalBounds->y1 * scale[1]));
+          asked.x2 = int(ceil(optionalBounds->x2 * scale[0] / par));
+          asked.y2 = int(ceil(optionalBounds->y2 * scale[1]));
+          want = Intersection(want, asked);
+        }
+        if(want.x1 >= want.x2 || want.y1 >= want.y2)
+          return true;
+        return bounds.x1 <= want.x1 && bounds.y1 <= want.y1 && bounds.x2 >= want.x2 && bounds.y2 >= want.y2;
+      }
+
+      Image *ProxyCache::getImage(ClipInstance *clip, OfxTime time, OfxPointD renderScale, const OfxRectD *optionalBounds)
+      {
+        Key key = { clip, time };
+        touch();
+
+        std::shared_ptr<ProxyPyramid> pyramid;
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          std::map<Key, Entry>::iterator it = _entries.find(key);
+          if(it != _entries.end()) {
+            OfxPointD scale = it->second.pyramid->getScale();
+            if(scale.x * (1 + kScaleTolerance) >= renderScale.x &&
+               scale.y * (1 + kScaleTolerance) >= renderScale.y &&
+               covers(it->second.pyramid->getImage(), optionalBounds)) {
+              it->second.lastUsed = ++_clock;
+              pyramid = it->second.pyramid;
+            }
+          }
+        }
+
+        // from the cache, outside the lock as it may have to filter
+        if(pyramid) {
+          Image *image = pyramid->getImage(renderScale);
+          if(image)
+            return image;
+        }
+
+        // then the spill tier, which gives up the image if it has it
+        Image *image = 0;
+        SpillCache *spill;
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          spill = _spill;
+        }
+        if(spill) {
+          image = spill->fetch(clip, time);
+          if(image) {
+            double scale[2];
+            image->getDoublePropertyN(kOfxImageEffectPropRenderScale, scale, 2);
+            if(scale[0] * (1 + kScaleTolerance) < renderScale.x || scale[1] * (1 + kScaleTolerance) < renderScale.y ||
+               !covers(*image, optionalBounds)) {
+              image->releaseReference();
+              image = 0;
+            }
+          }
+        }
+
+        if(!image)
+          image = clip->getImage(time, optionalBounds);
+        if(!image)
+          return 0;
+
+        // at a lower scale than asked for, nothing we can do with it
+        double scale[2];
+        image->getDoublePropertyN(kOfxImageEffectPropRenderScale, scale, 2);
+        if(scale[0] * (1 + kScaleTolerance) < renderScale.x || scale[1] * (1 + kScaleTolerance) < renderScale.y)
+          return image;
+
+        pyramid.reset(new ProxyPyramid(*clip, *image));
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          std::map<Key, Entry>::iterator it = _entries.find(key);
+          if(it != _entries.end())
+            release(it);
+
+          Entry entry;
+          entry.pyramid = pyramid;
+          entry.bytes = imageBytes(*image);
+          entry.lastUsed = ++_clock;
+          _entries[key] = entry;
+          Memory::Governor::get().allocated(entry.bytes);
+
+          while(_entries.size() > _maxFrames)
+            evictOne();
+        }
+
+        // the pyramid has its own reference on the image
+        Image *scaled = pyramid->getImage(renderScale);
+        if(scaled) {
+          image->releaseReference();
+          image = scaled;
+        }
+
+        Memory::Governor::get().enforce();
+        return image;
+      }
+
+      void ProxyCache::clear()
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        while(!_entries.empty())
+          release(_entries.begin());
+        if(_spill)
+          _spill->clear();
+      }
+
+      void ProxyCache::clear(ClipInstance *clip)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(_spill)
+          _spill->clear(clip);
+        std::map<Key, Entry>::iterator it = _entries.begin();
+        while(it != _entries.end()) {
+          if(it->first.clip == clip)
+            release(it++);
+          else
+            ++it;
+        }
+      }
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
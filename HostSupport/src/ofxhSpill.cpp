@@ -0,0 +1,361 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdio>
+#include <cstring>
+
+// ofx
+#include "ofxCore.h"
+#include "ofxImageEffect.h"
+
+// ofx host
+#include "ofxhBinary.h"
+#include "ofxhUtilities.h"
+#include "ofxhPropertySuite.h"
+#include "ofxhClip.h"
+#include "ofxhMemoryGovernor.h"
+#include "ofxhSpill.h"
+
+#if defined(UNIX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace ImageEffect {
+
+#if defined(UNIX)
+      /// An image promoted from a spill file, whose pixels are a private mapping of it.
+      /// The file has already been removed, the mapping keeps its pages. Its memory is
+      /// counted by the cache it is promoted into, as any other image it holds.
+      class MappedImage : public Image {
+      protected :
+        void   *_mapping;
+        size_t  _size;
+
+      public :
+        MappedImage(ClipInstance &clip, const std::string &depth, const std::string &components,
+                    const std::string &preMultiplication, double pixelAspectRatio,
+                    OfxPointD renderScale, void *mapping, size_t size,
+                    const OfxRectI &bounds, const OfxRectI &rod, int rowBytes,
+                    const std::string &field, const std::string &uniqueIdentifier)
+          : Image(clip, renderScale.x, renderScale.y, mapping, bounds, rod, rowBytes, field, uniqueIdentifier)
+          , _mapping(mapping)
+          , _size(size)
+        {
+          // as it was spilt, which may not be as the clip is now
+          setStringProperty(kOfxImageEffectPropPixelDepth, depth);
+          setStringProperty(kOfxImageEffectPropComponents, components);
+          setStringProperty(kOfxImageEffectPropPreMultiplication, preMultiplication);
+          setDoubleProperty(kOfxImagePropPixelAspectRatio, pixelAspectRatio);
+        }
+
+        virtual ~MappedImage()
+        {
+          munmap(_mapping, _size);
+        }
+      };
+
+      /// write an image's rows bottom up with no padding to a new file, returns false on failure
+      static bool writeImage(const std::string &path, Image &image, size_t bytes, int rowBytes)
+      {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if(fd < 0)
+          return false;
+
+        void *mapping = MAP_FAILED;
+        if(ftruncate(fd, (off_t)bytes) == 0)
+          mapping = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED) {
+          unlink(path.c_str());
+          return false;
+        }
+
+        OfxRectI bounds = image.getBounds();
+        const char *src = static_cast<const char *>(image.getPointerProperty(kOfxImagePropData));
+        int srcRowBytes = image.getIntProperty(kOfxImagePropRowBytes);
+        char *dst = static_cast<char *>(mapping);
+        for(int y = bounds.y1; y < bounds.y2; ++y)
+          memcpy(dst + (ptrdiff_t)(y - bounds.y1) * rowBytes, src + (ptrdiff_t)(y - bounds.y1) * srcRowBytes, rowBytes);
+
+        // the pages go out in the background, we only need them out of our address space
+        munmap(mapping, bytes);
+        return true;
+      }
+#endif
+
+      SpillCache::SpillCache(const std::string &directory, size_t diskBudget)
+        : _directory(directory)
+        , _budget(diskBudget)
+        , _bytes(0)
+        , _clock(0)
+        , _nFiles(0)
+        , _writing(false)
+        , _stop(false)
+      {
+#if defined(UNIX)
+        mkdir(_directory.c_str(), 0700);
+        _writer = std::thread(&SpillCache::writerMain, this);
+#endif
+      }
+
+      SpillCache::~SpillCache()
+      {
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          _stop = true;
+        }
+        _wake.notify_all();
+        if(_writer.joinable())
+          _writer.join();
+
+        clear();
+      }
+
+      void SpillCache::remove(std::map<Key, Entry>::iterator it)
+      {
+        Entry &entry = it->second;
+        if(entry.pending) {
+          entry.pending->releaseReference();
+          Memory::Governor::get().released(entry.bytes);
+        }
+#if defined(UNIX)
+        if(!entry.path.empty())
+          unlink(entry.path.c_str());
+#endif
+        _bytes -= entry.bytes;
+        _entries.erase(it);
+      }
+
+      bool SpillCache::makeRoom(size_t nBytes)
+      {
+        if(nBytes > _budget)
+          return false;
+
+        while(_bytes + nBytes > _budget && !_entries.empty()) {
+          std::map<Key, Entry>::iterator oldest = _entries.begin();
+          for(std::map<Key, Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if(it->second.spilt < oldest->second.spilt)
+              oldest = it;
+          }
+          remove(oldest);
+        }
+        return true;
+      }
+
+      void SpillCache::setBudget(size_t nBytes)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        _budget = nBytes;
+        makeRoom(0);
+      }
+
+      size_t SpillCache::getBytes()
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _bytes;
+      }
+
+      size_t SpillCache::getCount()
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _entries.size();
+      }
+
+      void SpillCache::spill(ClipInstance *clip, OfxTime time, Image &image)
+      {
+#if defined(UNIX)
+        OfxRectI bounds = image.getBounds();
+        int rowBytes = (bounds.x2 - bounds.x1) * image.getPixelBytes();
+        if(rowBytes <= 0 || bounds.y2 <= bounds.y1 || !image.getPointerProperty(kOfxImagePropData))
+          return;
+
+        Key key = { clip, time };
+        Entry entry;
+        entry.pending = &image;
+        entry.bytes = size_t(rowBytes) * size_t(bounds.y2 - bounds.y1);
+        entry.bounds = bounds;
+        entry.rod = image.getROD();
+        entry.rowBytes = rowBytes;
+        image.getDoublePropertyN(kOfxImageEffectPropRenderScale, &entry.renderScale.x, 2);
+        entry.pixelAspectRatio = image.getDoubleProperty(kOfxImagePropPixelAspectRatio);
+        entry.depth = image.getStringProperty(kOfxImageEffectPropPixelDepth);
+        entry.components = image.getStringProperty(kOfxImageEffectPropComponents);
+        entry.preMultiplication = image.getStringProperty(kOfxImageEffectPropPreMultiplication);
+        entry.field = image.getStringProperty(kOfxImagePropField);
+        entry.uniqueIdentifier = image.getStringProperty(kOfxImagePropUniqueIdentifier);
+
+        {
+          std::lock_guard<std::mutex> guard(_lock);
+          std::map<Key, Entry>::iterator it = _entries.find(key);
+          if(it != _entries.end())
+            remove(it);
+          if(_stop || !makeRoom(entry.bytes))
+            return;
+
+          entry.spilt = ++_clock;
+          image.addReference();
+          Memory::Governor::get().allocated(entry.bytes);
+          _entries[key] = entry;
+          _bytes += entry.bytes;
+          _queue.push_back(key);
+        }
+        _wake.notify_one();
+#endif
+      }
+
+      void SpillCache::writerMain()
+      {
+#if defined(UNIX)
+        std::unique_lock<std::mutex> guard(_lock);
+        for(;;) {
+          while(!_stop && _queue.empty()) {
+            _idle.notify_all();
+            _wake.wait(guard);
+          }
+          if(_stop)
+            break;
+
+          Key key = _queue.front();
+          _queue.pop_front();
+
+          // it may have been fetched or dropped since it was queued
+          std::map<Key, Entry>::iterator it = _entries.find(key);
+          if(it == _entries.end() || !it->second.pending)
+            continue;
+
+          Image *image = it->second.pending;
+          image->addReference();
+          size_t bytes = it->second.bytes;
+          int rowBytes = it->second.rowBytes;
+          char name[64];
+          snprintf(name, sizeof(name), "/ofxspill-%ld-%llu", (long)getpid(), ++_nFiles);
+          std::string path = _directory + name;
+          _writing = true;
+
+          guard.unlock();
+          bool written = writeImage(path, *image, bytes, rowBytes);
+          guard.lock();
+
+          // only keep the file if the entry is still the one we wrote
+          it = _entries.find(key);
+          if(it != _entries.end() && it->second.pending == image) {
+            if(written) {
+              it->second.path = path;
+              it->second.pending = 0;
+              image->releaseReference();
+              Memory::Governor::get().released(bytes);
+            }
+            else
+              remove(it);
+          }
+          else if(written)
+            unlink(path.c_str());
+
+          image->releaseReference();
+          _writing = false;
+        }
+#endif
+      }
+
+      Image *SpillCache::fetch(ClipInstance *clip, OfxTime time)
+      {
+        Key key = { clip, time };
+        std::lock_guard<std::mutex> guard(_lock);
+        std::map<Key, Entry>::iterator it = _entries.find(key);
+        if(it == _entries.end())
+          return 0;
+
+        Entry &entry = it->second;
+        Image *image = 0;
+        if(entry.pending) {
+          // not written yet, hand back the image itself
+          image = entry.pending;
+          image->addReference();
+        }
+#if defined(UNIX)
+        else {
+          int fd = open(entry.path.c_str(), O_RDONLY);
+          if(fd >= 0) {
+            // private and writable so a plugin scribbling on its input can't hurt anything
+            void *mapping = mmap(0, entry.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if(mapping != MAP_FAILED) {
+              madvise(mapping, entry.bytes, MADV_WILLNEED);
+              image = new MappedImage(*clip, entry.depth, entry.components, entry.preMultiplication,
+                                      entry.pixelAspectRatio, entry.renderScale, mapping, entry.bytes,
+                                      entry.bounds, entry.rod, entry.rowBytes, entry.field, entry.uniqueIdentifier);
+            }
+          }
+        }
+#endif
+
+        remove(it);
+        return image;
+      }
+
+      void SpillCache::flush()
+      {
+        std::unique_lock<std::mutex> guard(_lock);
+        while(!_stop && _writer.joinable() && (_writing || !_queue.empty()))
+          _idle.wait(guard);
+      }
+
+      void SpillCache::clear()
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        while(!_entries.empty())
+          remove(_entries.begin());
+        _queue.clear();
+      }
+
+      void SpillCache::clear(ClipInstance *clip)
+      {
+        std::lock_guard<std::mutex> guard(_lock);
+        std::map<Key, Entry>::iterator it = _entries.begin();
+        while(it != _entries.end()) {
+          if(it->first.clip == clip)
+            remove(it++);
+          else
+            ++it;
+        }
+      }
+
+    } // namespace ImageEffect
+
+  } // namespace Host
+
+} // namespace OFX
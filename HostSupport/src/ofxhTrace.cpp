@@ -0,0 +1,320 @@
+
+/*
+Software License :
+
+Copyright (c) 2007-2009, The Open Effects Association Ltd.  All Rights Reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+    * Neither the name The Open Effects Association Ltd, nor the names of its 
+      contributors may be used to endorse or promote products derived from this
+      software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+// ofx
+#include "ofxCore.h"
+
+// ofx host
+#include "ofxhUtilities.h"
+#include "ofxhTrace.h"
+
+namespace OFX {
+
+  namespace Host {
+
+    namespace Trace {
+
+      std::atomic<bool> gEnabled(false);
+
+      /// a ring of events written only by the thread that owns it
+      struct Ring {
+        std::vector<Event>            events;
+        std::atomic<unsigned long long> head;  ///< count of events ever written
+        std::atomic<unsigned long long> tail;  ///< events before this have been cleared
+        int                           threadId;
+        std::vector<unsigned char>    results;      ///< the events' results, back to back
+        std::atomic<unsigned long long> resultsHead;  ///< count of result bytes ever written
+
+        Ring(size_t n, int id)
+          : events(n)
+          , head(0)
+          , tail(0)
+          , threadId(id)
+          , results(Maximum(n * kResultBytesPerEvent, kResultBytes))
+          , resultsHead(0)
+        {}
+      };
+
+      /// every ring ever made, rings outlive their threads so their events can still be written
+      struct Registry {
+        std::mutex          lock;
+        std::vector<Ring *> rings;
+        size_t              ringSize;
+        long long           originTicks;  ///< the trace clock when this was made
+        long long           originNanos;  ///< the steady clock at the same moment
+
+        Registry()
+          : ringSize(16384)
+          , originTicks(now())
+          , originNanos(steadyNow())
+        {}
+      };
+
+      /// never destroyed, so the trace can be written at exit
+      static Registry &getRegistry()
+      {
+        static Registry *gRegistry = new Registry;
+        return *gRegistry;
+      }
+
+      static thread_local Ring *tRing = 0;
+
+      void setEnabled(bool enable)
+      {
+        // note where the clocks start before anything is stamped
+        getRegistry();
+        gEnabled.store(enable, std::memory_order_relaxed);
+      }
+
+      void setBufferSize(size_t nEvents)
+      {
+        Registry &registry = getRegistry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        // a power of two, so finding a slot is a mask rather than a divide
+        size_t n = 1;
+        while(n < nEvents)
+          n <<= 1;
+        registry.ringSize = n;
+      }
+
+      void clear()
+      {
+        Registry &registry = getRegistry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        for(size_t i = 0; i < registry.rings.size(); ++i)
+          registry.rings[i]->tail.store(registry.rings[i]->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+      }
+
+      long long steadyNow()
+      {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+      }
+
+      void record(const Event &event, const unsigned char *results)
+      {
+        Ring *ring = tRing;
+        if(!ring) {
+          // first event on this thread, the only time we lock
+          Registry &registry = getRegistry();
+          std::lock_guard<std::mutex> guard(registry.lock);
+          ring = new Ring(registry.ringSize, int(registry.rings.size()));
+          registry.rings.push_back(ring);
+          tRing = ring;
+        }
+
+        unsigned long long head = ring->head.load(std::memory_order_relaxed);
+        Event &slot = ring->events[head & (ring->events.size() - 1)];
+        slot = event;
+
+        // results go in their own ring, so events without any cost nothing for them
+        if(results && event.nResults) {
+          unsigned long long at = ring->resultsHead.load(std::memory_order_relaxed);
+          size_t size = ring->results.size();
+          size_t offset = size_t(at & (size - 1));
+          size_t part = Minimum(size - offset, size_t(event.nResults));
+          memcpy(&ring->results[offset], results, part);
+          memcpy(&ring->results[0], results + part, event.nResults - part);
+          slot.resultsAt = at;
+          ring->resultsHead.store(at + event.nResults, std::memory_order_release);
+        }
+        else
+          slot.nResults = 0;
+
+        ring->head.store(head + 1, std::memory_order_release);
+      }
+
+      /// write a string as a JSON string
+      static void writeString(std::ostream &out, const char *s)
+      {
+        out << '"';
+        for(; *s; ++s) {
+          if(*s == '"' || *s == '\\')
+            out << '\\';
+          out << *s;
+        }
+        out << '"';
+      }
+
+      /// write the results packed by Scope::result and Scope::value as an object of named arrays
+      static void writeResults(std::ostream &out, const Event &event, const unsigned char *results)
+      {
+        out << ",\"result\":{";
+        bool inArray = false;
+        bool first = true;
+        size_t i = 0;
+        while(i < event.nResults) {
+          unsigned char tag = results[i++];
+          const unsigned char *bytes = results + i;
+          if(tag == 'n') {
+            out << (inArray ? "]," : "");
+            writeString(out, (const char *)bytes);
+            out << ":[";
+            inArray = true;
+            first = true;
+            i += strlen((const char *)bytes) + 1;
+            continue;
+          }
+
+          // a value before any name, which Scope doesn't stop
+          if(!inArray) {
+            out << "\"\":[";
+            inArray = true;
+          }
+          out << (first ? "" : ",");
+          first = false;
+          if(tag == 'd') {
+            double v;
+            memcpy(&v, bytes, sizeof(v));
+            out << v;
+            i += sizeof(v);
+          }
+          else {
+            writeString(out, (const char *)bytes);
+            i += strlen((const char *)bytes) + 1;
+          }
+        }
+        out << (inArray ? "]" : "") << "}";
+        if(event.truncated)
+          out << ",\"truncated\":true";
+      }
+
+      /// write an event as a chrome 'complete' event, nanosPerTick converts the trace clock
+      static void writeEvent(std::ostream &out, const Event &event, const Ring &ring,
+                             const Registry &registry, double nanosPerTick)
+      {
+        double start = registry.originNanos + (event.start - registry.originTicks) * nanosPerTick;
+        out << "{\"name\":\"" << event.action << "\",\"cat\":\"ofx\",\"ph\":\"X\""
+            << ",\"ts\":" << start / 1000.0
+            << ",\"dur\":" << event.duration * nanosPerTick / 1000.0
+            << ",\"pid\":1,\"tid\":" << ring.threadId
+            << ",\"args\":{\"instance\":\"" << event.instance << "\""
+            << ",\"status\":\"" << StatStr(event.stat) << "\"";
+        if(event.hasTime)
+          out << ",\"time\":" << event.time;
+        if(event.hasWindow)
+          out << ",\"window\":[" << event.window.x1 << "," << event.window.y1 << "," << event.window.x2 << "," << event.window.y2 << "]";
+        if(event.nResults || event.truncated) {
+          // copy them out of the result ring, unless they have been written over since
+          unsigned char results[kResultBytes];
+          Event copy = event;
+          size_t size = ring.results.size();
+          if(ring.resultsHead.load(std::memory_order_acquire) - event.resultsAt > size - event.nResults) {
+            copy.nResults = 0;
+            copy.truncated = true;
+          }
+          for(unsigned int i = 0; i < copy.nResults; ++i)
+            results[i] = ring.results[(event.resultsAt + i) & (size - 1)];
+          writeResults(out, copy, results);
+        }
+        out << "}}";
+      }
+
+      void writeChromeTrace(std::ostream &out)
+      {
+        Registry &registry = getRegistry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+
+        // how fast the trace clock has run against the steady one since the registry was made
+        long long ticks = now() - registry.originTicks;
+        long long nanos = steadyNow() - registry.originNanos;
+        double nanosPerTick = ticks > 0 && nanos > 0 ? double(nanos) / double(ticks) : 1.0;
+
+        // timestamps are in microseconds, keep the nanoseconds
+        std::streamsize precision = out.precision(16);
+
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for(size_t i = 0; i < registry.rings.size(); ++i) {
+          Ring *ring = registry.rings[i];
+          unsigned long long head = ring->head.load(std::memory_order_acquire);
+          unsigned long long tail = ring->tail.load(std::memory_order_relaxed);
+          unsigned long long size = ring->events.size();
+          if(head - tail > size)
+            tail = head - size;
+
+          for(unsigned long long e = tail; e < head; ++e) {
+            if(!first)
+              out << ",\n";
+            first = false;
+            writeEvent(out, ring->events[e % size], *ring, registry, nanosPerTick);
+          }
+        }
+        out << "],\"displayTimeUnit\":\"ms\"}\n";
+        out.precision(precision);
+      }
+
+      bool writeChromeTrace(const std::string &path)
+      {
+        std::ofstream out(path.c_str());
+        if(!out)
+          return false;
+        writeChromeTrace(out);
+        return bool(out);
+      }
+
+      /// turns tracing on at startup and writes it at exit if OFX_HOST_TRACE is set
+      class EnvironmentTrace {
+        std::string _path;
+
+      public :
+        EnvironmentTrace()
+        {
+          const char *path = getenv("OFX_HOST_TRACE");
+          if(path && *path) {
+            _path = path;
+            setEnabled(true);
+          }
+        }
+
+        ~EnvironmentTrace()
+        {
+          if(!_path.empty()) {
+            setEnabled(false);
+            if(!writeChromeTrace(_path))
+              std::cerr << "could not write OFX trace to " << _path << std::endl;
+          }
+        }
+      };
+
+      static EnvironmentTrace gEnvironmentTrace;
+
+    } // namespace Trace
+
+  } // namespace Host
+
+} // namespace OFX
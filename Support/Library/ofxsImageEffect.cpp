@@ -895,7 +895,7 @@ namespace OFX {
     if(x < _bounds.x1 || x >= _bounds.x2 || y < _bounds.y1 || y >= _bounds.y2 || _pixelBytes == 0)
       return 0;
 
-    char *pix = ((char *) _pixelData) + (size_t)(y - _bounds.y1) * _rowBytes;
+    char *pix = ((char *) _pixelData) + (ptrdiff_t)(y - _bounds.y1) * _rowBytes;
     pix += (x - _bounds.x1) * _pixelBytes;
     return (void *) pix;   
   }
@@ -906,7 +906,7 @@ namespace OFX {
     if(x < _bounds.x1 || x >= _bounds.x2 || y < _bounds.y1 || y >= _bounds.y2 || _pixelBytes == 0)
       return 0;
 
-    const char *pix = ((const char *) _pixelData) + (size_t)(y - _bounds.y1) * _rowBytes;
+    const char *pix = ((const char *) _pixelData) + (ptrdiff_t)(y - _bounds.y1) * _rowBytes;
     pix += (x - _bounds.x1) * _pixelBytes;
     return (const void *) pix;
   }